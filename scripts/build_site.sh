@@ -65,5 +65,12 @@ build(){
 	log "Writing preprocessed page(s)..."
 	echo $INSRC > http/index.html.in
 	mv http/index.html.in http/index.html
+
+	# The server sends these instead of the originals to clients that accept them
+	log "Precompressing..."
+	find http/ -type f \( -name "*.html" -o -name "*.css" -o -name "*.js" \) | while read -r FILE; do
+		gzip -9 -k -f "$FILE"
+		command -v brotli >/dev/null 2>&1 && brotli -q 11 -f "$FILE"
+	done
 	log "Finished."
 }; build $1;
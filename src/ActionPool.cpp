@@ -0,0 +1,120 @@
+#include "ActionPool.h"
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace {
+
+struct Cache;
+
+struct Block {
+	/**
+	 * The cache the block goes back to when it's freed, or null if it was
+	 * too big for the pool.
+	 */
+	Cache* owner;
+	Block* next;
+	alignas(std::max_align_t) unsigned char data[ActionPool::kBlockSize];
+};
+
+struct Cache {
+	/**
+	 * Free blocks, only touched by the thread that owns the cache.
+	 */
+	Block* local = nullptr;
+
+	/**
+	 * Blocks freed by other threads. They only ever push to it and the owner
+	 * takes the whole list at once, so it can't suffer from ABA.
+	 */
+	std::atomic<Block*> remote { nullptr };
+};
+
+/**
+ * Caches of threads that have exited. Blocks that are still in use can
+ * outlive the thread that allocated them, so the caches are never deleted.
+ * Instead they are given to the next thread that starts.
+ */
+std::vector<Cache*>& GetOrphans(std::unique_lock<std::mutex>& lock) {
+	static std::mutex mutex;
+	static std::vector<Cache*> orphans;
+	lock = std::unique_lock<std::mutex>(mutex);
+	return orphans;
+}
+
+struct ThreadCache {
+	ThreadCache() {
+		std::unique_lock<std::mutex> lock;
+		std::vector<Cache*>& orphans = GetOrphans(lock);
+		if(orphans.empty()) {
+			cache = new Cache();
+		} else {
+			cache = orphans.back();
+			orphans.pop_back();
+		}
+	}
+
+	~ThreadCache() {
+		std::unique_lock<std::mutex> lock;
+		GetOrphans(lock).push_back(cache);
+	}
+
+	Cache* cache;
+};
+
+Cache& GetCache() {
+	thread_local ThreadCache thread_cache;
+	return *thread_cache.cache;
+}
+
+Block* GetBlock(void* ptr) {
+	return reinterpret_cast<Block*>(static_cast<unsigned char*>(ptr) - offsetof(Block, data));
+}
+
+} // namespace
+
+void* ActionPool::Allocate(size_t size) {
+	Block* block;
+	if(size > kBlockSize) {
+		block = static_cast<Block*>(::operator new(offsetof(Block, data) + size));
+		block->owner = nullptr;
+		return block->data;
+	}
+
+	Cache& cache = GetCache();
+	if(!cache.local)
+		cache.local = cache.remote.exchange(nullptr, std::memory_order_acquire);
+
+	if(cache.local) {
+		block = cache.local;
+		cache.local = block->next;
+	} else {
+		block = new Block;
+	}
+
+	block->owner = &cache;
+	return block->data;
+}
+
+void ActionPool::Free(void* ptr) {
+	if(!ptr)
+		return;
+
+	Block* block = GetBlock(ptr);
+	Cache* owner = block->owner;
+	if(!owner) {
+		::operator delete(block);
+		return;
+	}
+
+	if(owner == &GetCache()) {
+		block->next = owner->local;
+		owner->local = block;
+		return;
+	}
+
+	block->next = owner->remote.load(std::memory_order_relaxed);
+	while(!owner->remote.compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed))
+		;
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+
+/**
+ * Allocator for the actions consumed by the processing thread.
+ *
+ * Each thread keeps a free list of fixed-size blocks. Blocks freed by
+ * another thread (usually the processing thread) are pushed back to the
+ * thread that allocated them through a lock-free list, so once the lists
+ * are warm neither side takes a lock or calls malloc.
+ */
+class ActionPool {
+   public:
+	/**
+	 * The largest object that is served from the pool. Bigger objects
+	 * fall back to operator new.
+	 */
+	static constexpr size_t kBlockSize = 256;
+
+	static void* Allocate(size_t size);
+	static void Free(void* ptr);
+};
@@ -0,0 +1,131 @@
+#include "Base64.h"
+
+#if(defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+	#define BASE64_USE_X86_SIMD
+	#include <immintrin.h>
+#endif
+
+/**
+ * Portable encoder, four output characters per input triplet.
+ */
+static void EncodeBlockScalar(const unsigned char* in, size_t count, char* out) {
+	const unsigned char* end = in + count;
+
+	while(in < end) {
+		unsigned int triplet = (in[0] << 16) | (in[1] << 8) | in[2];
+
+		out[0] = __guac_socket_BASE64_CHARACTERS[(triplet >> 18) & 0x3F];
+		out[1] = __guac_socket_BASE64_CHARACTERS[(triplet >> 12) & 0x3F];
+		out[2] = __guac_socket_BASE64_CHARACTERS[(triplet >> 6) & 0x3F];
+		out[3] = __guac_socket_BASE64_CHARACTERS[triplet & 0x3F];
+
+		in += 3;
+		out += 4;
+	}
+}
+
+#ifdef BASE64_USE_X86_SIMD
+
+// The vector encoders split each group of three bytes into four 6-bit indices
+// with a shuffle and two multiplies, then map the indices to ASCII by adding
+// a per-range offset chosen with a second shuffle (Wojciech Mula's method).
+
+__attribute__((target("ssse3"))) static inline __m128i UnpackIndices128(__m128i in) {
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+	const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+	const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+	const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+
+	return _mm_or_si128(t1, t3);
+}
+
+__attribute__((target("ssse3"))) static inline __m128i IndicesToAscii128(__m128i indices) {
+	const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+										  '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+	// 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+	__m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+	const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+	range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+
+	return _mm_add_epi8(indices, _mm_shuffle_epi8(offsets, range));
+}
+
+__attribute__((target("ssse3"))) static void EncodeBlockSSSE3(const unsigned char* in, size_t count, char* out) {
+	// Each iteration consumes 12 bytes but loads 16, so stop while there
+	// is still a full load left and let the scalar encoder finish.
+	while(count >= 16) {
+		const __m128i indices = UnpackIndices128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), IndicesToAscii128(indices));
+
+		in += 12;
+		out += 16;
+		count -= 12;
+	}
+
+	EncodeBlockScalar(in, count, out);
+}
+
+__attribute__((target("avx2"))) static void EncodeBlockAVX2(const unsigned char* in, size_t count, char* out) {
+	const __m256i shuffle = _mm256_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+											10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+	const __m256i offsets = _mm256_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+											 '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+											 'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+											 '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+	// Each 128-bit lane encodes its own 12 bytes, the second lane is
+	// loaded from 12 bytes in so the last load ends 28 bytes in.
+	while(count >= 28) {
+		__m256i in_vec = _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in)));
+		in_vec = _mm256_inserti128_si256(in_vec, _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 12)), 1);
+		in_vec = _mm256_shuffle_epi8(in_vec, shuffle);
+
+		const __m256i t0 = _mm256_and_si256(in_vec, _mm256_set1_epi32(0x0fc0fc00));
+		const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		const __m256i t2 = _mm256_and_si256(in_vec, _mm256_set1_epi32(0x003f03f0));
+		const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+		const __m256i indices = _mm256_or_si256(t1, t3);
+
+		__m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+		const __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+		range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_add_epi8(indices, _mm256_shuffle_epi8(offsets, range)));
+
+		in += 24;
+		out += 32;
+		count -= 24;
+	}
+
+	EncodeBlockSSSE3(in, count, out);
+}
+
+#endif // BASE64_USE_X86_SIMD
+
+typedef void (*EncodeBlockFn)(const unsigned char* in, size_t count, char* out);
+
+/**
+ * Pick the widest encoder the running CPU supports.
+ */
+static EncodeBlockFn SelectEncodeBlock() {
+#ifdef BASE64_USE_X86_SIMD
+	__builtin_cpu_init();
+
+	if(__builtin_cpu_supports("avx2"))
+		return EncodeBlockAVX2;
+
+	if(__builtin_cpu_supports("ssse3"))
+		return EncodeBlockSSSE3;
+#endif
+
+	return EncodeBlockScalar;
+}
+
+static const EncodeBlockFn encode_block_ = SelectEncodeBlock();
+
+void Base64::EncodeBlock(const unsigned char* in, size_t count, char* out) {
+	encode_block_(in, count, out);
+}
@@ -1,5 +1,5 @@
 #pragma once
-#include <sstream>
+#include "GuacBuffer.h"
 
 static const char __guac_socket_BASE64_CHARACTERS[64] = {
 	'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M', 'N', 'O',
@@ -11,8 +11,8 @@ static const char __guac_socket_BASE64_CHARACTERS[64] = {
 
 class Base64 {
    public:
-	Base64(std::ostringstream& ss)
-		: ss_(ss),
+	Base64(GuacBuffer& buffer)
+		: buffer_(buffer),
 		  base64_ready_(0) {
 	}
 
@@ -41,6 +41,22 @@ class Base64 {
 		const unsigned char* char_buf = (const unsigned char*)buf;
 		const unsigned char* end = char_buf + count;
 
+		/* Complete any partial triplet left over from a previous write */
+		while(base64_ready_ > 0 && char_buf < end) {
+			retval = WriteBase64Byte(*(char_buf++));
+			if(retval < 0) {
+				return retval;
+			}
+		}
+
+		/* Encode all remaining whole triplets at once */
+		size_t block = (end - char_buf) / 3 * 3;
+		if(block) {
+			EncodeBlock(char_buf, block, buffer_.Extend(block / 3 * 4));
+			char_buf += block;
+		}
+
+		/* Keep the remainder until more data arrives or the base64 is flushed */
 		while(char_buf < end) {
 			retval = WriteBase64Byte(*(char_buf++));
 			if(retval < 0) {
@@ -65,30 +81,37 @@ class Base64 {
 		return 0;
 	}
 
+	/**
+	 * Encode a buffer whose length is a multiple of three, without padding.
+	 * The output must have room for count / 3 * 4 characters.
+	 * Uses AVX2 or SSSE3 when the CPU supports them.
+	 */
+	static void EncodeBlock(const unsigned char* in, size_t count, char* out);
+
    private:
 	size_t WriteBase64Triplet(int a, int b, int c) {
-		std::ostringstream& ss = ss_;
+		GuacBuffer& buffer = buffer_;
 
 		/* Byte 1 */
-		ss << __guac_socket_BASE64_CHARACTERS[(a & 0xFC) >> 2]; /* [AAAAAA]AABBBB BBBBCC CCCCCC */
+		buffer.Put(__guac_socket_BASE64_CHARACTERS[(a & 0xFC) >> 2]); /* [AAAAAA]AABBBB BBBBCC CCCCCC */
 
 		if(b >= 0) {
-			ss << __guac_socket_BASE64_CHARACTERS[((a & 0x03) << 4) | ((b & 0xF0) >> 4)]; /* AAAAAA[AABBBB]BBBBCC CCCCCC */
+			buffer.Put(__guac_socket_BASE64_CHARACTERS[((a & 0x03) << 4) | ((b & 0xF0) >> 4)]); /* AAAAAA[AABBBB]BBBBCC CCCCCC */
 
 			if(c >= 0) {
-				ss << __guac_socket_BASE64_CHARACTERS[((b & 0x0F) << 2) | ((c & 0xC0) >> 6)]; /* AAAAAA AABBBB[BBBBCC]CCCCCC */
-				ss << __guac_socket_BASE64_CHARACTERS[c & 0x3F];							  /* AAAAAA AABBBB BBBBCC[CCCCCC] */
+				buffer.Put(__guac_socket_BASE64_CHARACTERS[((b & 0x0F) << 2) | ((c & 0xC0) >> 6)]); /* AAAAAA AABBBB[BBBBCC]CCCCCC */
+				buffer.Put(__guac_socket_BASE64_CHARACTERS[c & 0x3F]);							  /* AAAAAA AABBBB BBBBCC[CCCCCC] */
 			} else {
-				ss << __guac_socket_BASE64_CHARACTERS[((b & 0x0F) << 2)]; /* AAAAAA AABBBB[BBBB--]------ */
-				ss << '=';												  /* AAAAAA AABBBB BBBB--[------] */
+				buffer.Put(__guac_socket_BASE64_CHARACTERS[((b & 0x0F) << 2)]); /* AAAAAA AABBBB[BBBB--]------ */
+				buffer.Put('=');											  /* AAAAAA AABBBB BBBB--[------] */
 			}
 		} else {
-			ss << __guac_socket_BASE64_CHARACTERS[((a & 0x03) << 4)]; /* AAAAAA[AA----]------ ------ */
-			ss << "==";												  /* AAAAAA AA----[------]------ */
-			//ss << '='; /* AAAAAA AA---- ------[------] */
+			buffer.Put(__guac_socket_BASE64_CHARACTERS[((a & 0x03) << 4)]); /* AAAAAA[AA----]------ ------ */
+			buffer.WriteString("==");												  /* AAAAAA AA----[------]------ */
+			//buffer.Put('='); /* AAAAAA AA---- ------[------] */
 		}
 
-		/* At this point, 4 bytes have been ss_ */
+		/* At this point, 4 bytes have been written */
 		if(b < 0)
 			return 1;
 
@@ -98,7 +121,7 @@ class Base64 {
 		return 3;
 	}
 
-	std::ostringstream& ss_;
+	GuacBuffer& buffer_;
 
 	/**
 	* The number of bytes present in the base64 "ready" buffer.
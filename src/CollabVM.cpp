@@ -50,9 +50,7 @@ Please email rightowner@gmail.com for any assistance.
 
 #include "guacamole/user-handlers.h"
 #include "guacamole/unicode.h"
-#ifdef USE_JPEG
-	#include "guacamole/protocol.h"
-#endif
+#include "guacamole/protocol.h"
 
 //#include <ossp/uuid.h>
 #include <rapidjson/writer.h>
@@ -148,7 +146,11 @@ enum SERVER_SETTINGS {
 	kJPEGQuality,
 	kModEnabled,
 	kModPerms,
-	kBlacklistedUsernames
+	kBlacklistedUsernames,
+	kCompression,
+	kCompressionWindowBits,
+	kCompressionMemLevel,
+	kIOThreads
 };
 
 const static std::string server_settings_[] = {
@@ -161,7 +163,11 @@ const static std::string server_settings_[] = {
 	"jpeg-quality",
 	"mod-enabled",
 	"mod-perms",
-	"blacklisted-usernames"
+	"blacklisted-usernames",
+	"compression",
+	"compression-window-bits",
+	"compression-mem-level",
+	"io-threads"
 };
 
 enum VM_SETTINGS {
@@ -198,7 +204,10 @@ enum VM_SETTINGS {
 	kUploadCooldownTime,
 	kUploadMaxSize,
 	kUploadMaxFilename,
-	kMOTD
+	kMOTD,
+	kTiledUpdates,
+	kImageEncoding,
+	kVideoMode
 };
 
 static const std::string vm_settings_[] = {
@@ -235,7 +244,10 @@ static const std::string vm_settings_[] = {
 	"upload-cooldown-time",
 	"upload-max-size",
 	"upload-max-filename",
-	"motd"
+	"motd",
+	"tiled-updates",
+	"image-encoding",
+	"video-mode"
 };
 
 static const std::string hypervisor_names_[] {
@@ -250,16 +262,27 @@ static const std::string snapshot_modes_[] {
 	"hd"
 };
 
+static const std::string image_encoders_[] {
+	"png",
+	"jpeg",
+	"webp",
+	"adaptive"
+};
+
 void IgnorePipe();
 
 CollabVMServer::CollabVMServer(net::io_service& service)
 	: service_(service),
+	  strand_(net::make_strand(service)),
 	  server_(std::make_shared<CollabVMServer::Server>(service)),
 	  stopping_(false),
 	  process_thread_running_(false),
-	  keep_alive_timer_(service),
-	  vm_preview_timer_(service),
-	  ip_data_timer(service),
+	  discard_actions_(false),
+	  next_shard_(0),
+	  vm_list_stale_(true),
+	  keep_alive_timer_(strand_),
+	  vm_preview_timer_(strand_),
+	  ip_data_timer(strand_),
 	  ip_data_timer_running_(false),
 	  guest_rng_(1000, 99999),
 	  rng_(std::chrono::steady_clock::now().time_since_epoch().count()),
@@ -268,6 +291,11 @@ CollabVMServer::CollabVMServer(net::io_service& service)
 	  chat_history_end_(0),
 	  chat_history_count_(0),
 	  upload_count_(0) {
+	// Create the processing shards before any VM controllers are assigned to them
+	uint32_t shard_count = std::min(std::max(std::thread::hardware_concurrency(), 1u), kMaxProcessingShards);
+	for(uint32_t i = 0; i < shard_count; i++)
+		shards_.push_back(std::make_unique<ProcessingShard>());
+
 	// Create VMControllers for all VMs that will be auto-started
 	for(auto [id, vm] : database_.VirtualMachines) {
 		if(vm->AutoStart) {
@@ -302,13 +330,15 @@ std::shared_ptr<VMController> CollabVMServer::CreateVMController(const std::shar
 
 	switch(vm->Hypervisor) {
 		case VMSettings::HypervisorEnum::kQEMU: {
-			controller = std::dynamic_pointer_cast<VMController>(std::make_shared<QEMUController>(*this, service_, vm));
+			controller = std::dynamic_pointer_cast<VMController>(std::make_shared<QEMUController>(*this, strand_, vm));
 		} break;
 		default:
 			throw std::runtime_error("Error: unsupported hypervisor in database");
 	}
 
+	controller->shard_ = next_shard_++ % shards_.size();
 	vm_controllers_[vm->Name] = controller;
+	vm_list_stale_ = true;
 	return controller;
 }
 
@@ -320,15 +350,19 @@ void CollabVMServer::Run(uint16_t port, std::string doc_root) {
 	if(last == '/' || last == '\\')
 		doc_root = doc_root.substr(0, doc_root.length() - 1);
 	doc_root_ = doc_root;
+	server_->set_doc_root(doc_root_);
 
 	server_->set_verify_handler(std::bind(&CollabVMServer::OnValidate, this, _1));
 	server_->set_open_handler(std::bind(&CollabVMServer::OnOpen, this, _1));
 	server_->set_close_handler(std::bind(&CollabVMServer::OnClose, this, _1));
+	server_->set_resync_handler(std::bind(&CollabVMServer::OnResync, this, _1));
 	server_->set_message_handler(std::bind(&CollabVMServer::OnMessageFromWS, this, _1, _2));
 
 	// Split blacklisted usernames into array
 	boost::split(blacklisted_usernames_, database_.Configuration.BlacklistedNames, boost::is_any_of(";"));
 
+	SetCompression(database_.Configuration);
+
 	// retains compatibility with previous server behaviour
 	server_->start("0.0.0.0", port);
 
@@ -336,11 +370,13 @@ void CollabVMServer::Run(uint16_t port, std::string doc_root) {
 	vm_preview_timer_.expires_from_now(std::chrono::seconds(kVMPreviewInterval), asio_ec);
 	vm_preview_timer_.async_wait(std::bind(&CollabVMServer::VMPreviewTimerCallback, shared_from_this(), std::placeholders::_1));
 
-#ifdef USE_JPEG
 	// Set the JPEG quality
 	if(database_.Configuration.JPEGQuality <= 100)
 		SetJPEGQuality(database_.Configuration.JPEGQuality);
-#endif
+
+	// Start the processing shards before the VMs can post actions to them
+	for(uint32_t i = 0; i < shards_.size(); i++)
+		shards_[i]->thread = std::thread(std::bind(&CollabVMServer::ShardThread, shared_from_this(), i));
 
 	// Start all of the VMs that should be auto-started
 	for(auto [id, vm] : vm_controllers_) {
@@ -478,6 +514,11 @@ void CollabVMServer::OnClose(std::weak_ptr<websocketmm::websocket_user> handle)
 	}
 }
 
+void CollabVMServer::OnResync(std::weak_ptr<websocketmm::websocket_user> handle) {
+	if(auto handle_sp = handle.lock())
+		PostAction<UserAction>(*handle_sp->GetUserData().user, ActionType::kResyncConnection);
+}
+
 /*
 std::string CollabVMServer::GenerateUuid()
 {
@@ -517,12 +558,54 @@ void CollabVMServer::OnMessageFromWS(std::weak_ptr<websocketmm::websocket_user>
 		if(msg->message_type != websocketmm::websocket_message::type::text)
 			return;
 
-		PostAction<MessageAction>(msg, *handle_sp->GetUserData().user, ActionType::kMessage);
+		CollabVMUser& user = *handle_sp->GetUserData().user;
+		GuacInstructionStream& stream = user.instruction_stream;
+		stream.Feed(std::move(msg));
+
+		// A malformed instruction drops the rest of the message
+		std::shared_ptr<const websocketmm::websocket_message> instruction;
+		size_t offset;
+		size_t length;
+		while(stream.Next(instruction, offset, length) == GuacInstructionStream::Status::kComplete) {
+			const std::uint8_t* data = instruction->data.data() + offset;
+			if(GuacInstructionParser::IsVMInstruction(data, length)) {
+				// Input from the user holding the turn is given to the VM right away
+				if(QueueTurnInput(user, data, length))
+					continue;
+
+				// Other input goes straight to the VM's shard so it doesn't wait
+				// behind everything else the processing thread has to do
+				uint32_t shard = user.shard.load(std::memory_order_relaxed);
+				if(shard != CollabVMUser::kNoShard) {
+					PostShardAction<MessageAction>(shard, instruction, user, ActionType::kMessage, offset, length);
+					continue;
+				}
+			}
+			PostAction<MessageAction>(instruction, user, ActionType::kMessage, offset, length);
+		}
+	}
+}
+
+bool CollabVMServer::QueueTurnInput(CollabVMUser& user, const std::uint8_t* data, size_t length) {
+	std::lock_guard<std::mutex> lock(user.turn_input_lock);
+	if(!user.turn_client)
+		return false;
+
+	GuacClient::InputEvent event;
+	// Malformed input is dropped like the parser would
+	if(GuacInstructionParser::ParseInputInstruction(data, length, event)) {
+		event.user = user.guac_user;
+		user.turn_client->QueueInput(event);
 	}
+	return true;
 }
 
 void CollabVMServer::SendWSMessage(CollabVMUser& user, const std::string& str) {
-	if(!server_->send_message(user.handle, websocketmm::BuildWebsocketMessage(str))) {
+	SendWSMessage(user, websocketmm::BuildWebsocketMessage(str));
+}
+
+void CollabVMServer::SendWSMessage(CollabVMUser& user, const std::shared_ptr<const websocketmm::websocket_message>& msg) {
+	if(!server_->send_message(user.handle, msg)) {
 		if(user.connected) {
 			// Disconnect the client if an error occurs
 			PostAction<UserAction>(user, ActionType::kRemoveConnection);
@@ -674,10 +757,11 @@ void CollabVMServer::RemoveConnection(std::shared_ptr<CollabVMUser>& user) {
 	if(user->username) {
 		// Remove the connection data from the map
 		usernames_.erase(*user->username);
+		RemoveOnlineUser(*user->username);
 		// Send a remove user instruction to everyone
 		std::ostringstream ss("7.remuser,1.1,", std::ostringstream::in | std::ostringstream::out | std::ostringstream::ate);
 		ss << user->username->length() << '.' << *user->username << ';';
-		std::string instr = ss.str();
+		auto instr = websocketmm::BuildWebsocketMessage(ss.str());
 
 		for(const auto& user_ : connections_) {
 			//std::shared_ptr<CollabVMUser> user = *it;
@@ -719,25 +803,142 @@ void CollabVMServer::UpdateVMStatus(const std::string& vm_name, VMController::Co
 	}
 }
 
-void CollabVMServer::ProcessingThread() {
+CollabVMServer::Action* CollabVMServer::NextAction(MPSCQueue<Action>& queue, ProcessingStats& stats) {
+	Action* action;
+	while(!(action = queue.Pop())) {
+		// Everything that was queued has been handled
+		stats.batch_started = false;
+		queue.Wait();
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	if(!stats.batch_started) {
+		stats.batch_started = true;
+		stats.batches++;
+		stats.max_depth = std::max(stats.max_depth, queue.Size() + 1);
+	}
+	auto latency = std::chrono::duration_cast<std::chrono::microseconds>(now - action->posted);
+	stats.actions++;
+	stats.latency += latency;
+	stats.max_latency = std::max(stats.max_latency, latency);
+	if(now >= stats.next_log) {
+		LogProcessingStats(stats);
+		stats.next_log = now + std::chrono::seconds(kProcessingStatsInterval);
+	}
+	return action;
+}
+
+void CollabVMServer::LogProcessingStats(ProcessingStats& stats) {
+#ifdef _DEBUG
+	if(stats.actions) {
+		std::cout << "[" << stats.name << "] " << stats.actions << " actions in " << stats.batches << " batches, latency avg "
+				  << stats.latency.count() / stats.actions << " us, max " << stats.max_latency.count()
+				  << " us, max queue depth " << stats.max_depth << std::endl;
+	}
+#endif
+	stats.actions = 0;
+	stats.batches = 0;
+	stats.max_depth = 0;
+	stats.latency = stats.max_latency = std::chrono::microseconds(0);
+}
+
+void CollabVMServer::ShardThread(uint32_t index) {
 	IgnorePipe();
+	ProcessingShard& shard = *shards_[index];
+	ProcessingStats stats("Processing shard " + std::to_string(index));
+	stats.next_log = std::chrono::steady_clock::now() + std::chrono::seconds(kProcessingStatsInterval);
+
 	while(true) {
-		std::unique_lock<std::mutex> lock(process_queue_lock_);
-		while(process_queue_.empty()) {
-			process_wait_.wait(lock);
+		Action* action = NextAction(shard.queue, stats);
+		if(action->action == ActionType::kShutdown) {
+			delete action;
+			break;
 		}
 
-		Action* action = process_queue_.front();
-		process_queue_.pop();
+		std::unique_lock<std::mutex> lock(shard.lock);
+		switch(action->action) {
+			case ActionType::kMessage: {
+				MessageAction* msg_action = static_cast<MessageAction*>(action);
+				const std::shared_ptr<CollabVMUser>& user = msg_action->user;
+				// The user may have left the VM after the message was routed here
+				if(user->connected && user->vm_controller != nullptr && user->vm_controller->shard_ == index) {
+					GuacInstructionParser::ParseInstruction(*this, user, msg_action->message->data.data() + msg_action->offset, msg_action->length);
+				}
+				break;
+			}
+			case ActionType::kTurnChange: {
+				const std::shared_ptr<VMController>& controller = static_cast<VMAction*>(action)->controller;
+				controller->NextTurn();
+				break;
+			}
+			case ActionType::kAgentConnect: {
+				AgentConnectAction* agent_action = static_cast<AgentConnectAction*>(action);
+				const std::shared_ptr<VMController>& controller = agent_action->controller;
+				controller->agent_connected_ = true;
+				controller->agent_os_name_ = agent_action->os_name;
+				controller->agent_service_pack_ = agent_action->service_pack;
+				controller->agent_pc_name_ = agent_action->pc_name;
+				controller->agent_username_ = agent_action->username;
+				controller->agent_max_filename_ = std::min(static_cast<uint32_t>(controller->GetSettings().UploadMaxFilename),
+														   agent_action->max_filename);
+				controller->agent_upload_in_progress_ = false;
+
+				std::cout << "Agent Connected, OS: \"" << agent_action->os_name << "\", SP: \"" << agent_action->service_pack << "\", PC: \"" << agent_action->pc_name << "\", Username: \"" << agent_action->username << "\"" << std::endl;
+
+				SendActionInstructions(*controller, controller->GetSettings());
+				break;
+			}
+			case ActionType::kAgentDisconnect: {
+				const std::shared_ptr<VMController>& controller = static_cast<VMAction*>(action)->controller;
+				controller->agent_connected_ = false;
+				controller->agent_os_name_.clear();
+				controller->agent_service_pack_.clear();
+				controller->agent_pc_name_.clear();
+				controller->agent_username_.clear();
+				controller->agent_upload_in_progress_ = false;
 
+				SendActionInstructions(*controller, controller->GetSettings());
+				break;
+			}
+			case ActionType::kVMThumbnail: {
+				VMThumbnailUpdate* thumbnail = static_cast<VMThumbnailUpdate*>(action);
+				thumbnail->controller->SetThumbnail(std::move(thumbnail->thumbnail));
+				vm_list_stale_ = true;
+				break;
+			}
+			default:
+				break;
+		}
 		lock.unlock();
 
+		delete action;
+	}
+}
+
+void CollabVMServer::ProcessingThread() {
+	IgnorePipe();
+	ProcessingStats stats("Processing");
+	stats.next_log = std::chrono::steady_clock::now() + std::chrono::seconds(kProcessingStatsInterval);
+
+	while(true) {
+		Action* action = NextAction(process_queue_, stats);
+
+		// Actions queued before the server was stopped are dropped
+		if(discard_actions_.load(std::memory_order_relaxed) && action->action != ActionType::kShutdown) {
+			delete action;
+			continue;
+		}
+
+		// Nothing can run on the shards while the processing thread
+		// handles an action
+		ShardsLock shards_lock(shards_);
+
 		switch(action->action) {
 			case ActionType::kMessage: {
 				MessageAction* msg_action = static_cast<MessageAction*>(action);
 				if(msg_action->user->connected) {
 					if(msg_action->message) {
-						GuacInstructionParser::ParseInstruction(*this, msg_action->user, std::string((char*)msg_action->message->data.data(), msg_action->message->data.size()));
+						GuacInstructionParser::ParseInstruction(*this, msg_action->user, msg_action->message->data.data() + msg_action->offset, msg_action->length);
 					}
 				}
 				break;
@@ -775,9 +976,17 @@ void CollabVMServer::ProcessingThread() {
 				}
 				break;
 			}
-			case ActionType::kTurnChange: {
-				const std::shared_ptr<VMController>& controller = static_cast<VMAction*>(action)->controller;
-				controller->NextTurn();
+			case ActionType::kResyncConnection: {
+				const std::shared_ptr<CollabVMUser>& connection = static_cast<UserAction*>(action)->user;
+				if(connection->connected && connection->guac_user != nullptr && connection->guac_user->client_) {
+					if(auto handle = connection->handle.lock()) {
+						websocketmm::send_queue_stats stats = handle->GetSendQueueStats();
+						std::cout << "[WebSocket Resync] IP: " << connection->ip_data.GetIP() << " dropped "
+								  << stats.dropped_messages << " messages (" << stats.dropped_bytes << " bytes), peak queue "
+								  << stats.peak_bytes << " bytes" << std::endl;
+					}
+					connection->guac_user->client_->ResyncUser(*connection->guac_user);
+				}
 				break;
 			}
 			case ActionType::kVoteEnded: {
@@ -785,35 +994,6 @@ void CollabVMServer::ProcessingThread() {
 				controller->EndVote();
 				break;
 			}
-			case ActionType::kAgentConnect: {
-				AgentConnectAction* agent_action = static_cast<AgentConnectAction*>(action);
-				const std::shared_ptr<VMController>& controller = agent_action->controller;
-				controller->agent_connected_ = true;
-				controller->agent_os_name_ = agent_action->os_name;
-				controller->agent_service_pack_ = agent_action->service_pack;
-				controller->agent_pc_name_ = agent_action->pc_name;
-				controller->agent_username_ = agent_action->username;
-				controller->agent_max_filename_ = std::min(static_cast<uint32_t>(controller->GetSettings().UploadMaxFilename),
-														   agent_action->max_filename);
-				controller->agent_upload_in_progress_ = false;
-
-				std::cout << "Agent Connected, OS: \"" << agent_action->os_name << "\", SP: \"" << agent_action->service_pack << "\", PC: \"" << agent_action->pc_name << "\", Username: \"" << agent_action->username << "\"" << std::endl;
-
-				SendActionInstructions(*controller, controller->GetSettings());
-				break;
-			}
-			case ActionType::kAgentDisconnect: {
-				const std::shared_ptr<VMController>& controller = static_cast<VMAction*>(action)->controller;
-				controller->agent_connected_ = false;
-				controller->agent_os_name_.clear();
-				controller->agent_service_pack_.clear();
-				controller->agent_pc_name_.clear();
-				controller->agent_username_.clear();
-				controller->agent_upload_in_progress_ = false;
-
-				SendActionInstructions(*controller, controller->GetSettings());
-				break;
-			}
 			/*
 		case ActionType::kHttpUploadTimedout:
 		{
@@ -950,14 +1130,11 @@ void CollabVMServer::ProcessingThread() {
 					vm_controller.second->UpdateThumbnail();
 				}
 				break;
-			case ActionType::kVMThumbnail: {
-				VMThumbnailUpdate* thumbnail = static_cast<VMThumbnailUpdate*>(action);
-				thumbnail->controller->SetThumbnail(thumbnail->thumbnail);
-				break;
-			}
 			case ActionType::kVMStateChange: {
 				VMStateChange* state_change = static_cast<VMStateChange*>(action);
 				std::shared_ptr<VMController>& controller = state_change->controller;
+				// The thumbnail is dropped when the VM stops
+				vm_list_stale_ = true;
 
 				if(state_change->state == VMController::ControllerState::kStopped) {
 					VMController::StopReason reason = controller->GetStopReason();
@@ -974,6 +1151,7 @@ void CollabVMServer::ProcessingThread() {
 						auto vm_it = vm_controllers_.find(controller->GetSettings().Name);
 						if(vm_it != vm_controllers_.end())
 							vm_controllers_.erase(vm_it);
+						vm_list_stale_ = true;
 						controller.reset();
 
 						if(stopping_ && vm_controllers_.empty()) {
@@ -998,6 +1176,7 @@ void CollabVMServer::ProcessingThread() {
 				break;
 			}
 			case ActionType::kShutdown:
+				discard_actions_ = false;
 
 				// Disconnect all active clients
 				for(const auto& connection : connections_) {
@@ -1028,6 +1207,12 @@ void CollabVMServer::ProcessingThread() {
 		delete action;
 	}
 stop:
+	// Stop the shards now that nothing else will be posted to them
+	for(uint32_t i = 0; i < shards_.size(); i++) {
+		PostShardAction<Action>(i, ActionType::kShutdown);
+		if(shards_[i]->thread.joinable())
+			shards_[i]->thread.join();
+	}
 	process_thread_running_ = false;
 }
 
@@ -1036,19 +1221,21 @@ void CollabVMServer::OnVMControllerVoteEnded(const std::shared_ptr<VMController>
 }
 
 void CollabVMServer::OnVMControllerTurnChange(const std::shared_ptr<VMController>& controller) {
-	PostAction<VMAction>(controller, ActionType::kTurnChange);
+	PostShardAction<VMAction>(controller->shard_, controller, ActionType::kTurnChange);
 }
 
-void CollabVMServer::OnVMControllerThumbnailUpdate(const std::shared_ptr<VMController>& controller, std::string* str) {
-	PostAction<VMThumbnailUpdate>(controller, str);
+void CollabVMServer::OnVMControllerThumbnailUpdate(const std::shared_ptr<VMController>& controller, std::shared_ptr<const std::string> str) {
+	PostShardAction<VMThumbnailUpdate>(controller->shard_, controller, std::move(str));
 }
 
 void CollabVMServer::BroadcastTurnInfo(VMController& controller, UserList& users, const std::deque<std::shared_ptr<CollabVMUser>>& turn_queue, CollabVMUser* current_turn, uint32_t time_remaining) {
 	if(current_turn == nullptr) {
 		// The instruction is static if there is nobody controlling the VM
 		// and nobody is waiting in the queue
-		users.ForEachUser([this](CollabVMUser& user) {
-			SendWSMessage(user, "4.turn,1.0,1.0;");
+		static const auto turn_instr = websocketmm::BuildWebsocketMessage("4.turn,1.0,1.0;");
+		controller.GetTurnListCache().clear();
+		users.ForEachUser([&](CollabVMUser& user) {
+			SendWSMessage(user, turn_instr);
 		});
 	} else {
 		std::string users_list;
@@ -1088,6 +1275,7 @@ void CollabVMServer::BroadcastTurnInfo(VMController& controller, UserList& users
 		turn_instr += ',';
 
 		turn_instr += users_list;
+		controller.SetTurnListCache(std::move(users_list));
 
 		// Send the instruction to the user that has control first
 		current_turn->waiting_turn = false;
@@ -1121,15 +1309,45 @@ void CollabVMServer::BroadcastTurnInfo(VMController& controller, UserList& users
 		}
 
 		// Tell all the spectators how many users are in the waiting queue
+		auto spectator_instr = websocketmm::BuildWebsocketMessage(turn_instr);
 		users.ForEachUser([&](CollabVMUser& user) {
 			if(user.waiting_turn || &user == current_turn)
 				return;
-			SendWSMessage(user, turn_instr);
+			SendWSMessage(user, spectator_instr);
 		});
 	}
 }
 
-void CollabVMServer::SendTurnInfo(CollabVMUser& user, uint32_t time_remaining, const std::string& current_turn, const std::deque<std::shared_ptr<CollabVMUser>>& turn_queue) {
+void CollabVMServer::SendTurnInfo(VMController& controller, CollabVMUser& user, uint32_t time_remaining) {
+	std::string& users_list = controller.GetTurnListCache();
+	if(users_list.empty()) {
+		const std::shared_ptr<CollabVMUser> current_turn = controller.CurrentTurn();
+		if(!current_turn)
+			return;
+
+		const std::deque<std::shared_ptr<CollabVMUser>>& turn_queue = controller.GetTurnQueue();
+		// Number of users
+		std::string temp_str = std::to_string(turn_queue.size() + 1);
+		users_list += std::to_string(temp_str.length());
+		users_list += '.';
+		users_list += temp_str;
+		users_list += ',';
+		// Current user controlling the VM
+		users_list += std::to_string(current_turn->username->length());
+		users_list += '.';
+		users_list += *current_turn->username;
+		// Users waiting in the queue
+		for(const auto& user : turn_queue) {
+			users_list += ',';
+
+			users_list += std::to_string(user->username->length());
+			users_list += '.';
+			users_list += *user->username;
+		}
+
+		users_list += ';';
+	}
+
 	std::string instr = "4.turn,";
 
 	// Remaining time for the current user's turn
@@ -1138,27 +1356,7 @@ void CollabVMServer::SendTurnInfo(CollabVMUser& user, uint32_t time_remaining, c
 	instr += '.';
 	instr += temp_str;
 	instr += ',';
-	//instr += user_list;
-	// Number of users
-	temp_str = std::to_string(turn_queue.size() + 1);
-	instr += std::to_string(temp_str.length());
-	instr += '.';
-	instr += temp_str;
-	instr += ',';
-	// Current user controlling the VM
-	instr += std::to_string(current_turn.length());
-	instr += '.';
-	instr += current_turn;
-	// Users waiting in the queue
-	for(const auto& user : turn_queue) {
-		instr += ',';
-
-		instr += std::to_string(user->username->length());
-		instr += '.';
-		instr += *user->username;
-	}
-
-	instr += ';';
+	instr += users_list;
 
 	SendWSMessage(user, instr);
 }
@@ -1186,8 +1384,9 @@ void CollabVMServer::BroadcastVoteInfo(const VMController& vm, UserList& users,
 	instr += temp_str;
 
 	instr += ';';
+	auto msg = websocketmm::BuildWebsocketMessage(instr);
 	users.ForEachUser([&](CollabVMUser& user) {
-		SendWSMessage(user, instr);
+		SendWSMessage(user, msg);
 	});
 }
 
@@ -1225,8 +1424,9 @@ void CollabVMServer::UserStartedVote(const VMController& vm, UserList& users, Co
 	instr += *user.username;
 	instr += MSG ";";
 	user.voted_amount++;
+	auto msg = websocketmm::BuildWebsocketMessage(instr);
 	users.ForEachUser([&](CollabVMUser& user) {
-		SendWSMessage(user, instr);
+		SendWSMessage(user, msg);
 	});
 }
 
@@ -1248,16 +1448,20 @@ void CollabVMServer::UserVoted(const VMController& vm, UserList& users, CollabVM
 	instr += *user.username;
 	instr += vote ? MSG_YES ";" : MSG_NO ";";
 
+	auto msg = websocketmm::BuildWebsocketMessage(instr);
 	users.ForEachUser([&](CollabVMUser& user) {
-		SendWSMessage(user, instr);
+		SendWSMessage(user, msg);
 	});
 }
 
 void CollabVMServer::BroadcastVoteEnded(const VMController& vm, UserList& users, bool vote_succeeded) {
-	std::string instr = vote_succeeded ? "4.chat,0.,33.The vote to reset the VM has won.;" : "4.chat,0.,34.The vote to reset the VM has lost.;";
+	static const auto vote_ended = websocketmm::BuildWebsocketMessage("4.vote,1.2;");
+	static const auto vote_won = websocketmm::BuildWebsocketMessage("4.chat,0.,33.The vote to reset the VM has won.;");
+	static const auto vote_lost = websocketmm::BuildWebsocketMessage("4.chat,0.,34.The vote to reset the VM has lost.;");
+	const auto& instr = vote_succeeded ? vote_won : vote_lost;
 
 	users.ForEachUser([&](CollabVMUser& user) {
-		SendWSMessage(user, "4.vote,1.2;");
+		SendWSMessage(user, vote_ended);
 		SendWSMessage(user, instr);
 		// Reset the vote amount for all users.
 		// TODO: Make this only act on users who have voted at least once
@@ -1297,29 +1501,19 @@ void CollabVMServer::Stop() {
 	//if (ws_ec)
 	//	std::cout << "stop_listening error: " << ws_ec.message() << std::endl;
 
-	// Stop the timers
-	boost::system::error_code asio_ec;
-	keep_alive_timer_.cancel(asio_ec);
-	ip_data_timer.cancel(asio_ec);
-	vm_preview_timer_.cancel(asio_ec);
+	// Stop the timers on the strand their handlers run on
+	net::post(strand_, [this]() {
+		boost::system::error_code asio_ec;
+		keep_alive_timer_.cancel(asio_ec);
+		ip_data_timer.cancel(asio_ec);
+		vm_preview_timer_.cancel(asio_ec);
+	});
 
 	if(process_thread_running_) {
-		std::unique_lock<std::mutex> lock(process_queue_lock_);
-		// Delete all actions currently in the queue and add the
+		// Discard all actions currently in the queue and add the
 		// shutdown action to signal the processing queue to disconnect
 		// all websocket clients and stop all VM controllers
-		while(!process_queue_.empty()) {
-			delete process_queue_.front();
-			process_queue_.pop();
-		}
-
-		lock.unlock();
-
-		// Clear processing queue by swapping it with an empty one
-		std::queue<Action*> emptyQueue;
-		process_queue_.swap(emptyQueue);
-
-		// Add the stop action to the processing queue
+		discard_actions_ = true;
 		PostAction<Action>(ActionType::kShutdown);
 	}
 
@@ -1353,7 +1547,11 @@ void CollabVMServer::OnVMControllerCleanUp(const std::shared_ptr<VMController>&
 }
 
 void CollabVMServer::SendGuacMessage(std::weak_ptr<websocketmm::websocket_user> handle, const std::string& str) {
-	if(!server_->send_message(handle, websocketmm::BuildWebsocketMessage(str))) {
+	SendGuacMessage(handle, websocketmm::BuildWebsocketMessage(str));
+}
+
+void CollabVMServer::SendGuacMessage(std::weak_ptr<websocketmm::websocket_user> handle, const std::shared_ptr<const websocketmm::websocket_message>& message) {
+	if(!server_->send_message(handle, message)) {
 		if(auto handle_sp = handle.lock()) {
 			auto user = handle_sp->GetUserData().user;
 
@@ -1432,18 +1630,56 @@ bool CollabVMServer::ValidateUsername(const std::string& username) {
 }
 
 void CollabVMServer::SendOnlineUsersList(CollabVMUser& user) {
-	std::ostringstream ss("7.adduser,", std::ios_base::in | std::ios_base::out | std::ios_base::ate);
-	std::string num = std::to_string(usernames_.size());
-	ss << num.size() << '.' << num;
+	if(!online_users_msg_) {
+		std::string instr = "7.adduser,";
+		std::string num = std::to_string(usernames_.size());
+		instr += std::to_string(num.length());
+		instr += '.';
+		instr += num;
+		instr += online_users_;
+		instr += ';';
+		online_users_msg_ = websocketmm::BuildWebsocketMessage(instr);
+	}
+	SendWSMessage(user, online_users_msg_);
+}
+
+void CollabVMServer::AddOnlineUser(const std::string& username, UserRank rank) {
+	std::string num = std::to_string(rank);
+	online_users_ += ',';
+	online_users_ += std::to_string(username.length());
+	online_users_ += '.';
+	online_users_ += username;
+	online_users_ += ',';
+	online_users_ += std::to_string(num.length());
+	online_users_ += '.';
+	online_users_ += num;
+	online_users_msg_.reset();
+}
+
+void CollabVMServer::RemoveOnlineUser(const std::string& username) {
+	// Each user has two elements, their username and their rank
+	size_t begin = 0;
+	while(begin < online_users_.length()) {
+		size_t name_pos = online_users_.find('.', begin) + 1;
+		size_t name_len = std::strtoul(&online_users_[begin + 1], nullptr, 10);
+		size_t rank_pos = online_users_.find('.', name_pos + name_len) + 1;
+		size_t rank_len = std::strtoul(&online_users_[name_pos + name_len + 1], nullptr, 10);
+		size_t end = rank_pos + rank_len;
+		if(!online_users_.compare(name_pos, name_len, username)) {
+			online_users_.erase(begin, end - begin);
+			online_users_msg_.reset();
+			return;
+		}
+		begin = end;
+	}
+}
 
-	for(auto& username : usernames_) {
-		std::shared_ptr<CollabVMUser> data = username.second;
-		// Append the user to the online users list
-		num = std::to_string(data->user_rank);
-		ss << ',' << data->username->length() << '.' << *data->username << ',' << num.size() << '.' << num;
+void CollabVMServer::SetUserRank(CollabVMUser& user, UserRank rank) {
+	user.user_rank = rank;
+	if(user.username) {
+		RemoveOnlineUser(*user.username);
+		AddOnlineUser(*user.username, rank);
 	}
-	ss << ';';
-	SendWSMessage(user, ss.str());
 }
 
 void CollabVMServer::ChangeUsername(const std::shared_ptr<CollabVMUser>& data, const std::string& new_username, UsernameChangeResult result, bool send_history) {
@@ -1525,9 +1761,10 @@ void CollabVMServer::ChangeUsername(const std::shared_ptr<CollabVMUser>& data, c
 		instr += ';';
 
 		// Send instruction to all users viewing a VM
+		auto msg = websocketmm::BuildWebsocketMessage(instr);
 		for(const auto& user : connections_) {
 			if(user->vm_controller)
-				SendWSMessage(*user, instr);
+				SendWSMessage(*user, msg);
 		}
 	}
 
@@ -1535,7 +1772,12 @@ void CollabVMServer::ChangeUsername(const std::shared_ptr<CollabVMUser>& data, c
 	if(data->username) {
 		std::cout << "[Username Changed] IP: " << data->ip_data.GetIP() << " Old: \"" << *data->username << "\" New: \"" << new_username << '"' << std::endl;
 		usernames_.erase(*data->username);
+		RemoveOnlineUser(*data->username);
 		data->username->assign(new_username);
+
+		// The turn list has the old username in it
+		if(data->vm_controller && (data->waiting_turn || data->vm_controller->CurrentTurn() == data))
+			data->vm_controller->GetTurnListCache().clear();
 	} else {
 		data->username = std::make_shared<std::string>(new_username);
 		std::cout << "[Username Assigned] IP: " << data->ip_data.GetIP() << " New username: \"" << new_username << '"' << std::endl;
@@ -1544,6 +1786,7 @@ void CollabVMServer::ChangeUsername(const std::shared_ptr<CollabVMUser>& data, c
 	data->ip_data.name_chg_count++;
 	data->ip_data.last_name_chg = now;
 	usernames_[new_username] = data;
+	AddOnlineUser(new_username, data->user_rank);
 }
 
 std::string CollabVMServer::GenerateUsername() {
@@ -1658,7 +1901,7 @@ void CollabVMServer::UnmuteUser(const std::shared_ptr<CollabVMUser>& user) {
 	//return;
 }
 
-void CollabVMServer::OnMouseInstruction(const std::shared_ptr<CollabVMUser>& user, std::vector<char*>& args) {
+void CollabVMServer::OnMouseInstruction(const std::shared_ptr<CollabVMUser>& user, GuacArguments& args) {
 	// Only allow a user to send mouse instructions if it is their turn,
 	// they are an admin, or they are connected to the admin panel
 	if(user->vm_controller != nullptr &&
@@ -1670,7 +1913,7 @@ void CollabVMServer::OnMouseInstruction(const std::shared_ptr<CollabVMUser>& use
 	}
 }
 
-void CollabVMServer::OnKeyInstruction(const std::shared_ptr<CollabVMUser>& user, std::vector<char*>& args) {
+void CollabVMServer::OnKeyInstruction(const std::shared_ptr<CollabVMUser>& user, GuacArguments& args) {
 	// Only allow a user to send keyboard instructions if it is their turn,
 	// they are an admin, or they are connected to the admin panel
 	if(user->vm_controller != nullptr &&
@@ -1682,7 +1925,7 @@ void CollabVMServer::OnKeyInstruction(const std::shared_ptr<CollabVMUser>& user,
 	}
 }
 
-void CollabVMServer::OnRenameInstruction(const std::shared_ptr<CollabVMUser>& user, std::vector<char*>& args) {
+void CollabVMServer::OnRenameInstruction(const std::shared_ptr<CollabVMUser>& user, GuacArguments& args) {
 	if(args.empty()) {
 		// The users wants the server to generate a username for them
 		if(!user->username) {
@@ -1800,7 +2043,7 @@ void CollabVMServer::BroadcastMOTD(VMController& controller, const VMSettings& s
 	});
 }
 
-void CollabVMServer::OnConnectInstruction(const std::shared_ptr<CollabVMUser>& user, std::vector<char*>& args) {
+void CollabVMServer::OnConnectInstruction(const std::shared_ptr<CollabVMUser>& user, GuacArguments& args) {
 	if(args.size() != 1 || user->guac_user != nullptr || !user->username) {
 		return;
 	}
@@ -1855,7 +2098,7 @@ void CollabVMServer::OnConnectInstruction(const std::shared_ptr<CollabVMUser>& u
 	controller.AddUser(user);
 }
 
-void CollabVMServer::OnAdminInstruction(const std::shared_ptr<CollabVMUser>& user, std::vector<char*>& args) {
+void CollabVMServer::OnAdminInstruction(const std::shared_ptr<CollabVMUser>& user, GuacArguments& args) {
 	// This instruction should have at least one argument
 	if(args.empty())
 		return;
@@ -1881,7 +2124,7 @@ void CollabVMServer::OnAdminInstruction(const std::shared_ptr<CollabVMUser>& use
 		case kStop:
 			// Logged out
 			SendWSMessage(*user, "5.admin,1.0,1.4;");
-			user->user_rank = UserRank::kUnregistered;
+			SetUserRank(*user, UserRank::kUnregistered);
 			if(user->vm_controller != nullptr) {
 				// Send new rank to users
 				std::string adminUser = "7.adduser,1.1,";
@@ -1907,7 +2150,7 @@ void CollabVMServer::OnAdminInstruction(const std::shared_ptr<CollabVMUser>& use
 			} else if(args.size() == 2) {
 				if(!admin_session_id_.empty() && args[1] == admin_session_id_) {
 					user->admin_connected = true;
-					user->user_rank = UserRank::kAdmin;
+					SetUserRank(*user, UserRank::kAdmin);
 					admin_connections_.insert(user);
 
 					// Send login success response
@@ -1936,7 +2179,7 @@ void CollabVMServer::OnAdminInstruction(const std::shared_ptr<CollabVMUser>& use
 		case kMasterPwd:
 			if(args.size() == 2 && args[1] == database_.Configuration.MasterPassword) {
 				user->admin_connected = true;
-				user->user_rank = UserRank::kAdmin;
+				SetUserRank(*user, UserRank::kAdmin);
 				admin_connections_.insert(user);
 
 				// Send login success response
@@ -1957,7 +2200,7 @@ void CollabVMServer::OnAdminInstruction(const std::shared_ptr<CollabVMUser>& use
 					SendOnlineUsersList(*user); // send userlist
 				}
 			} else if(args.size() == 2 && args[1] == database_.Configuration.ModPassword && database_.Configuration.ModEnabled) {
-				user->user_rank = UserRank::kModerator;
+				SetUserRank(*user, UserRank::kModerator);
 
 				// Send moderator login success response
 				std::string modLogin = "5.admin,1.0,1.3,";
@@ -2222,35 +2465,38 @@ void CollabVMServer::OnAdminInstruction(const std::shared_ptr<CollabVMUser>& use
 	}
 }
 
-void CollabVMServer::OnListInstruction(const std::shared_ptr<CollabVMUser>& user, std::vector<char*>& args) {
-	std::string instr("4.list");
-	for(auto it = vm_controllers_.begin(); it != vm_controllers_.end(); it++) {
-		instr += ',';
-		const VMSettings& vm_settings = it->second->GetSettings();
-		instr += std::to_string(vm_settings.Name.length());
-		instr += '.';
-		instr += vm_settings.Name;
-		instr += ',';
-		instr += std::to_string(vm_settings.DisplayName.length());
-		instr += '.';
-		instr += vm_settings.DisplayName;
+void CollabVMServer::OnListInstruction(const std::shared_ptr<CollabVMUser>& user, GuacArguments& args) {
+	if(vm_list_stale_.exchange(false) || !vm_list_msg_) {
+		std::string instr("4.list");
+		for(auto it = vm_controllers_.begin(); it != vm_controllers_.end(); it++) {
+			instr += ',';
+			const VMSettings& vm_settings = it->second->GetSettings();
+			instr += std::to_string(vm_settings.Name.length());
+			instr += '.';
+			instr += vm_settings.Name;
+			instr += ',';
+			instr += std::to_string(vm_settings.DisplayName.length());
+			instr += '.';
+			instr += vm_settings.DisplayName;
 
-		instr += ',';
+			instr += ',';
 
-		std::string* png = it->second->GetThumbnail();
-		if(png && png->length()) {
-			instr += std::to_string(png->length());
-			instr += '.';
-			instr += *png;
-		} else {
-			instr += "0.";
+			const std::shared_ptr<const std::string>& png = it->second->GetThumbnail();
+			if(png && png->length()) {
+				instr += std::to_string(png->length());
+				instr += '.';
+				instr += *png;
+			} else {
+				instr += "0.";
+			}
 		}
+		instr += ';';
+		vm_list_msg_ = websocketmm::BuildWebsocketMessage(instr);
 	}
-	instr += ';';
-	SendWSMessage(*user, instr);
+	SendWSMessage(*user, vm_list_msg_);
 }
 
-void CollabVMServer::OnNopInstruction(const std::shared_ptr<CollabVMUser>& user, std::vector<char*>& args) {
+void CollabVMServer::OnNopInstruction(const std::shared_ptr<CollabVMUser>& user, GuacArguments& args) {
 	user->last_nop_instr = std::chrono::time_point_cast<std::chrono::seconds>(std::chrono::steady_clock::now());
 }
 
@@ -2273,7 +2519,7 @@ void CollabVMServer::OnQEMUResponse(std::weak_ptr<CollabVMUser> data, rapidjson:
 	}
 }
 
-void CollabVMServer::OnChatInstruction(const std::shared_ptr<CollabVMUser>& user, std::vector<char*>& args) {
+void CollabVMServer::OnChatInstruction(const std::shared_ptr<CollabVMUser>& user, GuacArguments& args) {
 	if(args.size() != 1 || !user->username)
 		return;
 
@@ -2349,7 +2595,7 @@ void CollabVMServer::OnChatInstruction(const std::shared_ptr<CollabVMUser>& user
 		SendWSMessage(*connection, instr);
 }
 
-void CollabVMServer::OnTurnInstruction(const std::shared_ptr<CollabVMUser>& user, std::vector<char*>& args) {
+void CollabVMServer::OnTurnInstruction(const std::shared_ptr<CollabVMUser>& user, GuacArguments& args) {
 	auto now = std::chrono::time_point_cast<std::chrono::seconds>(std::chrono::steady_clock::now());
 
 	if(user->ip_data.turn_fixed) {
@@ -2384,12 +2630,12 @@ void CollabVMServer::OnTurnInstruction(const std::shared_ptr<CollabVMUser>& user
 	}
 }
 
-void CollabVMServer::OnVoteInstruction(const std::shared_ptr<CollabVMUser>& user, std::vector<char*>& args) {
+void CollabVMServer::OnVoteInstruction(const std::shared_ptr<CollabVMUser>& user, GuacArguments& args) {
 	if(args.size() == 1 && user->vm_controller != nullptr && user->username)
 		user->vm_controller->Vote(*user, args[0][0] == '1');
 }
 
-void CollabVMServer::OnFileInstruction(const std::shared_ptr<CollabVMUser>& user, std::vector<char*>& args) {
+void CollabVMServer::OnFileInstruction(const std::shared_ptr<CollabVMUser>& user, GuacArguments& args) {
 	if(!user->vm_controller || args.empty() || args[0][0] == '\0' ||
 	   !user->vm_controller->GetSettings().UploadsEnabled)
 		return;
@@ -2446,11 +2692,11 @@ void CollabVMServer::OnFileInstruction(const std::shared_ptr<CollabVMUser>& user
 void CollabVMServer::OnAgentConnect(const std::shared_ptr<VMController>& controller,
 									const std::string& os_name, const std::string& service_pack,
 									const std::string& pc_name, const std::string& username, uint32_t max_filename) {
-	PostAction<AgentConnectAction>(controller, os_name, service_pack, pc_name, username, max_filename);
+	PostShardAction<AgentConnectAction>(controller->shard_, controller, os_name, service_pack, pc_name, username, max_filename);
 }
 
 void CollabVMServer::OnAgentDisconnect(const std::shared_ptr<VMController>& controller) {
-	PostAction<VMAction>(controller, ActionType::kAgentDisconnect);
+	PostShardAction<VMAction>(controller->shard_, controller, ActionType::kAgentDisconnect);
 }
 
 // TODO
@@ -2490,17 +2736,11 @@ void CollabVMServer::OnUploadTimeout(const boost::system::error_code ec, std::sh
 		upload_info->http_state.exchange(UploadInfo::HttpUploadState::kCancel);
 	if (prev_state == UploadInfo::HttpUploadState::kNotStarted)
 	{
-		std::unique_lock<std::mutex> lock(process_queue_lock_);
-		process_queue_.push(new HttpAction(ActionType::kHttpUploadTimedout, upload_info));
-		lock.unlock();
-		process_wait_.notify_one();
+		PostAction<HttpAction>(ActionType::kHttpUploadTimedout, upload_info);
 	}
 	else if (prev_state == UploadInfo::HttpUploadState::kNotWriting)
 	{
-		std::unique_lock<std::mutex> lock(process_queue_lock_);
-		process_queue_.push(new HttpAction(ActionType::kHttpUploadFailed, upload_info));
-		lock.unlock();
-		process_wait_.notify_one();
+		PostAction<HttpAction>(ActionType::kHttpUploadFailed, upload_info);
 	}
      */
 }
@@ -2518,7 +2758,7 @@ void CollabVMServer::StartFileUpload(CollabVMUser& user) {
 		upload_count_++;
 		upload_info->file_path = file_path;
 
-		boost::asio::steady_timer* timer = new boost::asio::steady_timer(service_);
+		boost::asio::steady_timer* timer = new boost::asio::steady_timer(strand_);
 		std::string upload_id = GenerateUuid();
 		unique_lock<std::mutex> lock(upload_lock_);
 		auto result = upload_ids_.insert({ upload_id, upload_info });
@@ -3147,6 +3387,40 @@ bool CollabVMServer::ParseVMSettings(VMSettings& vm, rapidjson::Value& settings,
 							valid = false;
 						}
 						break;
+					case kTiledUpdates:
+						if(value.IsBool()) {
+							vm.TiledUpdates = value.GetBool();
+						} else {
+							WriteJSONObject(writer, vm_settings_[kTiledUpdates], invalid_object_);
+							valid = false;
+						}
+						break;
+					case kImageEncoding:
+						if(value.IsString()) {
+							std::string encoder = std::string(value.GetString(), value.GetStringLength());
+							for(size_t x = 0; x < sizeof(image_encoders_) / sizeof(std::string); x++) {
+								if(encoder == image_encoders_[x]) {
+									vm.ImageEncoding = (VMSettings::ImageEncoder)x;
+									goto found_encoder;
+								}
+							}
+							WriteJSONObject(writer, vm_settings_[kImageEncoding], "Unknown image encoding");
+							valid = false;
+						found_encoder:
+							break;
+						} else {
+							WriteJSONObject(writer, vm_settings_[kImageEncoding], invalid_object_);
+							valid = false;
+						}
+						break;
+					case kVideoMode:
+						if(value.IsBool()) {
+							vm.VideoMode = value.GetBool();
+						} else {
+							WriteJSONObject(writer, vm_settings_[kVideoMode], invalid_object_);
+							valid = false;
+						}
+						break;
 				}
 				break;
 			}
@@ -3284,6 +3558,7 @@ std::string CollabVMServer::PerformConfigFunction(const std::string& json) {
 							auto vm_it = vm_controllers_.find(vm->Name);
 							if(vm_it != vm_controllers_.end())
 								vm_it->second->ChangeSettings(vm);
+							vm_list_stale_ = true;
 
 							WriteServerSettings(writer);
 						}
@@ -3338,6 +3613,17 @@ std::string CollabVMServer::GetServerSettings() {
 	return std::string(str_buf.GetString(), str_buf.GetSize());
 }
 
+void CollabVMServer::SetCompression(const Config& config) {
+	websocketmm::compression_options options;
+	options.enabled = config.Compression;
+	// Databases from before these settings existed have them zeroed
+	if(config.CompressionWindowBits >= 9 && config.CompressionWindowBits <= 15)
+		options.window_bits = config.CompressionWindowBits;
+	if(config.CompressionMemLevel >= 1 && config.CompressionMemLevel <= 9)
+		options.mem_level = config.CompressionMemLevel;
+	server_->set_compression_options(options);
+}
+
 void CollabVMServer::WriteServerSettings(rapidjson::Writer<rapidjson::StringBuffer>& writer) {
 	writer.String("settings");
 	writer.StartObject();
@@ -3369,6 +3655,18 @@ void CollabVMServer::WriteServerSettings(rapidjson::Writer<rapidjson::StringBuff
 	writer.String(server_settings_[kModPerms].c_str());
 	writer.Uint(database_.Configuration.ModPerms);
 
+	writer.String(server_settings_[kCompression].c_str());
+	writer.Bool(database_.Configuration.Compression);
+
+	writer.String(server_settings_[kCompressionWindowBits].c_str());
+	writer.Uint(database_.Configuration.CompressionWindowBits);
+
+	writer.String(server_settings_[kCompressionMemLevel].c_str());
+	writer.Uint(database_.Configuration.CompressionMemLevel);
+
+	writer.String(server_settings_[kIOThreads].c_str());
+	writer.Uint(database_.Configuration.IOThreads);
+
 	// "vm" is an array of objects containing the settings for each VM
 	writer.String("vm");
 	writer.StartArray();
@@ -3511,6 +3809,18 @@ void CollabVMServer::WriteServerSettings(rapidjson::Writer<rapidjson::StringBuff
 					writer.String(vm_settings_[kMOTD].c_str());
 					writer.String(vm->MOTD.c_str());
 					break;
+				case kTiledUpdates:
+					writer.String(vm_settings_[kTiledUpdates].c_str());
+					writer.Bool(vm->TiledUpdates);
+					break;
+				case kImageEncoding:
+					writer.String(vm_settings_[kImageEncoding].c_str());
+					writer.String(image_encoders_[static_cast<size_t>(vm->ImageEncoding)].c_str());
+					break;
+				case kVideoMode:
+					writer.String(vm_settings_[kVideoMode].c_str());
+					writer.Bool(vm->VideoMode);
+					break;
 			}
 		}
 		writer.EndObject();
@@ -3651,6 +3961,53 @@ void CollabVMServer::ParseServerSettings(rapidjson::Value& settings, rapidjson::
 							valid = false;
 						}
 						break;
+					case kCompression:
+						if(value.IsBool()) {
+							config.Compression = value.GetBool();
+						} else {
+							WriteJSONObject(writer, server_settings_[kCompression], invalid_object_);
+							valid = false;
+						}
+						break;
+					case kCompressionWindowBits:
+						if(value.IsUint()) {
+							if(value.GetUint() >= 9 && value.GetUint() <= 15) {
+								config.CompressionWindowBits = value.GetUint();
+							} else {
+								WriteJSONObject(writer, server_settings_[kCompressionWindowBits], "Value must be between 9 and 15");
+								valid = false;
+							}
+						} else {
+							WriteJSONObject(writer, server_settings_[kCompressionWindowBits], invalid_object_);
+							valid = false;
+						}
+						break;
+					case kCompressionMemLevel:
+						if(value.IsUint()) {
+							if(value.GetUint() >= 1 && value.GetUint() <= 9) {
+								config.CompressionMemLevel = value.GetUint();
+							} else {
+								WriteJSONObject(writer, server_settings_[kCompressionMemLevel], "Value must be between 1 and 9");
+								valid = false;
+							}
+						} else {
+							WriteJSONObject(writer, server_settings_[kCompressionMemLevel], invalid_object_);
+							valid = false;
+						}
+						break;
+					case kIOThreads:
+						if(value.IsUint()) {
+							if(value.GetUint() <= std::numeric_limits<uint8_t>::max()) {
+								config.IOThreads = value.GetUint();
+							} else {
+								WriteJSONObject(writer, server_settings_[kIOThreads], "Value too big");
+								valid = false;
+							}
+						} else {
+							WriteJSONObject(writer, server_settings_[kIOThreads], invalid_object_);
+							valid = false;
+						}
+						break;
 				}
 				break;
 			}
@@ -3659,10 +4016,9 @@ void CollabVMServer::ParseServerSettings(rapidjson::Value& settings, rapidjson::
 
 	// Only save the configuration if all settings valid
 	if(valid) {
-#ifdef USE_JPEG
 		if(config.JPEGQuality <= 100)
 			SetJPEGQuality(config.JPEGQuality);
-#endif
+		SetCompression(config);
 		database_.Save(config);
 
 		// Set the value of the "result" property to true to indicate success
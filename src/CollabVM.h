@@ -11,12 +11,13 @@
 #include <set>
 #include <mutex>
 #include <atomic>
-#include <queue>
 #include <cstdint>
 #include <condition_variable>
 #include <deque>
 #include <list>
 #include <random>
+#include <thread>
+#include <vector>
 
 #include <websocketmm/fwd.h>
 
@@ -30,9 +31,12 @@
 #include "Database/VMSettings.h"
 #include "GuacUser.h"
 #include "CollabVMUser.h"
+#include "GuacArguments.h"
 #include "UploadInfo.h"
 
 #include "Chat.h"
+#include "ActionPool.h"
+#include "MPSCQueue.h"
 
 #ifdef _WIN32
 	#define strncasecmp _strnicmp
@@ -62,6 +66,21 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 	 */
 	void Stop();
 
+	/**
+	 * The number of threads that should run the io_service, from the config.
+	 * 0 means one per CPU core.
+	 */
+	inline unsigned int GetIOThreads() const {
+		return database_.Configuration.IOThreads;
+	}
+
+	/**
+	 * The strand that the server's timers run on.
+	 */
+	inline const VMController::Strand& GetStrand() const {
+		return strand_;
+	}
+
 	void OnVMControllerStateChange(const std::shared_ptr<VMController>& controller, VMController::ControllerState state);
 
 	/**
@@ -91,7 +110,7 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 	/**
 	 * Updates the preview for the VM.
 	 */
-	void OnVMControllerThumbnailUpdate(const std::shared_ptr<VMController>& controller, std::string* str);
+	void OnVMControllerThumbnailUpdate(const std::shared_ptr<VMController>& controller, std::shared_ptr<const std::string> str);
 
 	/**
 	 * Sends turn information to all user viewing a VM.
@@ -102,8 +121,9 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 
 	/**
 	 * Send turn info to the specified user because they just connected a VM.
+	 * The turn list is reused from the last BroadcastTurnInfo.
 	 */
-	void SendTurnInfo(CollabVMUser& user, uint32_t time_remaining, const std::string& current_turn, const std::deque<std::shared_ptr<CollabVMUser>>& turn_queue);
+	void SendTurnInfo(VMController& controller, CollabVMUser& user, uint32_t time_remaining);
 
 	void BroadcastVoteInfo(const VMController& vm, UserList& users, bool vote_started, uint32_t time_remaining, uint32_t yes_votes, uint32_t no_votes);
 
@@ -126,13 +146,19 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 	 */
 	void SendGuacMessage(std::weak_ptr<websocketmm::websocket_user> ptr, const std::string& str);
 
+	/**
+	 * Sends an already built message from a Guacamole client to a WebSocket connection.
+	 * The message is not copied, so the same message can be queued for many connections.
+	 */
+	void SendGuacMessage(std::weak_ptr<websocketmm::websocket_user> ptr, const std::shared_ptr<const websocketmm::websocket_message>& message);
+
 	void ExecuteCommandAsync(std::string command);
 	void MuteUser(const std::shared_ptr<CollabVMUser>& user, bool permanent);
 	void UnmuteUser(const std::shared_ptr<CollabVMUser>& user);
 
 	// Shared definition of guacamole instruction garbage
 #define GuacamoleInstruction(name) \
-		void On##name##Instruction(const std::shared_ptr<CollabVMUser>& user, std::vector<char*>& args);
+		void On##name##Instruction(const std::shared_ptr<CollabVMUser>& user, GuacArguments& args);
 
 	GuacamoleInstruction(Mouse)
 	GuacamoleInstruction(Key)
@@ -153,7 +179,7 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 	/**
 	 * Function pointer to a Guacamole instruction handler.
 	 */
-	typedef void (CollabVMServer::*GuacamoleInstruction)(const std::shared_ptr<CollabVMUser>& user, std::vector<char*>& args);
+	typedef void (CollabVMServer::*GuacamoleInstruction)(const std::shared_ptr<CollabVMUser>& user, GuacArguments& args);
 
 
 	void BroadcastMOTD(VMController& controller, const VMSettings& settings);
@@ -172,6 +198,7 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 		kMessage,		   // Process message
 		kAddConnection,	   // Add connection to map
 		kRemoveConnection, // Remove connection from map
+		kResyncConnection, // Resend the display to a connection that fell behind
 		kTurnChange,	   // Next turn
 		kVoteEnded,		   // Vote ended
 		kAgentConnect,	   // Agent connected
@@ -192,14 +219,28 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 
 	/**
 	 * Base class for actions that are consumed by the processing thread.
+	 * Actions are allocated from ActionPool.
 	 */
-	struct Action {
+	struct Action : public MPSCNode {
 		ActionType action;
 
+		/**
+		 * When the action was posted, for measuring how long it waited in the queue.
+		 */
+		std::chrono::steady_clock::time_point posted;
+
 		explicit Action(ActionType action)
 			: action(action) {
 		}
 
+		static void* operator new(size_t size) {
+			return ActionPool::Allocate(size);
+		}
+
+		static void operator delete(void* ptr) {
+			ActionPool::Free(ptr);
+		}
+
 		// Define a default virtual destructor, otherwise when deleting we
 		// will end up only calling the generated ~Action().
 		// This is crucial, as destructors for derived classes will not be called,
@@ -222,14 +263,22 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 	};
 
 	/**
-	 * An action emitted when a WebSocket message is received.
+	 * An action emitted for each instruction received in a WebSocket message.
 	 */
 	struct MessageAction : public UserAction {
 		std::shared_ptr<const websocketmm::websocket_message> message;
 
-		MessageAction(std::shared_ptr<const websocketmm::websocket_message>& msg, CollabVMUser& user, ActionType action)
+		/**
+		 * Where the instruction is in the message.
+		 */
+		size_t offset;
+		size_t length;
+
+		MessageAction(std::shared_ptr<const websocketmm::websocket_message>& msg, CollabVMUser& user, ActionType action, size_t offset, size_t length)
 			: UserAction(user, action),
-			  message(msg) {
+			  message(msg),
+			  offset(offset),
+			  length(length) {
 		}
 	};
 
@@ -250,10 +299,10 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 	};
 
 	struct VMThumbnailUpdate : public VMAction {
-		std::string* thumbnail;
-		VMThumbnailUpdate(const std::shared_ptr<VMController>& controller, std::string* thumbnail)
+		std::shared_ptr<const std::string> thumbnail;
+		VMThumbnailUpdate(const std::shared_ptr<VMController>& controller, std::shared_ptr<const std::string> thumbnail)
 			: VMAction(controller, ActionType::kVMThumbnail),
-			  thumbnail(thumbnail) {
+			  thumbnail(std::move(thumbnail)) {
 		}
 	};
 
@@ -312,11 +361,23 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 	template<class TAction, class ...Args>
 	inline void PostAction(Args&&... args) {
 		static_assert(std::is_base_of_v<Action, TAction> || std::is_same_v<TAction, Action>, "TAction needs to inherit from or be CollabVMServer::Action!");
-		std::unique_lock<std::mutex> lock(process_queue_lock_);
+		TAction* action = new TAction(std::forward<Args>(args)...);
+		action->posted = std::chrono::steady_clock::now();
+		process_queue_.Push(action);
+	}
 
-		process_queue_.push(new TAction(std::forward<Args>(args)...));
-		lock.unlock();
-		process_wait_.notify_one();
+	/**
+	 * Posts an action into the queue of a processing shard.
+	 * Arguments to this function are constructor arguments.
+	 *
+	 * \tparam TAction The action to post. Should be, or inherit from the Action class.
+	 */
+	template<class TAction, class ...Args>
+	inline void PostShardAction(uint32_t shard, Args&&... args) {
+		static_assert(std::is_base_of_v<Action, TAction> || std::is_same_v<TAction, Action>, "TAction needs to inherit from or be CollabVMServer::Action!");
+		TAction* action = new TAction(std::forward<Args>(args)...);
+		action->posted = std::chrono::steady_clock::now();
+		shards_[shard]->queue.Push(action);
 	}
 
 	struct case_insensitive_cmp {
@@ -331,6 +392,12 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 	void OnOpen(std::weak_ptr<websocketmm::websocket_user> handle);
 	void OnClose(std::weak_ptr<websocketmm::websocket_user> handle);
 
+	/**
+	 * Callback for when a connection has caught up after display updates were dropped
+	 * because it couldn't keep up.
+	 */
+	void OnResync(std::weak_ptr<websocketmm::websocket_user> handle);
+
 	void TimerCallback(const boost::system::error_code& ec, ActionType action);
 	void VMPreviewTimerCallback(const boost::system::error_code ec);
 	void IPDataTimerCallback(const boost::system::error_code& ec);
@@ -353,8 +420,21 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 	//std::string GenerateUuid();
 
 	void OnMessageFromWS(std::weak_ptr<websocketmm::websocket_user> handle, std::shared_ptr<const websocketmm::websocket_message> msg);
+
+	/**
+	 * Parses a mouse or key instruction on the websocket thread and queues it
+	 * for the VM if the user holds the turn.
+	 * @returns False if the user doesn't hold the turn.
+	 */
+	bool QueueTurnInput(CollabVMUser& user, const std::uint8_t* data, size_t length);
 	void SendWSMessage(CollabVMUser& user, const std::string& str);
 
+	/**
+	 * Sends a message that was already built, so one message can be
+	 * shared by every user it's broadcast to.
+	 */
+	void SendWSMessage(CollabVMUser& user, const std::shared_ptr<const websocketmm::websocket_message>& msg);
+
 	/**
 	 * The main loop for the processing thread.
 	 */
@@ -402,6 +482,18 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 	 */
 	void SendOnlineUsersList(CollabVMUser& user);
 
+	/**
+	 * Add or remove a user's entry in the encoded online users list.
+	 * These must be kept in step with usernames_.
+	 */
+	void AddOnlineUser(const std::string& username, UserRank rank);
+	void RemoveOnlineUser(const std::string& username);
+
+	/**
+	 * Changes the rank of a user and updates their entry in the online users list.
+	 */
+	void SetUserRank(CollabVMUser& user, UserRank rank);
+
 	/**
 	 * Sends an action instruction to all users currently connected to the VMController.
 	 */
@@ -471,6 +563,12 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 	 */
 	void ParseServerSettings(rapidjson::Value& settings, rapidjson::Writer<rapidjson::StringBuffer>& writer);
 
+	/**
+	 * Apply the WebSocket compression settings to the server.
+	 * They only affect connections made afterwards.
+	 */
+	void SetCompression(const Config& config);
+
 	bool ParseVMSettings(VMSettings& vm, rapidjson::Value& settings, rapidjson::Writer<rapidjson::StringBuffer>& writer);
 
 	std::shared_ptr<VMController> CreateVMController(const std::shared_ptr<VMSettings>& vm);
@@ -482,6 +580,14 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 	void DeleteIPData(IPData& ip_data);
 
 	boost::asio::io_service& service_;
+
+	/**
+	 * Timers and VM controllers run on this strand, so their handlers stay
+	 * serialized when the io_service is run by several threads. Websocket
+	 * connections each have their own strand.
+	 */
+	VMController::Strand strand_;
+
 	std::shared_ptr<Server> server_;
 
 	CollabVM::Database database_;
@@ -504,6 +610,29 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 	 */
 	std::map<std::string, std::shared_ptr<CollabVMUser>, case_insensitive_cmp> usernames_;
 
+	/**
+	 * The adduser elements for everyone in usernames_, updated as users
+	 * join, leave and change their names or ranks.
+	 */
+	std::string online_users_;
+
+	/**
+	 * The adduser instruction sent to users joining a VM. It's built from
+	 * online_users_ when it's needed and reset whenever that changes.
+	 */
+	std::shared_ptr<const websocketmm::websocket_message> online_users_msg_;
+
+	/**
+	 * The response to the list instruction, built when it's needed.
+	 */
+	std::shared_ptr<const websocketmm::websocket_message> vm_list_msg_;
+
+	/**
+	 * Set when a VM or its thumbnail changes so vm_list_msg_ is rebuilt.
+	 * Thumbnails are updated on the shards, so this is atomic.
+	 */
+	std::atomic<bool> vm_list_stale_;
+
 	/**
 	 * List of usernames that should not be allowed
 	 */
@@ -518,9 +647,94 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 	/**
 	 * A queue containing actions for the processing thread to perform.
 	 */
-	std::queue<Action*> process_queue_;
-	std::mutex process_queue_lock_;
-	std::condition_variable process_wait_;
+	MPSCQueue<Action> process_queue_;
+
+	/**
+	 * Set when the server is stopping, so the processing thread discards
+	 * every action queued before the shutdown action.
+	 */
+	std::atomic<bool> discard_actions_;
+
+	/**
+	 * A serialized executor for the actions of the VM controllers assigned
+	 * to it, such as their turn changes and the input of their users.
+	 * Shards run in parallel with each other, so input on one VM doesn't
+	 * wait behind chat or admin commands for another.
+	 *
+	 * A shard holds its lock while it handles an action, and the processing
+	 * thread holds the locks of every shard while it handles one of its own.
+	 * This means global state (usernames_, connections_, the IP data) and
+	 * anything spanning several VMs, like renames and chat, can simply be
+	 * handled on the processing thread. Work that only concerns one VM is
+	 * handed to its shard with PostShardAction.
+	 */
+	struct ProcessingShard {
+		MPSCQueue<Action> queue;
+		std::mutex lock;
+		std::thread thread;
+	};
+
+	std::vector<std::unique_ptr<ProcessingShard>> shards_;
+
+	/**
+	 * The shard that the next VM controller will be assigned to.
+	 */
+	uint32_t next_shard_;
+
+	/**
+	 * Locks every processing shard for the lifetime of the object.
+	 */
+	class ShardsLock {
+	   public:
+		explicit ShardsLock(std::vector<std::unique_ptr<ProcessingShard>>& shards)
+			: shards_(shards) {
+			for(auto& shard : shards_)
+				shard->lock.lock();
+		}
+
+		~ShardsLock() {
+			for(auto it = shards_.rbegin(); it != shards_.rend(); it++)
+				(*it)->lock.unlock();
+		}
+
+	   private:
+		std::vector<std::unique_ptr<ProcessingShard>>& shards_;
+	};
+
+	/**
+	 * The main loop for a processing shard.
+	 */
+	void ShardThread(uint32_t index);
+
+	/**
+	 * Statistics for the processing thread or a shard, which are logged
+	 * periodically in debug builds.
+	 */
+	struct ProcessingStats {
+		explicit ProcessingStats(std::string name)
+			: name(std::move(name)) {
+		}
+
+		std::string name;
+		std::chrono::steady_clock::time_point next_log;
+		bool batch_started = false;
+
+		size_t actions = 0;
+		size_t batches = 0;
+		size_t max_depth = 0;
+		std::chrono::microseconds latency { 0 };
+		std::chrono::microseconds max_latency { 0 };
+	};
+
+	/**
+	 * Waits for the next action in the queue and records it in the statistics.
+	 */
+	Action* NextAction(MPSCQueue<Action>& queue, ProcessingStats& stats);
+
+	/**
+	 * Log the processing statistics in debug builds and reset them.
+	 */
+	void LogProcessingStats(ProcessingStats& stats);
 
 	/**
 	 * A timer that sends keep-alive instructions to all the websocket clients.
@@ -555,6 +769,18 @@ class CollabVMServer : public std::enable_shared_from_this<CollabVMServer> {
 	 */
 	const uint8_t kKeepAliveInterval = 5;
 
+	/**
+	 * How frequently the processing thread's statistics are logged.
+	 * Measured in seconds.
+	 */
+	const uint8_t kProcessingStatsInterval = 60;
+
+	/**
+	 * The most processing shards that are created, the actual number is
+	 * limited by the number of hardware threads.
+	 */
+	const uint32_t kMaxProcessingShards = 8;
+
 	/**
 	 * How long before a client is disconnected.
 	 * Measured in seconds.
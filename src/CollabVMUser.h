@@ -1,10 +1,13 @@
 #pragma once
 #include <array>
+#include <atomic>
 #include <memory>
 #include <map>
+#include <mutex>
 #include <fstream>
 #include <stdint.h>
 #include "GuacUser.h"
+#include "GuacInstructionStream.h"
 
 #include <websocketmm/fwd.h>
 
@@ -170,7 +173,9 @@ class CollabVMUser : public std::enable_shared_from_this<CollabVMUser> {
 		  prev_(nullptr),
 		  handle(handle),
 		  vm_controller(nullptr),
+		  shard(kNoShard),
 		  guac_user(nullptr),
+		  turn_client(nullptr),
 		  waiting_turn(false),
 		  user_rank(UserRank::kUnregistered),
 		  //user_id(0),
@@ -199,12 +204,38 @@ class CollabVMUser : public std::enable_shared_from_this<CollabVMUser> {
 	 */
 	VMController* vm_controller;
 
+	/**
+	 * The processing shard of the VM that the client is viewing, or kNoShard.
+	 * Read by the websocket threads to route input instructions straight
+	 * to the shard.
+	 */
+	std::atomic<uint32_t> shard;
+
+	static constexpr uint32_t kNoShard = UINT32_MAX;
+
 	/**
 	 * The Guacamole user associated with the VM that the client
 	 * is viewing. May be null if the user is not viewing a VM.
 	 */
 	GuacUser* guac_user;
 
+	/**
+	 * The Guacamole client of the VM while the user holds its turn, so their
+	 * input can be queued straight from the websocket thread. Null otherwise.
+	 */
+	GuacClient* turn_client;
+
+	/**
+	 * Guards turn_client.
+	 */
+	std::mutex turn_input_lock;
+
+	/**
+	 * Splits the messages from the client into instructions. Only used by
+	 * the websocket thread reading from the client.
+	 */
+	GuacInstructionStream instruction_stream;
+
 	/**
 	 * Set to true when the user is waiting for a turn to control the VM.
 	 */
@@ -26,11 +26,11 @@ struct Config {
 		  ChatMsgHistory(10),
 		  MaxUploadTime(120),
 		  BanCommand(""),
-#ifdef USE_JPEG
 		  JPEGQuality(75),
-#else
-		  JPEGQuality(255),
-#endif
+		  Compression(false),
+		  CompressionWindowBits(15),
+		  CompressionMemLevel(4),
+		  IOThreads(1),
 		  ModEnabled(false),
 		  ModPerms(0) {
 	}
@@ -63,6 +63,19 @@ struct Config {
 
 	uint8_t JPEGQuality;
 
+	/**
+	 * Whether WebSocket messages are compressed with permessage-deflate.
+	 */
+	bool Compression;
+	uint8_t CompressionWindowBits;
+	uint8_t CompressionMemLevel;
+
+	/**
+	 * The number of threads that run network I/O and timers, or 0 for one
+	 * per CPU core. Only read when the server starts.
+	 */
+	uint8_t IOThreads;
+
 	bool ModEnabled;
 
 	uint16_t ModPerms;
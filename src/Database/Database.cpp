@@ -32,6 +32,10 @@ namespace CollabVM {
 									   make_column("MaxUploadTime", &Config::MaxUploadTime),
 									   make_column("BanCommand", &Config::BanCommand),
 									   make_column("JPEGQuality", &Config::JPEGQuality),
+									   make_column("Compression", &Config::Compression, default_value(false)),
+									   make_column("CompressionWindowBits", &Config::CompressionWindowBits, default_value(15)),
+									   make_column("CompressionMemLevel", &Config::CompressionMemLevel, default_value(4)),
+									   make_column("IOThreads", &Config::IOThreads, default_value(1)),
 									   make_column("ModEnabled", &Config::ModEnabled),
 									   make_column("ModPerms", &Config::ModPerms),
 									   make_column("BlacklistedNames", &Config::BlacklistedNames)),
@@ -68,7 +72,10 @@ namespace CollabVM {
 									   make_column("QMPAddress", &VMSettings::QMPAddress),
 									   make_column("QMPPort", &VMSettings::QMPPort),
 									   make_column("QEMUCmd", &VMSettings::QEMUCmd),
-									   make_column("QEMUSnapshotMode", &VMSettings::QEMUSnapshotMode))
+									   make_column("QEMUSnapshotMode", &VMSettings::QEMUSnapshotMode),
+									   make_column("TiledUpdates", &VMSettings::TiledUpdates, default_value(false)),
+									   make_column("ImageEncoding", &VMSettings::ImageEncoding, default_value(static_cast<uint8_t>(VMSettings::ImageEncoder::kPNG))),
+									   make_column("VideoMode", &VMSettings::VideoMode, default_value(false)))
 							);
 	}
 
@@ -26,6 +26,13 @@ struct VMSettings {
 		kLocal
 	};
 
+	enum ImageEncoder {
+		kPNG,	  // Lossless PNG for everything
+		kJPEG,	  // JPEG for the screen
+		kWebP,	  // Lossy WebP for the screen, JPEG if built without WebP
+		kAdaptive // Chosen for each update from its contents
+	};
+
 	std::string Name;
 
 	uint8_t Hypervisor { HypervisorEnum::kQEMU };
@@ -71,6 +78,10 @@ struct VMSettings {
 	uint16_t QMPPort {};
 	std::string QEMUCmd;
 	uint8_t QEMUSnapshotMode { SnapshotMode::kOff };
+
+	bool TiledUpdates = false;
+	uint8_t ImageEncoding { ImageEncoder::kPNG };
+	bool VideoMode = false;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+/**
+ * The arguments of a decoded Guacamole instruction. They point into the
+ * buffer that the instruction was decoded from, and each one is
+ * null-terminated so that handlers can use them as C strings.
+ */
+class GuacArguments {
+   public:
+	/**
+	 * The most arguments an instruction can have. Instructions with more
+	 * are rejected by the parser.
+	 */
+	static constexpr size_t kMaxArguments = 64;
+
+	inline size_t size() const {
+		return count_;
+	}
+
+	inline bool empty() const {
+		return !count_;
+	}
+
+	inline char* operator[](size_t i) const {
+		return args_[i];
+	}
+
+	/**
+	 * Get an argument along with its length.
+	 */
+	inline std::string_view view(size_t i) const {
+		return std::string_view(args_[i], lengths_[i]);
+	}
+
+	/**
+	 * Add an argument, returns false if there are too many.
+	 * The argument must be followed by a null terminator.
+	 */
+	inline bool push_back(char* arg, size_t length) {
+		if(count_ == kMaxArguments)
+			return false;
+		args_[count_] = arg;
+		lengths_[count_] = length;
+		count_++;
+		return true;
+	}
+
+	inline void clear() {
+		count_ = 0;
+	}
+
+   private:
+	std::array<char*, kMaxArguments> args_;
+	std::array<size_t, kMaxArguments> lengths_;
+	size_t count_ = 0;
+};
@@ -11,27 +11,31 @@ GuacBroadcastSocket::GuacBroadcastSocket(CollabVMServer& server, UserList& users
 }
 
 void GuacBroadcastSocket::InstructionBegin() {
-	// Lock stringstream
+	// Lock instruction buffer
 	mutex_.lock();
 
-	// Clear stringstream
-	ss_.str("");
+	// Clear instruction buffer
+	buffer_.Clear();
 }
 
 void GuacBroadcastSocket::InstructionEnd() {
-	std::string str = ss_.str();
+	std::vector<std::uint8_t> data = buffer_.Release();
 
-	// Unlock stringstream
+	// Unlock instruction buffer
 	mutex_.unlock();
 
 	// Check that the message ends with a semicolon
-	assert(str[str.length() - 1] == ';');
+	assert(data.back() == ';');
 
-	users_.ForEachUserLock([&](CollabVMUser& user) {
-		//user.guac_user->socket_.websocket_handle_->send(websocketmm::BuildWebsocketMessage(str))
+	// Build the message once. Every user's send queue holds a reference
+	// to the same buffer, so broadcasting doesn't copy the instruction per user.
+	// Users that fall behind can skip display updates, they are sent a keyframe
+	// once they have caught up.
+	auto message = websocketmm::BuildWebsocketMessage(websocketmm::websocket_message::type::text, std::move(data), true);
 
+	users_.ForEachUserLock([&](CollabVMUser& user) {
 		// This really shouldn't happen, but if it does, it does.
 		if(user.guac_user != nullptr)
-			server_.SendGuacMessage(user.guac_user->socket_.websocket_handle_, str);
+			server_.SendGuacMessage(user.guac_user->socket_.websocket_handle_, message);
 	});
 }
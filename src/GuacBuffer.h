@@ -0,0 +1,94 @@
+#pragma once
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/**
+ * Growable byte buffer that Guacamole instructions are built in.
+ * The finished buffer can be moved straight into a websocket message
+ * so instructions are never copied into an intermediate std::string.
+ */
+class GuacBuffer {
+   public:
+	GuacBuffer() {
+		data_.reserve(kInitialCapacity);
+	}
+
+	inline void Write(const void* buf, size_t count) {
+		const std::uint8_t* bytes = static_cast<const std::uint8_t*>(buf);
+		data_.insert(data_.end(), bytes, bytes + count);
+	}
+
+	inline void WriteString(const char* str) {
+		Write(str, std::strlen(str));
+	}
+
+	inline void WriteInt(int64_t i) {
+		char buffer[24];
+		auto result = std::to_chars(buffer, buffer + sizeof(buffer), i);
+		Write(buffer, result.ptr - buffer);
+	}
+
+	inline void Put(char c) {
+		data_.push_back(static_cast<std::uint8_t>(c));
+	}
+
+	/**
+	 * Grow the buffer by count bytes and return a pointer to the start
+	 * of the new space, so encoders can write to it directly.
+	 */
+	inline char* Extend(size_t count) {
+		const size_t size = data_.size();
+		data_.resize(size + count);
+		return reinterpret_cast<char*>(data_.data() + size);
+	}
+
+	inline void Clear() {
+		data_.clear();
+	}
+
+	inline size_t Size() const {
+		return data_.size();
+	}
+
+	inline bool Empty() const {
+		return data_.empty();
+	}
+
+	inline const std::uint8_t* Data() const {
+		return data_.data();
+	}
+
+	/**
+	 * Take the contents of the buffer, leaving it empty and ready
+	 * for the next instruction. Small instructions are copied out so the
+	 * buffer keeps its capacity and is reused, while large ones, such as
+	 * images, are moved out instead of being copied.
+	 */
+	inline std::vector<std::uint8_t> Release() {
+		if(data_.size() <= kMaxCopySize) {
+			std::vector<std::uint8_t> data(data_.begin(), data_.end());
+			data_.clear();
+			return data;
+		}
+
+		std::vector<std::uint8_t> data = std::move(data_);
+		data_ = std::vector<std::uint8_t>();
+		data_.reserve(kInitialCapacity);
+		return data;
+	}
+
+   private:
+	/**
+	 * Capacity reserved up front, enough for every non-image instruction.
+	 */
+	static constexpr size_t kInitialCapacity = 256;
+
+	/**
+	 * The largest instruction that Release() copies instead of moving.
+	 */
+	static constexpr size_t kMaxCopySize = 4096;
+
+	std::vector<std::uint8_t> data_;
+};
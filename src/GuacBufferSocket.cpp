@@ -0,0 +1,11 @@
+#include "GuacBufferSocket.h"
+
+void GuacBufferSocket::InstructionBegin() {
+	// Lock instruction buffer
+	mutex_.lock();
+}
+
+void GuacBufferSocket::InstructionEnd() {
+	// Keep the instruction in the buffer after the ones before it
+	mutex_.unlock();
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include "GuacSocket.h"
+
+/**
+ * A socket that collects instructions in its buffer instead of sending
+ * them, so a sequence of instructions can be encoded once and sent to
+ * many users.
+ */
+class GuacBufferSocket : public GuacSocket {
+   public:
+	void InstructionBegin() override;
+	void InstructionEnd() override;
+};
@@ -7,6 +7,7 @@
 #include "guacamole/client-constants.h"
 #include "guacamole/user-constants.h"
 #include "guacamole/user-handlers.h"
+#include <algorithm>
 
 using std::mutex;
 using std::lock_guard;
@@ -97,10 +98,75 @@ void GuacClient::AddUser(GuacUser& user) {
 		OnUserJoin(user);
 }
 
+void GuacClient::ResyncUser(GuacUser& user) {
+	// Users are sent the whole display when they join
+	lock_guard<mutex> state_lock(state_mutex_);
+	if(client_state_ == ClientState::kConnected)
+		OnUserJoin(user);
+}
+
 void GuacClient::RemoveUser(GuacUser& user) {
+	// Forget the user's queued input, which would outlive them otherwise
+	lock_guard<mutex> handling_lock(input_handling_mutex_);
+	unique_lock<mutex> input_lock(input_mutex_);
+	input_queue_.erase(std::remove_if(input_queue_.begin(), input_queue_.end(),
+									  [&user](const InputEvent& event) { return event.user == &user; }),
+					   input_queue_.end());
+	input_lock.unlock();
+
 	OnUserLeave(user);
 }
 
+void GuacClient::QueueInput(const InputEvent& event) {
+	unique_lock<mutex> lock(input_mutex_);
+	bool was_empty = input_queue_.empty();
+	if(!was_empty && event.type == InputEvent::Type::kMouse) {
+		InputEvent& last = input_queue_.back();
+		if(last.type == InputEvent::Type::kMouse && last.user == event.user && last.args[2] == event.args[2]) {
+			last.args[0] = event.args[0];
+			last.args[1] = event.args[1];
+			return;
+		}
+	}
+
+	if(input_queue_.size() >= kMaxQueuedInput && event.type == InputEvent::Type::kMouse) {
+		// Only drop pointer moves; a button change or key event that went
+		// missing could leave a button or key held down in the guest
+		auto last = std::find_if(input_queue_.rbegin(), input_queue_.rend(), [&event](const InputEvent& queued) {
+			return queued.type == InputEvent::Type::kMouse && queued.user == event.user;
+		});
+		if(last != input_queue_.rend() && last->args[2] == event.args[2])
+			return;
+	}
+	input_queue_.push_back(event);
+	lock.unlock();
+
+	if(was_empty)
+		OnInputQueued();
+}
+
+void GuacClient::ProcessInput() {
+	lock_guard<mutex> handling_lock(input_handling_mutex_);
+	unique_lock<mutex> input_lock(input_mutex_);
+	if(input_queue_.empty())
+		return;
+	input_batch_.swap(input_queue_);
+	input_lock.unlock();
+
+	for(const InputEvent& event : input_batch_) {
+		if(event.type == InputEvent::Type::kMouse)
+			MouseHandler(*event.user, event.args[0], event.args[1], event.args[2]);
+		else
+			KeyHandler(*event.user, event.args[0], event.args[1]);
+	}
+	input_batch_.clear();
+}
+
+void GuacClient::DiscardInput() {
+	lock_guard<mutex> lock(input_mutex_);
+	input_queue_.clear();
+}
+
 void GuacClient::OnConnect() {
 	unique_lock<mutex> lock(state_mutex_);
 	if(client_state_ != ClientState::kConnecting)
@@ -213,7 +279,7 @@ int64_t __guac_parse_int(const char* str) {
 	return num * sign;
 }
 
-void GuacClient::HandleSync(GuacUser& user, std::vector<char*>& args) {
+void GuacClient::HandleSync(GuacUser& user, GuacArguments& args) {
 	if(args.size() != 1)
 		return;
 
@@ -251,22 +317,22 @@ void GuacClient::HandleSync(GuacUser& user, std::vector<char*>& args) {
 	//	user.sync_handler(user, timestamp);
 }
 
-void GuacClient::HandleMouse(GuacUser& user, std::vector<char*>& args) {
+void GuacClient::HandleMouse(GuacUser& user, GuacArguments& args) {
 	if(args.size() == 3)
-		MouseHandler(user,
-					 atoi(args[0]), /* x */
-					 atoi(args[1]), /* y */
-					 atoi(args[2]) /* mask */);
+		QueueInput({ InputEvent::Type::kMouse, &user,
+					 { atoi(args[0]), /* x */
+					   atoi(args[1]), /* y */
+					   atoi(args[2]) /* mask */ } });
 }
 
-void GuacClient::HandleKey(GuacUser& user, std::vector<char*>& args) {
+void GuacClient::HandleKey(GuacUser& user, GuacArguments& args) {
 	if(args.size() == 2)
-		KeyHandler(user,
-				   atoi(args[0]), /* keysym */
-				   atoi(args[1]) /* pressed */);
+		QueueInput({ InputEvent::Type::kKey, &user,
+					 { atoi(args[0]), /* keysym */
+					   atoi(args[1]) /* pressed */ } });
 }
 
-void GuacClient::HandleClipboard(GuacUser& user, std::vector<char*>& args) {
+void GuacClient::HandleClipboard(GuacUser& user, GuacArguments& args) {
 	if(args.size() != 2)
 		return;
 
@@ -282,15 +348,15 @@ void GuacClient::HandleClipboard(GuacUser& user, std::vector<char*>& args) {
 					 args[1] /* mimetype */);
 }
 
-//void GuacClient::HandleFile(GuacUser& user, std::vector<char*>& args)
+//void GuacClient::HandleFile(GuacUser& user, GuacArguments& args)
 //{
 //}
 //
-//void GuacClient::HandlePipe(GuacUser& user, std::vector<char*>& args)
+//void GuacClient::HandlePipe(GuacUser& user, GuacArguments& args)
 //{
 //}
 //
-//void GuacClient::HandleAck(GuacUser& user, std::vector<char*>& args)
+//void GuacClient::HandleAck(GuacUser& user, GuacArguments& args)
 //{
 //	int result;
 //	int stream_index = atoi(args[0]);
@@ -312,7 +378,7 @@ void GuacClient::HandleClipboard(GuacUser& user, std::vector<char*>& args) {
 //	stream->index = GUAC_USER_CLOSED_STREAM_INDEX;
 //}
 //
-//void GuacClient::HandleBlob(GuacUser& user, std::vector<char*>& args)
+//void GuacClient::HandleBlob(GuacUser& user, GuacArguments& args)
 //{
 //	int stream_index = atoi(args[0]);
 //	guac_stream* stream = __get_open_input_stream(user, stream_index);
@@ -339,7 +405,7 @@ void GuacClient::HandleClipboard(GuacUser& user, std::vector<char*>& args) {
 //		"File transfer unsupported", GUAC_PROTOCOL_STATUS_UNSUPPORTED);
 //}
 //
-//void GuacClient::HandleEnd(GuacUser& user, std::vector<char*>& args)
+//void GuacClient::HandleEnd(GuacUser& user, GuacArguments& args)
 //{
 //	int result = 0;
 //	int stream_index = atoi(args[0]);
@@ -361,11 +427,11 @@ void GuacClient::HandleClipboard(GuacUser& user, std::vector<char*>& args) {
 //	stream->index = GUAC_USER_CLOSED_STREAM_INDEX;
 //}
 //
-//void GuacClient::HandleSize(GuacUser& user, std::vector<char*>& args)
+//void GuacClient::HandleSize(GuacUser& user, GuacArguments& args)
 //{
 //}
 
-void GuacClient::HandleDisconnect(GuacUser& user, std::vector<char*>& args) {
+void GuacClient::HandleDisconnect(GuacUser& user, GuacArguments& args) {
 	//user.Stop();
 }
 
@@ -7,6 +7,7 @@
 #include "guacamole/stream.h"
 #include "guacamole/protocol.h"
 #include "UserList.h"
+#include "GuacArguments.h"
 #include <string>
 #include <stdint.h>
 #include <mutex>
@@ -45,6 +46,19 @@ class GuacClient {
 		kProtocolError // Protocol error
 	};
 
+	/**
+	 * A mouse or key event waiting to be handled by the client thread.
+	 */
+	struct InputEvent {
+		enum class Type : uint8_t {
+			kMouse, // args are the x and y coordinates and the button mask
+			kKey	// args are the keysym and whether it was pressed
+		} type;
+
+		GuacUser* user;
+		int args[3];
+	};
+
 	GuacClient(CollabVMServer& server, VMController& controller, UserList& users, const std::string& hostname, uint16_t port, uint16_t frame_duration);
 
 	virtual ~GuacClient();
@@ -88,6 +102,11 @@ class GuacClient {
 	 */
 	void RemoveUser(GuacUser& user);
 
+	/**
+	 * Resend the display to a user that missed updates.
+	 */
+	void ResyncUser(GuacUser& user);
+
 	/**
 	 * Returns true if the client is connected.
 	 */
@@ -114,17 +133,27 @@ class GuacClient {
 	/**
 	 * User instruction handlers
 	 */
-	void HandleSync(GuacUser& user, std::vector<char*>& args);
-	void HandleMouse(GuacUser& user, std::vector<char*>& args);
-	void HandleKey(GuacUser& user, std::vector<char*>& args);
-	void HandleClipboard(GuacUser& user, std::vector<char*>& args);
-	//void HandleFile(GuacUser& user, std::vector<char*>& args);
-	//void HandlePipe(GuacUser& user, std::vector<char*>& args);
-	//void HandleAck(GuacUser& user, std::vector<char*>& args);
-	//void HandleBlob(GuacUser& user, std::vector<char*>& args);
-	//void HandleEnd(GuacUser& user, std::vector<char*>& args);
-	//void HandleSize(GuacUser& user, std::vector<char*>& args);
-	void HandleDisconnect(GuacUser& user, std::vector<char*>& args);
+	void HandleSync(GuacUser& user, GuacArguments& args);
+	void HandleMouse(GuacUser& user, GuacArguments& args);
+	void HandleKey(GuacUser& user, GuacArguments& args);
+	void HandleClipboard(GuacUser& user, GuacArguments& args);
+	//void HandleFile(GuacUser& user, GuacArguments& args);
+	//void HandlePipe(GuacUser& user, GuacArguments& args);
+	//void HandleAck(GuacUser& user, GuacArguments& args);
+	//void HandleBlob(GuacUser& user, GuacArguments& args);
+	//void HandleEnd(GuacUser& user, GuacArguments& args);
+	//void HandleSize(GuacUser& user, GuacArguments& args);
+	void HandleDisconnect(GuacUser& user, GuacArguments& args);
+
+	/**
+	 * Queue a mouse or key event to be handled by the client thread.
+	 * Safe to call from any thread. A pointer move replaces the previous
+	 * event if it was a move by the same user with the same buttons held,
+	 * so moves that arrive faster than they can be sent are coalesced.
+	 * Once kMaxQueuedInput events are waiting, further moves are dropped,
+	 * but button changes and key events are always queued.
+	 */
+	void QueueInput(const InputEvent& event);
 
 	void Log(guac_client_log_level level, const char* format, ...);
 
@@ -176,6 +205,25 @@ class GuacClient {
 	*/
 	void OnConnect();
 
+	/**
+	 * Called by the client thread to pass the queued input to the mouse
+	 * and key handlers.
+	 */
+	void ProcessInput();
+
+	/**
+	 * Throw away queued input, for when the connection to the server is
+	 * (re)established.
+	 */
+	void DiscardInput();
+
+	/**
+	 * Called after input is queued while the queue was empty, so derived
+	 * classes can wake the client thread.
+	 */
+	virtual void OnInputQueued() {
+	}
+
 	std::string hostname_;
 	uint16_t port_;
 
@@ -214,6 +262,30 @@ class GuacClient {
 	std::atomic<bool> update_thumbnail_;
 
    private:
+	/**
+	 * The number of input events waiting for the client thread after
+	 * which pointer moves are dropped until it catches up.
+	 */
+	static constexpr size_t kMaxQueuedInput = 256;
+
+	/**
+	 * Input waiting for the client thread, guarded by input_mutex_.
+	 */
+	std::vector<InputEvent> input_queue_;
+	std::mutex input_mutex_;
+
+	/**
+	 * The events being handled by the client thread. It swaps them with
+	 * input_queue_ so that neither side allocates once both are warm.
+	 */
+	std::vector<InputEvent> input_batch_;
+
+	/**
+	 * Held by the client thread while it handles input, so users can't
+	 * leave while one of their events is being handled.
+	 */
+	std::mutex input_handling_mutex_;
+
 	/**
 	 * The number of currently-connected users. This value may include inactive
 	 * users if cleanup of those users has not yet finished.
@@ -0,0 +1,8 @@
+#include "GuacEncoderPool.h"
+#include <algorithm>
+#include <thread>
+
+boost::asio::thread_pool& GetEncoderPool() {
+	static boost::asio::thread_pool pool(std::max(1u, std::thread::hardware_concurrency()));
+	return pool;
+}
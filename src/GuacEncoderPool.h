@@ -0,0 +1,9 @@
+#pragma once
+#include <boost/asio/thread_pool.hpp>
+
+/**
+ * Returns the thread pool shared by every VM for encoding images. It has
+ * one thread per hardware thread, so the total encoding work in flight is
+ * bounded no matter how many VMs are running.
+ */
+boost::asio::thread_pool& GetEncoderPool();
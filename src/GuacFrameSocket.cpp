@@ -0,0 +1,200 @@
+#include "GuacFrameSocket.h"
+#include "GuacBufferSocket.h"
+#include "GuacEncoderPool.h"
+#include "guacamole/protocol.h"
+#include <cairo/cairo.h>
+#include <cstring>
+
+#include <boost/asio/post.hpp>
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+
+GuacFrameSocket::GuacFrameSocket(GuacSocket& output)
+	: output_(output) {
+}
+
+GuacFrameSocket::~GuacFrameSocket() {
+	Wait();
+}
+
+GuacFrameSocket::Frame& GuacFrameSocket::CurrentFrame() {
+	if(!current_)
+		current_ = std::make_shared<Frame>();
+	return *current_;
+}
+
+void GuacFrameSocket::InstructionBegin() {
+	// Lock instruction buffer
+	mutex_.lock();
+}
+
+void GuacFrameSocket::InstructionEnd() {
+	// Consecutive instructions are sent together as one message
+	Frame& frame = CurrentFrame();
+	if(frame.items.empty() || frame.items.back().image)
+		frame.items.emplace_back();
+
+	std::vector<std::uint8_t>& data = frame.items.back().data;
+	data.insert(data.end(), buffer_.Data(), buffer_.Data() + buffer_.Size());
+	buffer_.Clear();
+
+	// Unlock instruction buffer
+	mutex_.unlock();
+}
+
+bool GuacFrameSocket::DeferImage(guac_composite_mode mode, const guac_layer* layer, int x, int y, cairo_surface_t* surface,
+								 guac_image_encoding encoding, int quality) {
+	Item item;
+	item.image = true;
+	item.mode = mode;
+	item.encoding = encoding;
+	item.quality = quality;
+	item.layer = layer;
+	item.x = x;
+	item.y = y;
+	item.width = cairo_image_surface_get_width(surface);
+	item.height = cairo_image_surface_get_height(surface);
+	item.format = cairo_image_surface_get_format(surface);
+
+	// The source will be drawn over by later updates, so copy it now
+	const unsigned char* src = cairo_image_surface_get_data(surface);
+	int src_stride = cairo_image_surface_get_stride(surface);
+	size_t row_size = item.width * 4;
+	item.pixels.resize(row_size * item.height);
+	for(int row = 0; row < item.height; row++)
+		std::memcpy(item.pixels.data() + row * row_size, src + row * src_stride, row_size);
+
+	CurrentFrame().items.push_back(std::move(item));
+	return true;
+}
+
+void GuacFrameSocket::Submit(microseconds decode, microseconds flush) {
+	if(!current_)
+		return;
+
+	std::shared_ptr<Frame> frame = std::move(current_);
+	frame->decode = decode;
+	frame->flush = flush;
+
+	Enqueue(frame, true);
+
+	// Hold one count until every image has been posted so the frame
+	// can't be sent before the last one is encoded
+	frame->submitted = steady_clock::now();
+	for(size_t i = 0; i < frame->items.size(); i++) {
+		if(frame->items[i].image) {
+			frame->remaining++;
+			boost::asio::post(GetEncoderPool(), [this, frame, i]() {
+				Encode(frame, i);
+			});
+		}
+	}
+
+	if(--frame->remaining == 0)
+		Encoded(frame);
+}
+
+void GuacFrameSocket::Post(std::function<void()> callback) {
+	std::shared_ptr<Frame> frame = std::make_shared<Frame>();
+	frame->callback = std::move(callback);
+	frame->submitted = steady_clock::now();
+
+	Enqueue(frame, false);
+	Encoded(frame);
+}
+
+void GuacFrameSocket::Wait() {
+	std::unique_lock<std::mutex> lock(frames_mutex_);
+	frames_wait_.wait(lock, [this]() {
+		return frames_.empty();
+	});
+	lock.unlock();
+
+	// The last frame may have been popped by a thread that is still
+	// in SendReady(), so wait for it to leave
+	std::lock_guard<std::mutex> send_lock(send_mutex_);
+}
+
+GuacFrameSocket::Timings GuacFrameSocket::TakeTimings() {
+	std::lock_guard<std::mutex> lock(frames_mutex_);
+	Timings timings = timings_;
+	timings_ = Timings();
+	return timings;
+}
+
+void GuacFrameSocket::Enqueue(const std::shared_ptr<Frame>& frame, bool wait) {
+	std::unique_lock<std::mutex> lock(frames_mutex_);
+	if(wait) {
+		frames_wait_.wait(lock, [this]() {
+			return frames_.size() < kMaxFrames;
+		});
+	}
+	// Not yet encoded until Submit() releases its count
+	frame->remaining = 1;
+	frames_.push_back(frame);
+}
+
+void GuacFrameSocket::Encode(const std::shared_ptr<Frame>& frame, size_t index) {
+	Item& item = frame->items[index];
+
+	cairo_surface_t* surface = cairo_image_surface_create_for_data(item.pixels.data(), static_cast<cairo_format_t>(item.format),
+																   item.width, item.height, item.width * 4);
+
+	GuacBufferSocket socket;
+	guac_protocol_send_image(socket, item.mode, item.layer, item.x, item.y, surface, item.encoding, item.quality);
+	cairo_surface_destroy(surface);
+
+	item.data = socket.buffer_.Release();
+	item.pixels = std::vector<unsigned char>();
+
+	if(--frame->remaining == 0)
+		Encoded(frame);
+}
+
+void GuacFrameSocket::Encoded(const std::shared_ptr<Frame>& frame) {
+	frame->encode = duration_cast<microseconds>(steady_clock::now() - frame->submitted);
+	frame->remaining = 0;
+	SendReady();
+}
+
+void GuacFrameSocket::SendReady() {
+	std::lock_guard<std::mutex> send_lock(send_mutex_);
+
+	for(;;) {
+		std::shared_ptr<Frame> frame;
+		{
+			std::lock_guard<std::mutex> lock(frames_mutex_);
+			if(frames_.empty() || frames_.front()->remaining != 0)
+				break;
+			frame = frames_.front();
+		}
+
+		steady_clock::time_point send_start = steady_clock::now();
+		for(const Item& item : frame->items) {
+			if(item.data.empty())
+				continue;
+			output_.InstructionBegin();
+			output_.Write(item.data.data(), item.data.size());
+			output_.InstructionEnd();
+		}
+
+		if(frame->callback)
+			frame->callback();
+
+		{
+			std::lock_guard<std::mutex> lock(frames_mutex_);
+			frames_.pop_front();
+
+			if(!frame->callback) {
+				timings_.frames++;
+				timings_.decode += frame->decode;
+				timings_.flush += frame->flush;
+				timings_.encode += frame->encode;
+				timings_.send += duration_cast<microseconds>(steady_clock::now() - send_start);
+			}
+		}
+		frames_wait_.notify_all();
+	}
+}
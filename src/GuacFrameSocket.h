@@ -0,0 +1,172 @@
+#pragma once
+#include "GuacSocket.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * Collects the instructions of a frame and hands encoding of its images to
+ * the shared encoder pool, so the thread producing frames can go back to
+ * reading updates straight away. Frames are written to the output socket in
+ * the order they were submitted, once all of their images are encoded.
+ */
+class GuacFrameSocket : public GuacSocket {
+   public:
+	/**
+	 * Time spent in each stage of the pipeline, summed over a number of frames.
+	 */
+	struct Timings {
+		uint32_t frames = 0;
+
+		/**
+		 * Reading updates and drawing them to the surface.
+		 */
+		std::chrono::microseconds decode {};
+
+		/**
+		 * Flushing the surface into the frame.
+		 */
+		std::chrono::microseconds flush {};
+
+		/**
+		 * From submission until every image in the frame is encoded.
+		 */
+		std::chrono::microseconds encode {};
+
+		/**
+		 * Writing the frame to the output socket.
+		 */
+		std::chrono::microseconds send {};
+	};
+
+	explicit GuacFrameSocket(GuacSocket& output);
+	~GuacFrameSocket();
+
+	void InstructionBegin() override;
+	void InstructionEnd() override;
+	bool DeferImage(guac_composite_mode mode, const guac_layer* layer, int x, int y, cairo_surface_t* surface,
+					guac_image_encoding encoding, int quality) override;
+
+	/**
+	 * Returns true if instructions have been written since the last frame
+	 * was submitted.
+	 */
+	inline bool Pending() const {
+		return current_ != nullptr;
+	}
+
+	/**
+	 * Submit everything written since the last call as one frame. If too
+	 * many frames are still being encoded, this waits for the oldest one
+	 * to be sent first.
+	 *
+	 * \param[in] decode Time spent on the frame before it was flushed.
+	 * \param[in] flush Time spent flushing the frame.
+	 */
+	void Submit(std::chrono::microseconds decode, std::chrono::microseconds flush);
+
+	/**
+	 * Call a function once every frame submitted so far has been sent.
+	 */
+	void Post(std::function<void()> callback);
+
+	/**
+	 * Wait until every submitted frame has been sent.
+	 */
+	void Wait();
+
+	/**
+	 * Returns the timings accumulated since the last call and resets them.
+	 */
+	Timings TakeTimings();
+
+   private:
+	struct Item {
+		/**
+		 * The instructions, or the encoded image once it is ready.
+		 */
+		std::vector<std::uint8_t> data;
+
+		/**
+		 * Whether this item is an image waiting to be encoded.
+		 */
+		bool image = false;
+
+		guac_composite_mode mode;
+		guac_image_encoding encoding;
+		int quality = -1;
+		const guac_layer* layer = nullptr;
+		int x = 0;
+		int y = 0;
+		int width = 0;
+		int height = 0;
+		int format = 0;
+
+		/**
+		 * Copy of the image, taken when it was deferred.
+		 */
+		std::vector<unsigned char> pixels;
+	};
+
+	struct Frame {
+		std::vector<Item> items;
+
+		/**
+		 * The number of images left to encode.
+		 */
+		std::atomic<size_t> remaining { 0 };
+
+		std::function<void()> callback;
+
+		std::chrono::steady_clock::time_point submitted;
+		std::chrono::microseconds decode {};
+		std::chrono::microseconds flush {};
+		std::chrono::microseconds encode {};
+	};
+
+	Frame& CurrentFrame();
+	void Encode(const std::shared_ptr<Frame>& frame, size_t index);
+	void Encoded(const std::shared_ptr<Frame>& frame);
+	void Enqueue(const std::shared_ptr<Frame>& frame, bool wait);
+	void SendReady();
+
+	/**
+	 * The maximum number of frames that may be waiting to be encoded or
+	 * sent before Submit() blocks.
+	 */
+	static constexpr size_t kMaxFrames = 4;
+
+	GuacSocket& output_;
+
+	/**
+	 * The frame being written, or null if nothing has been written since
+	 * the last frame was submitted.
+	 */
+	std::shared_ptr<Frame> current_;
+
+	/**
+	 * Submitted frames, oldest first.
+	 */
+	std::deque<std::shared_ptr<Frame>> frames_;
+	std::mutex frames_mutex_;
+	std::condition_variable frames_wait_;
+
+	/**
+	 * Held while writing frames to the output so that they are sent
+	 * by one thread at a time, in order.
+	 *
+	 * Lock order: send_mutex_, then frames_mutex_ or the output's user
+	 * list lock. Submit() and Post() may send frames, so they must not be
+	 * called while holding a lock that is also taken with the user list
+	 * locked, such as GuacVNCClient::pending_joins_mutex_.
+	 */
+	std::mutex send_mutex_;
+
+	Timings timings_;
+};
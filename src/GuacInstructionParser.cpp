@@ -1,125 +1,220 @@
 #include "GuacInstructionParser.h"
 #include "CollabVM.h"
+#include <algorithm>
+#include <cstring>
 #include <vector>
 
 //#include <functional>
 #include <string>
 
 namespace GuacInstructionParser {
-	struct Instruction {
-		const char* opcode;
-		CollabVMServer::GuacamoleInstruction handler;
-	};
-
-	constexpr static Instruction instructions[] = {
-		// Guacamole instructions
-		{ "mouse", &CollabVMServer::OnMouseInstruction },
-		{ "key", &CollabVMServer::OnKeyInstruction },
-
-		// Custom instructions
-		{ "rename", &CollabVMServer::OnRenameInstruction },
-		{ "connect", &CollabVMServer::OnConnectInstruction },
-		{ "chat", &CollabVMServer::OnChatInstruction },
-		{ "turn", &CollabVMServer::OnTurnInstruction },
-		{ "admin", &CollabVMServer::OnAdminInstruction },
-		{ "nop", &CollabVMServer::OnNopInstruction },
-		{ "list", &CollabVMServer::OnListInstruction },
-		{ "vote", &CollabVMServer::OnVoteInstruction },
-		{ "file", &CollabVMServer::OnFileInstruction }
-	};
-
-	//constexpr size_t instruction_count = sizeof(instructions)/sizeof(Instruction);
-
-	/**
-	 * Max element size of a Guacamole element.
-	 */
-	constexpr std::uint64_t MAX_GUAC_ELEMENT_LENGTH = 3450;
-
 	/**
-	 * Max size of a Guacamole frame.
+	 * Opcodes, including their length prefix, of the instructions that only
+	 * affect the VM the user is viewing.
 	 */
-	constexpr std::uint64_t MAX_GUAC_FRAME_LENGTH = 6144;
+	constexpr static const char* vm_instructions[] = {
+		"5.mouse,",
+		"3.key,"
+	};
 
 	/**
-	 * Decode an instruction from a string.
-	 * \param[in] input input guacamole string to decode
+	 * Finds the handler for an opcode. No two opcodes have the same
+	 * length and first character, so that is all the switch needs to look
+	 * at before comparing the whole opcode.
 	 */
-	static std::vector<std::string> DecodeInstruction(const std::string& input) {
-		std::vector<std::string> output;
-		if(input.back() != ';')
-			return output;
-
-		if(input.empty() || input.length() >= MAX_GUAC_FRAME_LENGTH)
-			return output;
-
-		std::istringstream iss { input };
-
-		while(iss) {
-			unsigned long long length { 0 };
-			iss >> length;
-
-			if(!iss)
-				return std::vector<std::string>();
-
-			// Ignore weird elements that could be an attempt to crash the server
-			if(length >= MAX_GUAC_ELEMENT_LENGTH || length >= input.length())
-				return std::vector<std::string>();
-
-			// Ignore if there is no period separating data.
-			if(iss.peek() != '.')
-				return std::vector<std::string>();
-
-			iss.get(); // remove the period
+	static CollabVMServer::GuacamoleInstruction FindHandler(std::string_view opcode) {
+		if(opcode.empty())
+			return nullptr;
 
-			// Read content
-			std::vector<char> content(length + 1, '\0'); // Is there a reason this can't be a string?
-			iss.read(content.data(), static_cast<std::streamsize>(length));
-			output.emplace_back(content.data(), length); // Safe code(TM)
-
-			const char& separator = iss.peek();
-			if(separator != ',') {
-				// If the instruction is ending return output
-				if(separator == ';')
-					return output;
+		std::string_view expected;
+		CollabVMServer::GuacamoleInstruction handler;
+		switch(opcode.length()) {
+			case 3:
+				switch(opcode[0]) {
+					// Guacamole instructions
+					case 'k':
+						expected = "key";
+						handler = &CollabVMServer::OnKeyInstruction;
+						break;
+					// Custom instructions
+					case 'n':
+						expected = "nop";
+						handler = &CollabVMServer::OnNopInstruction;
+						break;
+					default:
+						return nullptr;
+				}
+				break;
+			case 4:
+				switch(opcode[0]) {
+					case 'c':
+						expected = "chat";
+						handler = &CollabVMServer::OnChatInstruction;
+						break;
+					case 't':
+						expected = "turn";
+						handler = &CollabVMServer::OnTurnInstruction;
+						break;
+					case 'l':
+						expected = "list";
+						handler = &CollabVMServer::OnListInstruction;
+						break;
+					case 'v':
+						expected = "vote";
+						handler = &CollabVMServer::OnVoteInstruction;
+						break;
+					case 'f':
+						expected = "file";
+						handler = &CollabVMServer::OnFileInstruction;
+						break;
+					default:
+						return nullptr;
+				}
+				break;
+			case 5:
+				switch(opcode[0]) {
+					case 'm':
+						expected = "mouse";
+						handler = &CollabVMServer::OnMouseInstruction;
+						break;
+					case 'a':
+						expected = "admin";
+						handler = &CollabVMServer::OnAdminInstruction;
+						break;
+					default:
+						return nullptr;
+				}
+				break;
+			case 6:
+				expected = "rename";
+				handler = &CollabVMServer::OnRenameInstruction;
+				break;
+			case 7:
+				expected = "connect";
+				handler = &CollabVMServer::OnConnectInstruction;
+				break;
+			default:
+				return nullptr;
+		}
+		return opcode == expected ? handler : nullptr;
+	}
 
-				// Otherwise, this is probably an fuzz attempt,
-				// so fuck you!
-				return std::vector<std::string>();
+	int DecodeInstruction(char* data, size_t length, std::string_view& opcode, GuacArguments& args) {
+		args.clear();
+		const char* end = data + std::min<size_t>(length, MAX_GUAC_FRAME_LENGTH);
+		char* it = data;
+		bool first = true;
+		while(it != end) {
+			// Read the length of the element
+			size_t element_length = 0;
+			const char* length_begin = it;
+			while(it != end && *it >= '0' && *it <= '9') {
+				element_length = element_length * 10 + (*it++ - '0');
+				// Ignore weird elements that could be an attempt to crash the server
+				if(element_length >= MAX_GUAC_ELEMENT_LENGTH)
+					return -1;
+			}
+			if(it == end)
+				break;
+
+			// There must be a period separating the length from the content
+			if(it == length_begin || *it != '.')
+				return -1;
+			it++;
+
+			if(static_cast<size_t>(end - it) <= element_length)
+				break;
+			char* element = it;
+			it += element_length;
+
+			// The element is followed by a comma, or a semicolon if it's the last one
+			char separator = *it;
+			if(separator != ',' && separator != ';')
+				return -1;
+			*it++ = '\0';
+
+			if(first) {
+				opcode = std::string_view(element, element_length);
+				first = false;
+			} else if(!args.push_back(element, element_length)) {
+				return -1;
 			}
 
-			// Eat the character we peeked.
-			// I don't see much of the point of this.
-			iss.get();
+			if(separator == ';')
+				return static_cast<int>(it - data);
 		}
-		//
-		return std::vector<std::string>();
+
+		// The instruction is incomplete, which is an error once it's as long as a frame can be
+		return length >= MAX_GUAC_FRAME_LENGTH ? -1 : 0;
 	}
 
-	void ParseInstruction(CollabVMServer& server, const std::shared_ptr<CollabVMUser>& user, const std::string& instruction) {
-		std::vector<std::string> decoded = DecodeInstruction(instruction);
-		if(decoded.empty())
+	void ParseInstruction(CollabVMServer& server, const std::shared_ptr<CollabVMUser>& user, const std::uint8_t* data, size_t length) {
+		// Decode a copy because the separators are replaced with null terminators
+		if(!length || length >= MAX_GUAC_FRAME_LENGTH)
 			return;
+		char buffer[MAX_GUAC_FRAME_LENGTH];
+		std::memcpy(buffer, data, length);
 
-		for(auto& inst : instructions) {
-			if(!std::strncmp(inst.opcode, decoded[0].data(), decoded[0].length())) {
-				auto argument_conv = std::vector<char*>();
+		std::string_view opcode;
+		GuacArguments args;
+		// The message must be exactly one instruction
+		if(DecodeInstruction(buffer, length, opcode, args) != static_cast<int>(length))
+			return;
 
-				// Only bother taking this branch if we need to.
-				if(decoded.size() > 1) {
-					auto argument_begin = &decoded[1]; // this is a bit crumby
-					argument_conv.resize(decoded.size() - 1);
+		if(CollabVMServer::GuacamoleInstruction handler = FindHandler(opcode))
+			(server.*handler)(user, args);
+	}
 
-					// since the std::string lifetime is managed by us,
-					// simply just copy pointers. MAJOR code smell, these should
-					// just be taking vector<string_view> or something
-					for(size_t j = 0; j < decoded.size() - 1; ++j)
-						argument_conv[j] = argument_begin[j].data();
-				}
+	bool IsVMInstruction(const std::uint8_t* data, size_t length) {
+		for(const char* opcode : vm_instructions) {
+			size_t len = std::strlen(opcode);
+			if(length > len && !std::memcmp(data, opcode, len))
+				return true;
+		}
+		return false;
+	}
 
-				// Call the instruction handler
-				(server.*(inst.handler))(user, argument_conv);
-				argument_conv.clear();
+	bool ParseInputInstruction(const std::uint8_t* data, size_t length, GuacClient::InputEvent& event) {
+		const char* it = reinterpret_cast<const char*>(data);
+		const char* end = it + length;
+		size_t arg_count;
+		if(length > 8 && !std::memcmp(it, "5.mouse,", 8)) {
+			event.type = GuacClient::InputEvent::Type::kMouse;
+			arg_count = 3;
+			it += 8;
+		} else if(length > 6 && !std::memcmp(it, "3.key,", 6)) {
+			event.type = GuacClient::InputEvent::Type::kKey;
+			arg_count = 2;
+			it += 6;
+		} else {
+			return false;
+		}
+		for(size_t i = 0; i < arg_count; i++) {
+			// Read the length of the element
+			size_t length = 0;
+			const char* length_begin = it;
+			while(it != end && *it >= '0' && *it <= '9' && it - length_begin < 4)
+				length = length * 10 + (*it++ - '0');
+			if(it == length_begin || it == end || *it++ != '.' || !length || static_cast<size_t>(end - it) <= length)
+				return false;
+
+			// Read the value, which may be negative
+			const char* value_end = it + length;
+			bool negative = *it == '-';
+			if(negative && ++it == value_end)
+				return false;
+			int value = 0;
+			for(; it != value_end; it++) {
+				if(*it < '0' || *it > '9' || value > 99999999)
+					return false;
+				value = value * 10 + (*it - '0');
 			}
+			event.args[i] = negative ? -value : value;
+
+			// Arguments are separated by commas and the last one ends the instruction
+			if(*it++ != (i + 1 == arg_count ? ';' : ','))
+				return false;
 		}
+		return it == end;
 	}
 } // namespace GuacInstructionParser
@@ -1,14 +1,60 @@
 #pragma once
-#include <string>
+#include <cstdint>
+#include <string_view>
+#include <vector>
 #include "CollabVMUser.h"
+#include "GuacArguments.h"
+#include "GuacClient.h"
 
 namespace GuacInstructionParser {
+	/**
+	 * Max element size of a Guacamole element.
+	 */
+	constexpr std::uint64_t MAX_GUAC_ELEMENT_LENGTH = 3450;
+
+	/**
+	 * Max size of a Guacamole frame.
+	 */
+	constexpr std::uint64_t MAX_GUAC_FRAME_LENGTH = 6144;
+
+	/**
+	 * Decodes the instruction at the start of a buffer in a single pass,
+	 * without allocating. The separator after each element is overwritten
+	 * with a null terminator, and the opcode and arguments point into the buffer.
+	 * @param data The buffer to decode.
+	 * @param length The length of the buffer.
+	 * @param opcode Set to the opcode of the instruction.
+	 * @param args Filled with the arguments of the instruction.
+	 * @returns The length of the instruction, 0 if the buffer ends before the
+	 * instruction does, or -1 if the instruction is malformed.
+	 */
+	int DecodeInstruction(char* data, size_t length, std::string_view& opcode, GuacArguments& args);
+
 	/**
 	 * Parses the instruction from a Guacamole webclient and calls the
 	 * handler for it.
 	 * @param server The CollabVMServer to call the handler with.
-	 * @param data The connection data belonging to the client that sent the instruction.
-	 * @param instruction The instruction to parse.
+	 * @param user The connection data belonging to the client that sent the instruction.
+	 * @param data The instruction to parse.
+	 * @param length The length of the instruction.
+	 */
+	void ParseInstruction(CollabVMServer& server, const std::shared_ptr<CollabVMUser>& user, const std::uint8_t* data, size_t length);
+
+	/**
+	 * Checks whether an unparsed instruction is input for the VM that
+	 * the user is viewing, which can be handled by the VM's processing shard.
+	 * @param data The raw instruction received from the client.
+	 * @param length The length of the instruction.
+	 */
+	bool IsVMInstruction(const std::uint8_t* data, size_t length);
+
+	/**
+	 * Parses a mouse or key instruction into an input event in place,
+	 * without allocating. The user of the event is not set.
+	 * @param data The raw instruction received from the client.
+	 * @param length The length of the instruction.
+	 * @param event The event to store the type and arguments in.
+	 * @returns False if the instruction is malformed or is not a mouse or key instruction.
 	 */
-	void ParseInstruction(CollabVMServer& server, const std::shared_ptr<CollabVMUser>& user, const std::string& instruction);
+	bool ParseInputInstruction(const std::uint8_t* data, size_t length, GuacClient::InputEvent& event);
 } // namespace GuacInstructionParser
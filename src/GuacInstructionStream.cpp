@@ -0,0 +1,111 @@
+#include "GuacInstructionStream.h"
+#include "GuacInstructionParser.h"
+#include <algorithm>
+
+#include <websocketmm/websocket_user.h>
+
+GuacInstructionStream::GuacInstructionStream()
+	: position_(0),
+	  state_(State::kLength),
+	  length_digits_(0),
+	  element_remaining_(0),
+	  instruction_length_(0) {
+}
+
+void GuacInstructionStream::Feed(std::shared_ptr<const websocketmm::websocket_message> message) {
+	message_ = std::move(message);
+	position_ = 0;
+}
+
+GuacInstructionStream::Status GuacInstructionStream::Next(std::shared_ptr<const websocketmm::websocket_message>& instruction, size_t& offset, size_t& length) {
+	if(!message_)
+		return Status::kIncomplete;
+
+	const std::vector<std::uint8_t>& data = message_->data;
+	const size_t begin = position_;
+	bool malformed = false;
+	while(position_ != data.size()) {
+		if(state_ == State::kContent) {
+			// The content can't contain anything we care about, so skip it all at once
+			size_t skipped = std::min(element_remaining_, data.size() - position_);
+			position_ += skipped;
+			instruction_length_ += skipped;
+			element_remaining_ -= skipped;
+			if(!element_remaining_)
+				state_ = State::kSeparator;
+		} else {
+			std::uint8_t c = data[position_++];
+			instruction_length_++;
+			if(state_ == State::kLength) {
+				if(c >= '0' && c <= '9') {
+					element_remaining_ = element_remaining_ * 10 + (c - '0');
+					length_digits_++;
+					// Ignore weird elements that could be an attempt to crash the server
+					if(element_remaining_ >= GuacInstructionParser::MAX_GUAC_ELEMENT_LENGTH) {
+						malformed = true;
+						break;
+					}
+				} else if(c == '.' && length_digits_) {
+					state_ = element_remaining_ ? State::kContent : State::kSeparator;
+				} else {
+					malformed = true;
+					break;
+				}
+			} else if(c == ',') {
+				state_ = State::kLength;
+				length_digits_ = 0;
+				element_remaining_ = 0;
+			} else if(c == ';') {
+				if(partial_.empty()) {
+					instruction = message_;
+					offset = begin;
+					length = position_ - begin;
+				} else {
+					// The instruction began in an earlier message
+					partial_.insert(partial_.end(), data.begin() + begin, data.begin() + position_);
+					offset = 0;
+					length = partial_.size();
+					instruction = websocketmm::BuildWebsocketMessage(websocketmm::websocket_message::type::text, std::move(partial_));
+					partial_.clear();
+				}
+
+				state_ = State::kLength;
+				length_digits_ = 0;
+				element_remaining_ = 0;
+				instruction_length_ = 0;
+				if(position_ == data.size())
+					message_.reset();
+				return Status::kComplete;
+			} else {
+				malformed = true;
+				break;
+			}
+		}
+
+		if(instruction_length_ >= GuacInstructionParser::MAX_GUAC_FRAME_LENGTH) {
+			malformed = true;
+			break;
+		}
+	}
+
+	if(malformed) {
+		// There's no telling where the next instruction begins, so drop the rest
+		Reset();
+		return Status::kMalformed;
+	}
+
+	// Keep the incomplete instruction until the next message
+	partial_.insert(partial_.end(), data.begin() + begin, data.end());
+	message_.reset();
+	return Status::kIncomplete;
+}
+
+void GuacInstructionStream::Reset() {
+	message_.reset();
+	position_ = 0;
+	partial_.clear();
+	state_ = State::kLength;
+	length_digits_ = 0;
+	element_remaining_ = 0;
+	instruction_length_ = 0;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <websocketmm/fwd.h>
+
+/**
+ * Splits the messages received from a client into Guacamole instructions.
+ * A message may contain any number of instructions, and an instruction
+ * may be split across several messages, so the state of the last
+ * incomplete instruction is kept between messages. The element and frame
+ * limits are enforced while scanning, so an incomplete instruction never
+ * buffers more than a frame.
+ *
+ * Only the thread reading from the client's connection may use it.
+ */
+class GuacInstructionStream {
+   public:
+	enum class Status : uint8_t {
+		kComplete,	 // An instruction was found
+		kIncomplete, // The rest of the message was consumed
+		kMalformed	 // The message was not valid, the rest of it was dropped
+	};
+
+	GuacInstructionStream();
+
+	/**
+	 * Start scanning a message from the client. The previous message must
+	 * have been scanned until Next stopped returning kComplete.
+	 */
+	void Feed(std::shared_ptr<const websocketmm::websocket_message> message);
+
+	/**
+	 * Find the next complete instruction in the message.
+	 * Instructions that are entirely inside the message refer to it
+	 * without copying, while ones that began in an earlier message are
+	 * given a message of their own.
+	 * @param instruction Set to the message containing the instruction.
+	 * @param offset Set to the offset of the instruction in the message.
+	 * @param length Set to the length of the instruction.
+	 */
+	Status Next(std::shared_ptr<const websocketmm::websocket_message>& instruction, size_t& offset, size_t& length);
+
+	/**
+	 * Forget the current message and any incomplete instruction.
+	 */
+	void Reset();
+
+   private:
+	enum class State : uint8_t {
+		kLength,   // Reading the length of an element
+		kContent,  // Skipping the content of an element
+		kSeparator // Expecting the separator after an element
+	};
+
+	std::shared_ptr<const websocketmm::websocket_message> message_;
+
+	/**
+	 * How much of the current message has been scanned.
+	 */
+	size_t position_;
+
+	/**
+	 * The beginning of an instruction that was split across messages.
+	 */
+	std::vector<std::uint8_t> partial_;
+
+	State state_;
+
+	/**
+	 * The number of digits read of the current element's length.
+	 */
+	size_t length_digits_;
+
+	/**
+	 * The length of the current element while reading it, and then
+	 * the number of bytes left in its content.
+	 */
+	size_t element_remaining_;
+
+	/**
+	 * The number of bytes of the current instruction that have been scanned.
+	 */
+	size_t instruction_length_;
+};
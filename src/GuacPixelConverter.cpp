@@ -0,0 +1,174 @@
+#include "GuacPixelConverter.h"
+#include <cstring>
+#include <utility>
+
+#if(defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+	#define PIXEL_CONVERTER_USE_X86_SIMD
+	#include <immintrin.h>
+#endif
+
+GuacPixelConverter::GuacPixelConverter()
+	: kind_(kGeneric),
+	  bpp_(0),
+	  red_shift_(0),
+	  green_shift_(0),
+	  blue_shift_(0),
+	  red_max_(0),
+	  green_max_(0),
+	  blue_max_(0),
+	  swap_red_blue_(false),
+	  shuffle_ { 0x80, 0x80, 0x80, 0x80 } {
+}
+
+void GuacPixelConverter::SetFormat(const rfbPixelFormat& format, bool swap_red_blue) {
+	unsigned int bpp = format.bitsPerPixel / 8;
+	if(bpp == bpp_ && swap_red_blue == swap_red_blue_ &&
+	   format.redShift == red_shift_ && format.greenShift == green_shift_ && format.blueShift == blue_shift_ &&
+	   format.redMax == red_max_ && format.greenMax == green_max_ && format.blueMax == blue_max_)
+		return;
+
+	bpp_ = bpp;
+	red_shift_ = format.redShift;
+	green_shift_ = format.greenShift;
+	blue_shift_ = format.blueShift;
+	red_max_ = format.redMax;
+	green_max_ = format.greenMax;
+	blue_max_ = format.blueMax;
+	swap_red_blue_ = swap_red_blue;
+	table_.clear();
+
+	if(bpp_ == 4) {
+		// Whole 8-bit components on byte boundaries only need to be moved
+		if(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ &&
+		   red_max_ == 0xFF && green_max_ == 0xFF && blue_max_ == 0xFF &&
+		   red_shift_ % 8 == 0 && green_shift_ % 8 == 0 && blue_shift_ % 8 == 0 &&
+		   red_shift_ <= 24 && green_shift_ <= 24 && blue_shift_ <= 24) {
+			uint8_t red = red_shift_ / 8;
+			uint8_t blue = blue_shift_ / 8;
+			if(swap_red_blue_)
+				std::swap(red, blue);
+
+			shuffle_[0] = blue;
+			shuffle_[1] = green_shift_ / 8;
+			shuffle_[2] = red;
+			shuffle_[3] = 0x80;
+
+			// The alpha byte is ignored when drawing opaque images
+			kind_ = shuffle_[0] == 0 && shuffle_[1] == 1 && shuffle_[2] == 2 ? kIdentity : kShuffle;
+		} else {
+			kind_ = kGeneric;
+		}
+	} else {
+		// 8 and 16-bit pixels have few enough values to convert all of them up front
+		size_t count = bpp_ == 2 ? 0x10000 : 0x100;
+		table_.resize(count);
+		for(size_t v = 0; v < count; v++)
+			table_[v] = ConvertPixel(v);
+		kind_ = kTable;
+	}
+}
+
+uint32_t GuacPixelConverter::ConvertPixel(uint32_t v) const {
+	unsigned char red = (v >> red_shift_) * 0x100 / (red_max_ + 1);
+	unsigned char green = (v >> green_shift_) * 0x100 / (green_max_ + 1);
+	unsigned char blue = (v >> blue_shift_) * 0x100 / (blue_max_ + 1);
+
+	if(swap_red_blue_)
+		return (blue << 16) | (green << 8) | red;
+
+	return (red << 16) | (green << 8) | blue;
+}
+
+#ifdef PIXEL_CONVERTER_USE_X86_SIMD
+__attribute__((target("ssse3"))) static void ShuffleRowSSSE3(const unsigned char* src, unsigned char* dst, int width, const uint8_t* shuffle) {
+	const __m128i mask = _mm_setr_epi8(shuffle[0], shuffle[1], shuffle[2], shuffle[3],
+									   shuffle[0] + 4, shuffle[1] + 4, shuffle[2] + 4, shuffle[3],
+									   shuffle[0] + 8, shuffle[1] + 8, shuffle[2] + 8, shuffle[3],
+									   shuffle[0] + 12, shuffle[1] + 12, shuffle[2] + 12, shuffle[3]);
+
+	int x = 0;
+	for(; x + 4 <= width; x += 4) {
+		__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), _mm_shuffle_epi8(pixels, mask));
+	}
+
+	for(; x < width; x++) {
+		const unsigned char* in = src + x * 4;
+		unsigned char* out = dst + x * 4;
+		out[0] = in[shuffle[0]];
+		out[1] = in[shuffle[1]];
+		out[2] = in[shuffle[2]];
+		out[3] = 0;
+	}
+}
+#endif
+
+static void ShuffleRow(const unsigned char* src, unsigned char* dst, int width, const uint8_t* shuffle) {
+	for(int x = 0; x < width; x++) {
+		const unsigned char* in = src + x * 4;
+		unsigned char* out = dst + x * 4;
+		out[0] = in[shuffle[0]];
+		out[1] = in[shuffle[1]];
+		out[2] = in[shuffle[2]];
+		out[3] = 0;
+	}
+}
+
+typedef void (*ShuffleRowFn)(const unsigned char* src, unsigned char* dst, int width, const uint8_t* shuffle);
+
+static ShuffleRowFn SelectShuffleRow() {
+#ifdef PIXEL_CONVERTER_USE_X86_SIMD
+	__builtin_cpu_init();
+
+	if(__builtin_cpu_supports("ssse3"))
+		return ShuffleRowSSSE3;
+#endif
+
+	return ShuffleRow;
+}
+
+static const ShuffleRowFn shuffle_row_ = SelectShuffleRow();
+
+void GuacPixelConverter::Convert(const unsigned char* src, int src_stride, unsigned char* dst, int dst_stride, int width, int height) const {
+	for(int y = 0; y < height; y++) {
+		uint32_t* out = reinterpret_cast<uint32_t*>(dst);
+
+		switch(kind_) {
+			case kIdentity:
+				for(int x = 0; x < width; x++) {
+					uint32_t v;
+					std::memcpy(&v, src + x * 4, sizeof(v));
+					out[x] = v & 0x00FFFFFF;
+				}
+				break;
+
+			case kShuffle:
+				shuffle_row_(src, dst, width, shuffle_);
+				break;
+
+			case kTable:
+				if(bpp_ == 2) {
+					for(int x = 0; x < width; x++) {
+						uint16_t v;
+						std::memcpy(&v, src + x * 2, sizeof(v));
+						out[x] = table_[v];
+					}
+				} else {
+					for(int x = 0; x < width; x++)
+						out[x] = table_[src[x * bpp_]];
+				}
+				break;
+
+			case kGeneric:
+				for(int x = 0; x < width; x++) {
+					uint32_t v;
+					std::memcpy(&v, src + x * 4, sizeof(v));
+					out[x] = ConvertPixel(v);
+				}
+				break;
+		}
+
+		src += src_stride;
+		dst += dst_stride;
+	}
+}
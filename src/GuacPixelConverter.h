@@ -0,0 +1,66 @@
+#pragma once
+#include <rfb/rfbproto.h>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Converts pixels from the format used by a VNC server to the 32-bit
+ * 0x00RRGGBB layout used by Cairo and guac_common_surface. The per-pixel
+ * work is worked out once per format rather than once per pixel.
+ */
+class GuacPixelConverter {
+   public:
+	GuacPixelConverter();
+
+	/**
+	 * Prepare to convert from the given format. Lookup tables are only
+	 * rebuilt if the format or the red/blue swap setting has changed.
+	 */
+	void SetFormat(const rfbPixelFormat& format, bool swap_red_blue);
+
+	/**
+	 * Returns true if pixels in the current format already match Cairo's
+	 * layout, so they can be drawn straight from the framebuffer.
+	 */
+	inline bool IsIdentity() const {
+		return kind_ == kIdentity;
+	}
+
+	/**
+	 * Convert a rectangle of pixels. The alpha byte of every output
+	 * pixel is zero.
+	 */
+	void Convert(const unsigned char* src, int src_stride, unsigned char* dst, int dst_stride, int width, int height) const;
+
+   private:
+	enum Kind {
+		kIdentity, // 32-bit 0x00RRGGBB, no conversion needed
+		kShuffle,  // 32-bit with byte-aligned 8-bit components
+		kTable,	   // 8 or 16-bit, converted with a lookup table
+		kGeneric   // Anything else
+	};
+
+	uint32_t ConvertPixel(uint32_t v) const;
+
+	Kind kind_;
+
+	unsigned int bpp_;
+	unsigned int red_shift_;
+	unsigned int green_shift_;
+	unsigned int blue_shift_;
+	unsigned int red_max_;
+	unsigned int green_max_;
+	unsigned int blue_max_;
+	bool swap_red_blue_;
+
+	/**
+	 * For kShuffle, the index of the source byte for each output byte.
+	 * Indices of 0x80 produce a zero byte.
+	 */
+	uint8_t shuffle_[4];
+
+	/**
+	 * For kTable, the converted value of every possible source pixel.
+	 */
+	std::vector<uint32_t> table_;
+};
@@ -1,21 +1,21 @@
 #include "GuacSocket.h"
 
 GuacSocket::GuacSocket()
-	: base64_(ss_) {
+	: base64_(buffer_) {
 }
 
 size_t GuacSocket::Write(const void* buf, size_t count) {
-	ss_.write((const char*)buf, count);
+	buffer_.Write(buf, count);
 	return 0;
 }
 
 size_t GuacSocket::WriteInt(int64_t i) {
-	ss_ << i;
+	buffer_.WriteInt(i);
 	return 0;
 }
 
 size_t GuacSocket::WriteString(const char* str) {
-	ss_ << str;
+	buffer_.WriteString(str);
 	return 0;
 }
 
@@ -1,7 +1,11 @@
 #pragma once
-#include <sstream>
 #include <mutex>
+#include "GuacBuffer.h"
 #include "Base64.h"
+#include "guacamole/layer-types.h"
+#include "guacamole/protocol-types.h"
+
+typedef struct _cairo_surface cairo_surface_t;
 
 class GuacSocket {
    public:
@@ -27,12 +31,22 @@ class GuacSocket {
 	void Flush();
 
 	/**
-	 * The stringstream buffer for instructions.
+	 * Called before an image is encoded for this socket. Sockets that
+	 * encode images elsewhere take a copy of the image and return true,
+	 * in which case nothing is written to the socket.
+	 */
+	virtual bool DeferImage(guac_composite_mode mode, const guac_layer* layer, int x, int y, cairo_surface_t* surface,
+							guac_image_encoding encoding, int quality) {
+		return false;
+	}
+
+	/**
+	 * The buffer instructions are built in.
 	 */
-	std::ostringstream ss_;
+	GuacBuffer buffer_;
 
 	/**
-	 * Mutex for stringstream.
+	 * Mutex for the instruction buffer.
 	 */
 	std::mutex mutex_;
 
@@ -1,11 +1,24 @@
 #include "GuacVNCClient.h"
 #include "VMControllers/VMController.h"
 #include "CollabVM.h"
+#include "GuacBufferSocket.h"
+#include "GuacEncoderPool.h"
+#include "guacamole/hash.h"
 #include "guacamole/protocol.h"
 #include <cairo/cairo.h>
+#include <algorithm>
+#include <cstring>
+
+#include <boost/asio/post.hpp>
+
+#include <websocketmm/websocket_user.h>
 
 #ifdef _WIN32
 	#define strdup _strdup
+#else
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <unistd.h>
 #endif
 
 using std::unique_lock;
@@ -14,6 +27,8 @@ using std::mutex;
 using std::chrono::steady_clock;
 using std::chrono::duration;
 using std::chrono::milliseconds;
+using std::chrono::microseconds;
+using std::chrono::duration_cast;
 typedef std::chrono::time_point<steady_clock, milliseconds> time_point;
 
 void IgnorePipe();
@@ -33,8 +48,25 @@ GuacVNCClient::GuacVNCClient(CollabVMServer& server, VMController& controller, U
 	  remote_cursor_(false),
 	  audio_enabled_(false),
 	  cursor_(guac_common_cursor_alloc(*this)),
-	  default_surface_(NULL) {
+	  default_surface_(NULL),
+	  frame_socket_(broadcast_socket_),
+	  tiled_updates_(false),
+	  image_encoding_(GUAC_IMAGE_PNG),
+	  video_mode_(false),
+	  keyframe_version_(0),
+	  thumbnail_pending_(false),
+	  thumbnail_hash_(0),
+	  thumbnail_hashed_(false) {
 	password_ = strdup(""); // NOTE: freed by libvncclient
+
+#ifndef _WIN32
+	if(pipe(wake_pipe_) == 0) {
+		fcntl(wake_pipe_[0], F_SETFL, O_NONBLOCK);
+		fcntl(wake_pipe_[1], F_SETFL, O_NONBLOCK);
+	} else {
+		wake_pipe_[0] = wake_pipe_[1] = -1;
+	}
+#endif
 }
 
 void GuacVNCClient::Start() {
@@ -100,87 +132,37 @@ void GuacVNCClient::CleanUp() {
 void GuacVNCClient::guac_vnc_update(rfbClient* client, int x, int y, int w, int h) {
 	GuacVNCClient* vnc_client = (GuacVNCClient*)rfbClientGetClientData(client, GUAC_VNC_CLIENT_KEY);
 
-	int dx, dy;
-
-	/* Cairo image buffer */
-	int stride;
-	unsigned char* buffer;
-	unsigned char* buffer_row_current;
-	cairo_surface_t* surface;
-
-	/* VNC framebuffer */
-	unsigned int bpp;
-	unsigned int fb_stride;
-	unsigned char* fb_row_current;
-
 	/* Ignore extra update if already handled by copyrect */
 	if(vnc_client->copy_rect_used_) {
 		vnc_client->copy_rect_used_ = 0;
 		return;
 	}
 
-	/* Init Cairo buffer */
-	stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, w);
-	buffer = (unsigned char*)malloc(h * stride);
-	buffer_row_current = buffer;
-
-	bpp = client->format.bitsPerPixel / 8;
-	fb_stride = bpp * client->width;
-	fb_row_current = client->frameBuffer + (y * fb_stride) + (x * bpp);
-
-	/* Copy image data from VNC client to PNG */
-	for(dy = y; dy < y + h; dy++) {
-		unsigned int* buffer_current;
-		unsigned char* fb_current;
+	vnc_client->pixel_converter_.SetFormat(client->format, vnc_client->swap_red_blue_);
 
-		/* Get current buffer row, advance to next */
-		buffer_current = (unsigned int*)buffer_row_current;
-		buffer_row_current += stride;
-
-		/* Get current framebuffer row, advance to next */
-		fb_current = fb_row_current;
-		fb_row_current += fb_stride;
-
-		for(dx = x; dx < x + w; dx++) {
-			unsigned char red, green, blue;
-			unsigned int v;
-
-			switch(bpp) {
-				case 4:
-					v = *((unsigned int*)fb_current);
-					break;
-
-				case 2:
-					v = *((unsigned short*)fb_current);
-					break;
-
-				default:
-					v = *((unsigned char*)fb_current);
-			}
+	/* VNC framebuffer */
+	unsigned int bpp = client->format.bitsPerPixel / 8;
+	unsigned int fb_stride = bpp * client->width;
+	unsigned char* fb_current = client->frameBuffer + (y * fb_stride) + (x * bpp);
 
-			/* Translate value to RGB */
-			red = (v >> client->format.redShift) * 0x100 / (client->format.redMax + 1);
-			green = (v >> client->format.greenShift) * 0x100 / (client->format.greenMax + 1);
-			blue = (v >> client->format.blueShift) * 0x100 / (client->format.blueMax + 1);
+	cairo_surface_t* surface;
 
-			/* Output RGB */
-			if(vnc_client->swap_red_blue_)
-				*(buffer_current++) = (blue << 16) | (green << 8) | red;
-			else
-				*(buffer_current++) = (red << 16) | (green << 8) | blue;
+	/* Draw straight from the framebuffer if it is already in Cairo's format */
+	if(vnc_client->pixel_converter_.IsIdentity()) {
+		surface = cairo_image_surface_create_for_data(fb_current, CAIRO_FORMAT_RGB24, w, h, fb_stride);
+	} else {
+		/* Otherwise convert into the scratch buffer */
+		int stride = cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, w);
+		unsigned char* buffer = vnc_client->GetScratchBuffer(h * stride);
+		vnc_client->pixel_converter_.Convert(fb_current, fb_stride, buffer, stride, w, h);
 
-			fb_current += bpp;
-		}
+		surface = cairo_image_surface_create_for_data(buffer, CAIRO_FORMAT_RGB24, w, h, stride);
 	}
 
 	/* For now, only use default layer */
-	surface = cairo_image_surface_create_for_data(buffer, CAIRO_FORMAT_RGB24, w, h, stride);
-
 	guac_common_surface_draw(vnc_client->default_surface_, x, y, surface);
 
-	/* Free surface */
 	cairo_surface_destroy(surface);
-	free(buffer);
 }
 
 void GuacVNCClient::guac_vnc_copyrect(rfbClient* client, int src_x, int src_y, int w, int h, int dest_x, int dest_y) {
@@ -250,85 +232,46 @@ char* GuacVNCClient::guac_vnc_get_password(rfbClient* rfb_client) {
 void GuacVNCClient::guac_vnc_cursor(rfbClient* client, int x, int y, int w, int h, int bpp) {
 	GuacVNCClient* vnc_client = (GuacVNCClient*)rfbClientGetClientData(client, GUAC_VNC_CLIENT_KEY);
 
+	vnc_client->pixel_converter_.SetFormat(client->format, vnc_client->swap_red_blue_);
+
 	/* Cairo image buffer */
 	int stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, w);
-	unsigned char* buffer = (unsigned char*)malloc(h * stride);
-	unsigned char* buffer_row_current = buffer;
-
-	/* VNC image buffer */
-	unsigned int fb_stride = bpp * w;
-	unsigned char* fb_row_current = client->rcSource;
-	unsigned char* fb_mask = client->rcMask;
+	unsigned char* buffer = vnc_client->GetScratchBuffer(h * stride);
 
-	int dx, dy;
+	/* Convert image data from VNC client to RGB */
+	vnc_client->pixel_converter_.Convert(client->rcSource, bpp * w, buffer, stride, w, h);
 
-	/* Copy image data from VNC client to RGBA buffer */
-	for(dy = 0; dy < h; dy++) {
-		unsigned int* buffer_current;
-		unsigned char* fb_current;
-
-		/* Get current buffer row, advance to next */
-		buffer_current = (unsigned int*)buffer_row_current;
+	/* Translate mask to alpha */
+	unsigned char* buffer_row_current = buffer;
+	unsigned char* fb_mask = client->rcMask;
+	for(int dy = 0; dy < h; dy++) {
+		unsigned int* buffer_current = (unsigned int*)buffer_row_current;
 		buffer_row_current += stride;
 
-		/* Get current framebuffer row, advance to next */
-		fb_current = fb_row_current;
-		fb_row_current += fb_stride;
-
-		for(dx = 0; dx < w; dx++) {
-			unsigned char alpha, red, green, blue;
-			unsigned int v;
-
-			/* Read current pixel value */
-			switch(bpp) {
-				case 4:
-					v = *((unsigned int*)fb_current);
-					break;
-
-				case 2:
-					v = *((unsigned short*)fb_current);
-					break;
-
-				default:
-					v = *((unsigned char*)fb_current);
-			}
-
-			/* Translate mask to alpha */
+		for(int dx = 0; dx < w; dx++) {
 			if(*(fb_mask++))
-				alpha = 0xFF;
-			else
-				alpha = 0x00;
-
-			/* Translate value to RGB */
-			red = (v >> client->format.redShift) * 0x100 / (client->format.redMax + 1);
-			green = (v >> client->format.greenShift) * 0x100 / (client->format.greenMax + 1);
-			blue = (v >> client->format.blueShift) * 0x100 / (client->format.blueMax + 1);
-
-			/* Output ARGB */
-			if(vnc_client->swap_red_blue_)
-				*(buffer_current++) = (alpha << 24) | (blue << 16) | (green << 8) | red;
-			else
-				*(buffer_current++) = (alpha << 24) | (red << 16) | (green << 8) | blue;
-
-			/* Next VNC pixel */
-			fb_current += bpp;
+				buffer_current[dx] |= 0xFF000000;
 		}
 	}
 
 	/* Update stored cursor information */
 	guac_common_cursor_set_argb(vnc_client->cursor_, x, y, buffer, w, h, stride);
-
-	/* Free surface */
-	free(buffer);
+	vnc_client->keyframe_.reset();
 
 	/* libvncclient does not free rcMask as it does rcSource */
 	free(client->rcMask);
 }
 
+unsigned char* GuacVNCClient::GetScratchBuffer(size_t size) {
+	if(scratch_buffer_.size() < size)
+		scratch_buffer_.resize(size);
+	return scratch_buffer_.data();
+}
+
 int GuacVNCClient::EndFrame() {
 	/* Update and send timestamp */
 	last_sent_timestamp = guac_timestamp_current();
-	return guac_protocol_send_sync(broadcast_socket_, last_sent_timestamp);
+	return guac_protocol_send_sync(frame_socket_, last_sent_timestamp);
 }
 
 int GuacVNCClient::GetProcessingLag() {
@@ -519,10 +462,27 @@ void GuacVNCClient::VNCThread() {
 		guac_protocol_send_name(broadcast_socket_, rfb_client->desktopName);
 
 		/* Create default surface */
-		default_surface_ = guac_common_surface_alloc(broadcast_socket_, GuacClient::GUAC_DEFAULT_LAYER,
+		default_surface_ = guac_common_surface_alloc(frame_socket_, GuacClient::GUAC_DEFAULT_LAYER,
 													 rfb_client->width, rfb_client->height);
-
-		broadcast_socket_.Flush();
+		guac_common_surface_set_tiled(default_surface_, tiled_updates_);
+		default_surface_->encoding = image_encoding_;
+		keyframe_.reset();
+
+		frame_socket_.Submit(microseconds::zero(), microseconds::zero());
+
+		// Input that was queued while disconnected is stale
+		DiscardInput();
+
+		// The screen may look the same as before, but the VM controller
+		// has forgotten the last thumbnail. A thumbnail that is still being
+		// encoded would record its hash afterwards, so wait for it first.
+		{
+			unique_lock<mutex> lock(thumbnail_mutex_);
+			thumbnail_wait_.wait(lock, [this]() {
+				return !thumbnail_pending_;
+			});
+			thumbnail_hashed_ = false;
+		}
 
 		// Call join handler for each user if there are already
 		// users in the list
@@ -536,12 +496,16 @@ void GuacVNCClient::VNCThread() {
 
 		disconnect_reason_ = DisconnectReason::kClient;
 		//guac_timestamp last_frame_end = guac_timestamp_current();
+		steady_clock::time_point next_timings_log = steady_clock::now() + std::chrono::seconds(GUAC_VNC_TIMINGS_INTERVAL);
 
 		/* Handle messages from VNC server while client is running */
 		while(client_state_ == ClientState::kConnected) {
-			// Wait a maximum of one second for an RFB message to be
-			// received from the VNC server
-			int wait_result = WaitForMessage(rfb_client, 1000000);
+			// Wait a maximum of one frame for an RFB message to be
+			// received from the VNC server, so users who join while
+			// the display is idle are not kept waiting for a keyframe
+			int wait_result = WaitForMessageOrInput(rfb_client, std::chrono::duration_cast<std::chrono::microseconds>(frame_duration_).count());
+			steady_clock::time_point decode_start = steady_clock::now();
+			ProcessInput();
 			if(wait_result > 0) {
 				//guac_timestamp frame_start = guac_timestamp_current();
 
@@ -569,6 +533,9 @@ void GuacVNCClient::VNCThread() {
 						break;
 					}
 
+					// Send input between messages so it isn't held up by a busy frame
+					ProcessInput();
+
 					/* Calculate time remaining in frame */
 					time_point frame_end = std::chrono::time_point_cast<milliseconds>(steady_clock::now());
 					milliseconds frame_remaining = frame_start + frame_duration_ - frame_end;
@@ -595,12 +562,30 @@ void GuacVNCClient::VNCThread() {
 				lock.unlock();
 			}
 
+			guac_common_surface_set_tiled(default_surface_, tiled_updates_);
+			default_surface_->encoding = image_encoding_;
+			guac_common_surface_set_video(default_surface_, video_mode_, video_mode_ ? GetVideoQuality() : -1);
+
 			// If there were any updates to the surface, flush them to the clients
-			// and send a sync message to them
-			if(default_surface_->dirty || default_surface_->png_queue_length) {
+			// and send a sync message to them. Video is flushed until it has
+			// gone still so that it can be sent again losslessly.
+			if(default_surface_->dirty || default_surface_->png_queue_length || frame_socket_.Pending() ||
+			   default_surface_->video) {
+				steady_clock::time_point flush_start = steady_clock::now();
 				guac_common_surface_flush(default_surface_);
 				EndFrame();
-				broadcast_socket_.Flush();
+				steady_clock::time_point flush_end = steady_clock::now();
+
+				// Images are encoded by the encoder pool while the next frame is read
+				frame_socket_.Submit(duration_cast<microseconds>(flush_start - decode_start),
+									 duration_cast<microseconds>(flush_end - flush_start));
+			}
+
+			SendKeyframe();
+
+			if(steady_clock::now() >= next_timings_log) {
+				LogFrameTimings();
+				next_timings_log += std::chrono::seconds(GUAC_VNC_TIMINGS_INTERVAL);
 			}
 
 			if(update_thumbnail_) {
@@ -612,6 +597,10 @@ void GuacVNCClient::VNCThread() {
 		//guac_client_log(client, GUAC_LOG_INFO, "Internal VNC client disconnected");
 		std::cout << "Disconnected from VNC server" << std::endl;
 
+		// Send the frames that are still being encoded
+		frame_socket_.Wait();
+		WaitForThumbnail();
+
 		// Call the disconnect handler so CleanUp() will be called
 		controller_.OnGuacDisconnect(true);
 		lock.lock();
@@ -625,19 +614,88 @@ void GuacVNCClient::VNCThread() {
 }
 
 void GuacVNCClient::OnUserJoin(GuacUser& user) {
-	/* If not owner, synchronize with current display */
-	guac_common_surface_dup(default_surface_, user.socket_);
-	guac_common_cursor_dup(cursor_, user.socket_);
-
-	user.socket_.Flush();
-
-	guac_protocol_send_sync(user.socket_, guac_timestamp_current());
+	// The display is sent by the VNC thread at the end of the current frame
+	lock_guard<mutex> lock(pending_joins_mutex_);
+	if(std::find(pending_joins_.begin(), pending_joins_.end(), &user) == pending_joins_.end())
+		pending_joins_.push_back(&user);
 }
 
 void GuacVNCClient::OnUserLeave(GuacUser& user) {
+	unique_lock<mutex> lock(pending_joins_mutex_);
+	pending_joins_.erase(std::remove(pending_joins_.begin(), pending_joins_.end(), &user), pending_joins_.end());
+	lock.unlock();
+
 	guac_common_cursor_remove_user(cursor_, user);
 }
 
+void GuacVNCClient::SendKeyframe() {
+	unique_lock<mutex> lock(pending_joins_mutex_);
+	if(pending_joins_.empty())
+		return;
+
+	// Re-encode the display only if it has changed since the last keyframe
+	if(!keyframe_ || keyframe_version_ != default_surface_->version) {
+		GuacBufferSocket socket;
+		guac_common_surface_dup(default_surface_, socket);
+		guac_common_cursor_dup(cursor_, socket);
+
+		keyframe_ = websocketmm::BuildWebsocketMessage(websocketmm::websocket_message::type::text, socket.buffer_.Release(), true);
+		keyframe_version_ = default_surface_->version;
+	}
+
+	// The cursor may have moved since the keyframe was encoded
+	GuacBufferSocket socket;
+	guac_protocol_send_move(socket, cursor_->layer, GuacClient::GUAC_DEFAULT_LAYER,
+							cursor_->x - cursor_->hotspot_x, cursor_->y - cursor_->hotspot_y, 0);
+	guac_protocol_send_sync(socket, guac_timestamp_current());
+	std::shared_ptr<const websocketmm::websocket_message> sync =
+	websocketmm::BuildWebsocketMessage(websocketmm::websocket_message::type::text, socket.buffer_.Release(), true);
+
+	CollabVMServer* server = pending_joins_.front()->socket_.server_;
+	std::vector<std::weak_ptr<websocketmm::websocket_user>> handles;
+	for(GuacUser* user : pending_joins_)
+		handles.push_back(user->socket_.websocket_handle_);
+	pending_joins_.clear();
+
+	// Posting can send frames, which takes the user list's lock, and users
+	// leave while that lock is held, so pending_joins_mutex_ must be released first
+	lock.unlock();
+
+	// Frames that are still being encoded were drawn before the keyframe,
+	// so it has to be sent after them
+	frame_socket_.Post([server, handles = std::move(handles), keyframe = keyframe_, sync]() {
+		for(const std::weak_ptr<websocketmm::websocket_user>& handle : handles) {
+			server->SendGuacMessage(handle, keyframe);
+			server->SendGuacMessage(handle, sync);
+		}
+	});
+}
+
+int GuacVNCClient::GetVideoQuality() {
+	// Lower the quality of video as users fall behind
+	int quality = GUAC_VNC_VIDEO_MAX_QUALITY - GetProcessingLag() / GUAC_VNC_VIDEO_LAG_PER_QUALITY;
+	return std::max(quality, GUAC_VNC_VIDEO_MIN_QUALITY);
+}
+
+void GuacVNCClient::LogFrameTimings() {
+	// The timings are taken even when they aren't logged so they don't build up
+	GuacFrameSocket::Timings timings = frame_socket_.TakeTimings();
+#ifdef _DEBUG
+	if(!timings.frames)
+		return;
+
+	auto average = [&timings](microseconds total) {
+		return total.count() / 1000.0 / timings.frames;
+	};
+
+	std::cout << "[" << controller_.GetSettings().Name << "] " << timings.frames << " frames, average ms: decode "
+			  << average(timings.decode) << ", flush " << average(timings.flush) << ", encode "
+			  << average(timings.encode) << ", send " << average(timings.send) << std::endl;
+#else
+	(void)timings;
+#endif
+}
+
 void GuacVNCClient::MouseHandler(GuacUser& user, int x, int y, int button_mask) {
 #ifdef _DEBUG
 	//std::cout << "Mouse " << x << 'x' << y << " flags " << button_mask << '\n';
@@ -655,6 +713,37 @@ void GuacVNCClient::KeyHandler(GuacUser& user, int keysym, int pressed) {
 	SendKeyEvent(rfb_client_, keysym, pressed);
 }
 
+void GuacVNCClient::OnInputQueued() {
+#ifndef _WIN32
+	if(wake_pipe_[1] != -1) {
+		char c = 0;
+		// If the pipe is full the VNC thread is already being woken
+		ssize_t written = write(wake_pipe_[1], &c, 1);
+		(void)written;
+	}
+#endif
+}
+
+int GuacVNCClient::WaitForMessageOrInput(rfbClient* client, unsigned int usecs) {
+#ifndef _WIN32
+	if(wake_pipe_[0] == -1)
+		return WaitForMessage(client, usecs);
+
+	pollfd fds[2] = { { client->sock, POLLIN, 0 }, { wake_pipe_[0], POLLIN, 0 } };
+	int result = poll(fds, 2, usecs / 1000);
+	if(result > 0 && fds[1].revents) {
+		// Empty the pipe, the input itself is taken from the queue
+		char buf[64];
+		while(read(wake_pipe_[0], buf, sizeof(buf)) > 0)
+			;
+		result = fds[0].revents ? 1 : 0;
+	}
+	return result;
+#else
+	return WaitForMessage(client, usecs);
+#endif
+}
+
 void GuacVNCClient::ClipboardHandler(GuacUser& user, guac_stream* stream, char* mimetype) {
 	guac_protocol_send_ack(user.socket_, stream,
 						   "Clipboard unsupported", GUAC_PROTOCOL_STATUS_UNSUPPORTED);
@@ -667,46 +756,93 @@ static cairo_status_t WriteThumbnail(void* closure, const unsigned char* data, u
 }
 
 void GuacVNCClient::GenerateThumbnail() {
+	{
+		lock_guard<mutex> lock(thumbnail_mutex_);
+		if(thumbnail_pending_)
+			return;
+		thumbnail_pending_ = true;
+	}
+
+	// Copy the surface so the VNC thread can keep drawing to it while
+	// the thumbnail is scaled and encoded
 	guac_common_surface* surface = default_surface_;
+	cairo_surface_t* snapshot = cairo_image_surface_create(CAIRO_FORMAT_RGB24, surface->width, surface->height);
+	unsigned char* data = cairo_image_surface_get_data(snapshot);
+	const int stride = cairo_image_surface_get_stride(snapshot);
+	for(int y = 0; y < surface->height; y++)
+		std::memcpy(data + y * stride, surface->buffer + y * surface->stride, surface->width * 4);
+	cairo_surface_mark_dirty(snapshot);
+
+	boost::asio::post(GetEncoderPool(), [this, snapshot]() {
+		EncodeThumbnail(snapshot);
+	});
+}
 
-	int width;
-	int height;
-	float scale_xy;
-	if(surface->width > surface->height) {
-		width = 400;
-		scale_xy = 400.0 / surface->width;
-		height = scale_xy * surface->height;
-	} else {
-		height = 400;
-		scale_xy = 400.0 / surface->height;
-		width = scale_xy * surface->width;
-	}
+void GuacVNCClient::EncodeThumbnail(cairo_surface_t* snapshot) {
+	// Skip the encoding if the screen hasn't changed since the last thumbnail
+	unsigned int hash = guac_hash_surface(snapshot);
+	unique_lock<mutex> lock(thumbnail_mutex_);
+	bool changed = !thumbnail_hashed_ || hash != thumbnail_hash_;
+	lock.unlock();
+	if(changed) {
+		const int snapshot_width = cairo_image_surface_get_width(snapshot);
+		const int snapshot_height = cairo_image_surface_get_height(snapshot);
+
+		int width;
+		int height;
+		float scale_xy;
+		if(snapshot_width > snapshot_height) {
+			width = 400;
+			scale_xy = 400.0 / snapshot_width;
+			height = scale_xy * snapshot_height;
+		} else {
+			height = 400;
+			scale_xy = 400.0 / snapshot_height;
+			width = scale_xy * snapshot_width;
+		}
 
-	cairo_surface_t* target = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+		cairo_surface_t* target = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
 
-	cairo_surface_t* rect = cairo_image_surface_create_for_data(
-	surface->buffer, CAIRO_FORMAT_RGB24,
-	surface->width, surface->height, surface->stride);
+		cairo_t* cr = cairo_create(target);
+		cairo_scale(cr, scale_xy, scale_xy);
 
-	cairo_t* cr = cairo_create(target);
-	//cairo_translate(cr, 0, 0);
-	cairo_scale(cr, scale_xy, scale_xy);
+		cairo_set_source_surface(cr, snapshot, 0, 0);
+		cairo_paint(cr);
 
-	cairo_set_source_surface(cr, rect, 0, 0);
-	cairo_paint(cr);
+		GuacBuffer buffer;
+		Base64 base64(buffer);
 
-	std::ostringstream ss;
-	Base64 base64(ss);
+		cairo_surface_write_to_png_stream(target, WriteThumbnail, &base64);
+		base64.FlushBase64();
 
-	cairo_surface_write_to_png_stream(target, WriteThumbnail, &base64);
+		cairo_destroy(cr);
+		cairo_surface_destroy(target);
 
-	cairo_destroy(cr);
-	cairo_surface_destroy(rect);
-	cairo_surface_destroy(target);
+		lock.lock();
+		thumbnail_hash_ = hash;
+		thumbnail_hashed_ = true;
+		lock.unlock();
+		controller_.NewThumbnail(std::make_shared<const std::string>(reinterpret_cast<const char*>(buffer.Data()), buffer.Size()));
+	}
+	cairo_surface_destroy(snapshot);
 
-	controller_.NewThumbnail(new std::string(ss.str()));
+	lock.lock();
+	thumbnail_pending_ = false;
+	thumbnail_wait_.notify_all();
 }
 
-GuacVNCClient::~GuacVNCClient() {
+void GuacVNCClient::WaitForThumbnail() {
+	unique_lock<mutex> lock(thumbnail_mutex_);
+	thumbnail_wait_.wait(lock, [this]() {
+		return !thumbnail_pending_;
+	});
+}
 
+GuacVNCClient::~GuacVNCClient() {
+#ifndef _WIN32
+	if(wake_pipe_[0] != -1) {
+		close(wake_pipe_[0]);
+		close(wake_pipe_[1]);
+	}
+#endif
 }
@@ -7,8 +7,16 @@
 #undef max
 #include "guacamole/guac_surface.h"
 #include "guacamole/guac_cursor.h"
+#include "GuacPixelConverter.h"
+#include "GuacFrameSocket.h"
 #include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <vector>
+
+#include <websocketmm/fwd.h>
 
 /**
 * The maximum duration of a frame in milliseconds.
@@ -22,6 +30,27 @@
 */
 #define GUAC_VNC_FRAME_TIMEOUT 0
 
+/**
+* How often the average time spent in each stage of a frame is logged,
+* in seconds.
+*/
+#define GUAC_VNC_TIMINGS_INTERVAL 60
+
+/**
+* The quality video is sent at when users are keeping up.
+*/
+#define GUAC_VNC_VIDEO_MAX_QUALITY 70
+
+/**
+* The lowest quality video is sent at, however far behind users are.
+*/
+#define GUAC_VNC_VIDEO_MIN_QUALITY 20
+
+/**
+* The milliseconds of processing lag that lower the video quality by one.
+*/
+#define GUAC_VNC_VIDEO_LAG_PER_QUALITY 10
+
 class CollabVMServer;
 class VMController;
 class GuacBroadcastSocket;
@@ -35,12 +64,43 @@ class GuacVNCClient : public GuacClient {
 	void CleanUp() override;
 	~GuacVNCClient() override;
 
+	/**
+	 * Enable or disable tiled change tracking for the display. Takes effect
+	 * at the end of the current frame.
+	 */
+	inline void SetTiledUpdates(bool enabled) {
+		tiled_updates_ = enabled;
+	}
+
+	/**
+	 * Set the format that updates to the display are encoded as. Takes
+	 * effect at the end of the current frame.
+	 */
+	inline void SetImageEncoding(guac_image_encoding encoding) {
+		image_encoding_ = encoding;
+	}
+
+	/**
+	 * Enable or disable sending regions of the display which are changing
+	 * every frame, such as video, lossily. Takes effect at the end of the
+	 * current frame.
+	 */
+	inline void SetVideoMode(bool enabled) {
+		video_mode_ = enabled;
+	}
+
    private:
 	void OnUserJoin(GuacUser& user) override;
 	void OnUserLeave(GuacUser& user) override;
 	void MouseHandler(GuacUser& user, int x, int y, int button_mask) override;
 	void KeyHandler(GuacUser& user, int keysym, int pressed) override;
 	void ClipboardHandler(GuacUser& user, guac_stream* stream, char* mimetype) override;
+	void OnInputQueued() override;
+
+	/**
+	 * Like WaitForMessage, but also returns early when input is queued.
+	 */
+	int WaitForMessageOrInput(rfbClient* client, unsigned int usecs);
 
 	static void guac_vnc_update(rfbClient* client, int x, int y, int w, int h);
 	static void guac_vnc_copyrect(rfbClient* client, int src_x, int src_y, int w, int h, int dest_x, int dest_y);
@@ -48,12 +108,33 @@ class GuacVNCClient : public GuacClient {
 	static rfbBool guac_vnc_malloc_framebuffer(rfbClient* rfb_client);
 	static char* guac_vnc_get_password(rfbClient* rfb_client);
 	static void guac_vnc_cursor(rfbClient* client, int x, int y, int w, int h, int bpp);
+	unsigned char* GetScratchBuffer(size_t size);
 	int EndFrame();
 	int GetProcessingLag();
 	rfbClient* GetVNCClient();
 	void VNCThread();
+
+	/**
+	 * Takes a snapshot of the default surface and encodes a thumbnail
+	 * from it on the encoder pool. Does nothing if the previous
+	 * thumbnail is still being encoded.
+	 */
 	void GenerateThumbnail();
 
+	/**
+	 * Scales and encodes a snapshot unless it hasn't changed since
+	 * the last thumbnail. Takes ownership of the snapshot.
+	 */
+	void EncodeThumbnail(cairo_surface_t* snapshot);
+
+	/**
+	 * Waits for the thumbnail being encoded, if there is one.
+	 */
+	void WaitForThumbnail();
+	void SendKeyframe();
+	void LogFrameTimings();
+	int GetVideoQuality();
+
 	std::thread vnc_thread_;
 
 	/**
@@ -74,6 +155,16 @@ class GuacVNCClient : public GuacClient {
 	*/
 	int copy_rect_used_;
 
+	/**
+	 * Converts framebuffer and cursor pixels to Cairo's format.
+	 */
+	GuacPixelConverter pixel_converter_;
+
+	/**
+	 * Reused for converted pixels so that updates don't allocate.
+	 */
+	std::vector<unsigned char> scratch_buffer_;
+
 	/**
 	* Client settings, parsed from args.
 	*/
@@ -125,6 +216,77 @@ class GuacVNCClient : public GuacClient {
 	*/
 	guac_common_surface* default_surface_;
 
+	/**
+	 * Collects the instructions of each frame of the default surface so
+	 * that its images are encoded off the VNC thread. It writes the frames
+	 * to the broadcast socket in order.
+	 */
+	GuacFrameSocket frame_socket_;
+
+	/**
+	 * Whether the default surface should use tiled change tracking.
+	 */
+	std::atomic<bool> tiled_updates_;
+
+	/**
+	 * The format updates to the default surface are encoded as.
+	 */
+	std::atomic<guac_image_encoding> image_encoding_;
+
+	/**
+	 * Whether video detection is enabled for the default surface.
+	 */
+	std::atomic<bool> video_mode_;
+
+	/**
+	 * Users who have joined but have not been sent the display yet. They
+	 * are served by the VNC thread after a frame has been flushed, so the
+	 * keyframe they receive matches what has already been broadcast.
+	 */
+	std::vector<GuacUser*> pending_joins_;
+
+	/**
+	 * Mutex for pending_joins_.
+	 */
+	std::mutex pending_joins_mutex_;
+
+	/**
+	 * The encoded default surface and cursor image that is sent to joining
+	 * users. It is only re-encoded when a user joins after the surface or
+	 * cursor has changed, so every user joining within the same frame
+	 * receives the same message.
+	 */
+	std::shared_ptr<const websocketmm::websocket_message> keyframe_;
+
+	/**
+	 * The version of the default surface that keyframe_ was encoded from.
+	 */
+	unsigned int keyframe_version_;
+
+	/**
+	 * Set while a thumbnail is being encoded on the encoder pool.
+	 */
+	bool thumbnail_pending_;
+	std::mutex thumbnail_mutex_;
+	std::condition_variable thumbnail_wait_;
+
+	/**
+	 * The hash of the snapshot the last thumbnail was made from, so an
+	 * unchanged screen isn't encoded again. Only valid if thumbnail_hashed_
+	 * is set, which is cleared on every new VNC connection. Both are
+	 * guarded by thumbnail_mutex_.
+	 */
+	unsigned int thumbnail_hash_;
+	bool thumbnail_hashed_;
+
+#ifndef _WIN32
+	/**
+	 * Written to when input is queued to wake the VNC thread while it waits
+	 * for the VNC server. On Windows input waits until the end of the frame.
+	 */
+	int wake_pipe_[2];
+#endif
+
 	char* vnc_settings_[9];
 
 	static char* GUAC_VNC_CLIENT_KEY;
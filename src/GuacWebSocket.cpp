@@ -10,22 +10,20 @@ GuacWebSocket::GuacWebSocket(CollabVMServer* server, std::weak_ptr<websocketmm::
 }
 
 void GuacWebSocket::InstructionBegin() {
-	// Lock stringstream
+	// Lock instruction buffer
 	mutex_.lock();
 }
 
 void GuacWebSocket::InstructionEnd() {
-	std::string str = ss_.str();
+	// Take the instruction, which also clears the buffer
+	std::vector<std::uint8_t> data = buffer_.Release();
 
-	// Clear stringstream
-	ss_.str("");
-
-	// Unlock stringstream
+	// Unlock instruction buffer
 	mutex_.unlock();
 
 	// Check that the message ends with a semicolon
-	//assert(str[str.length() - 1] == ';');
-	if(str.length() && str[str.length() - 1] == ';') {
-		server_->SendGuacMessage(websocket_handle_, str);
+	//assert(data.back() == ';');
+	if(!data.empty() && data.back() == ';') {
+		server_->SendGuacMessage(websocket_handle_, websocketmm::BuildWebsocketMessage(websocketmm::websocket_message::type::text, std::move(data)));
 	}
 }
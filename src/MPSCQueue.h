@@ -0,0 +1,136 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+/**
+ * Intrusive hook for objects stored in an MPSCQueue.
+ */
+struct MPSCNode {
+	std::atomic<MPSCNode*> next { nullptr };
+};
+
+/**
+ * Intrusive multi-producer, single-consumer queue (Dmitry Vyukov's design).
+ * Pushing is a single atomic exchange, and popping takes no locks. The
+ * consumer only takes a lock when it has to sleep until something is pushed.
+ *
+ * \tparam T The queued type, which must inherit from MPSCNode.
+ */
+template <class T>
+class MPSCQueue {
+   public:
+	MPSCQueue()
+		: head_(&stub_),
+		  tail_(&stub_) {
+	}
+
+	~MPSCQueue() {
+		while(T* node = Pop())
+			delete node;
+	}
+
+	/**
+	 * Add a node to the queue. Safe to call from any thread.
+	 */
+	void Push(T* node) {
+		size_.fetch_add(1, std::memory_order_relaxed);
+		Link(node);
+
+		// The consumer marks itself as waiting before it checks the queue,
+		// so either it sees the node or we see that it needs waking up
+		if(waiting_.load()) {
+			std::lock_guard<std::mutex> lock(wait_mutex_);
+			wait_cv_.notify_one();
+		}
+	}
+
+	/**
+	 * Take the node at the front of the queue, or return null if it's empty.
+	 * Only the consumer thread may call this.
+	 */
+	T* Pop() {
+		MPSCNode* tail = tail_;
+		MPSCNode* next = tail->next.load(std::memory_order_acquire);
+
+		if(tail == &stub_) {
+			if(!next)
+				return nullptr;
+			tail_ = next;
+			tail = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+
+		if(next) {
+			tail_ = next;
+			return Take(tail);
+		}
+
+		// Another node is being pushed, it will be linked in a moment
+		if(tail != head_.load(std::memory_order_acquire))
+			return nullptr;
+
+		// The tail is the last node, so put the stub behind it before taking it
+		Link(&stub_);
+
+		next = tail->next.load(std::memory_order_acquire);
+		if(next) {
+			tail_ = next;
+			return Take(tail);
+		}
+		return nullptr;
+	}
+
+	/**
+	 * Block until the queue isn't empty. Only the consumer thread may call this.
+	 */
+	void Wait() {
+		std::unique_lock<std::mutex> lock(wait_mutex_);
+		waiting_.store(true);
+		wait_cv_.wait(lock, [this]() {
+			return tail_ != &stub_ || stub_.next.load() != nullptr;
+		});
+		waiting_.store(false, std::memory_order_relaxed);
+	}
+
+	/**
+	 * The number of nodes in the queue. Approximate while nodes are being pushed.
+	 */
+	size_t Size() const {
+		return size_.load(std::memory_order_relaxed);
+	}
+
+   private:
+	void Link(MPSCNode* node) {
+		node->next.store(nullptr, std::memory_order_relaxed);
+		MPSCNode* prev = head_.exchange(node, std::memory_order_acq_rel);
+		prev->next.store(node);
+	}
+
+	T* Take(MPSCNode* node) {
+		size_.fetch_sub(1, std::memory_order_relaxed);
+		return static_cast<T*>(node);
+	}
+
+	/**
+	 * The most recently pushed node. Producers swap themselves in here.
+	 */
+	std::atomic<MPSCNode*> head_;
+
+	/**
+	 * The next node to be popped, only touched by the consumer.
+	 */
+	MPSCNode* tail_;
+
+	/**
+	 * Placeholder that keeps the list from ever being empty, so a push never
+	 * has to update the tail.
+	 */
+	MPSCNode stub_;
+
+	std::atomic<size_t> size_ { 0 };
+
+	std::atomic<bool> waiting_ { false };
+	std::mutex wait_mutex_;
+	std::condition_variable wait_cv_;
+};
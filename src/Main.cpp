@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <iostream>
+#include <thread>
+#include <vector>
 #include "CollabVM.h"
 
 #if !defined(_WIN32)
@@ -9,10 +12,6 @@
 //#include <windows.h>
 #endif
 
-// Enable this to allow Asio multi threading
-// Currently a bit buggy and unneeded with beast..
-//#define ENABLE_ASIO_MULTITHREADING
-
 void IgnorePipe() {
 	// Ignores SIGPIPE to prevent LibVNCClient from crashing on Linux
 #ifndef _WIN32
@@ -28,12 +27,14 @@ void IgnorePipe() {
 #ifndef UNIT_TEST
 int main(int argc, char* argv[]) {
 	try {
-		if(argc < 2 || argc > 3) {
-			std::cout << "Usage: [Port] [HTTP dir]\n";
+		if(argc < 2 || argc > 4) {
+			std::cout << "Usage: [Port] [HTTP dir] [I/O threads]\n";
 			std::cout << "Port - the port to listen on for websocket and http requests\n";
 			std::cout << "HTTP dir (optional) - the directory to serve HTTP files from. defaults to \"http\""
 						 " in the current directory\n";
-			std::cout << "\tEx: 80 web" << std::endl;
+			std::cout << "I/O threads (optional) - the number of threads to run network I/O on, 0 for one per CPU core."
+						 " defaults to the server config\n";
+			std::cout << "\tEx: 80 web 4" << std::endl;
 			return -1;
 		}
 
@@ -49,51 +50,61 @@ int main(int argc, char* argv[]) {
 			return -1;
 		}
 
+		int io_threads = -1;
+		if(argc > 3) {
+			s = argv[3];
+			io_threads = stoi(s, &i);
+			if(i != s.length() || io_threads < 0) {
+				std::cout << "Invalid number of I/O threads." << std::endl;
+				return -1;
+			}
+		}
+
 		std::cout << "Collab VM Server started" << std::endl;
 
 		boost::asio::io_service service_;
 		std::shared_ptr<CollabVMServer> server_;
 
-		// Set up Ctrl+C handler
+		IgnorePipe();
+
+		server_ = std::make_shared<CollabVMServer>(service_);
+
+		// Set up Ctrl+C handler. It runs on the server's strand so it
+		// can't race the timers' handlers when there are multiple threads.
 		boost::asio::signal_set interruptSignal(service_, SIGINT, SIGTERM);
-		interruptSignal.async_wait([&](boost::system::error_code ec, int sig) {
+		interruptSignal.async_wait(boost::asio::bind_executor(server_->GetStrand(), [&](boost::system::error_code ec, int sig) {
 			std::cout << "\nShutting down..." << std::endl;
 			//work.reset();
 			server_->Stop();
 			service_.stop();
-		});
-
-		IgnorePipe();
-
-		server_ = std::make_shared<CollabVMServer>(service_);
+		}));
 		server_->Run(port, argc > 2 ? argv[2] : "http");
 
-		// If the server has multithreading enabled, then
-		// spawn the threads now.
-	#ifdef ENABLE_ASIO_MULTITHREADING
-		std::vector<std::thread> threads;
+		// The command line overrides the config
+		unsigned int thread_count = io_threads >= 0 ? io_threads : server_->GetIOThreads();
+		if(thread_count == 0)
+			thread_count = std::max(std::thread::hardware_concurrency(), 1u);
 
-		const auto N = (std::thread::hardware_concurrency() / 2) - 1;
-		threads.reserve(N);
+		// Each websocket connection has its own strand and the server's
+		// timers share another, so completion handlers can run on any thread.
+		std::vector<std::thread> threads;
+		threads.reserve(thread_count - 1);
 
-		// Notify user how many threads the server will spawn to run completion handlers
-		std::cout << "Running server ASIO completion handlers on " << N << " worker threads\n";
-		std::cout << "Your system will actually run " << N + 1 << " worker threads including main thread\n";
+		if(thread_count > 1)
+			std::cout << "Running server ASIO completion handlers on " << thread_count << " threads" << std::endl;
 
-		for(int j = 0; j < N; ++j) {
+		for(unsigned int j = 1; j < thread_count; ++j) {
 			threads.emplace_back([&service_]() {
 				service_.run();
 			});
 		}
-	#endif
+
 		// Run the io_service on the main thread.
 		service_.run();
 
-	#ifdef ENABLE_ASIO_MULTITHREADING
 		// Join ASIO completion handler threads when the server is stopping.
 		for(auto& thread : threads)
 			thread.join();
-	#endif
 	} catch(const std::exception& e) {
 		std::cout << "An exception was thrown:" << std::endl;
 		std::cout << e.what() << std::endl;
@@ -104,19 +104,22 @@ void ReniceAllTasks(pid_t process, int nice) {
 }
 #endif
 
-QEMUController::QEMUController(CollabVMServer& server, boost::asio::io_service& service, const std::shared_ptr<VMSettings>& settings)
-	: VMController(server, service, settings),
+QEMUController::QEMUController(CollabVMServer& server, const Strand& strand, const std::shared_ptr<VMSettings>& settings)
+	: VMController(server, strand, settings),
 	  guac_client_(server, *this, users_, settings->VNCAddress, settings->VNCPort),
 	  internal_state_(InternalState::kInactive),
 	  qemu_running_(false),
-	  timer_(service),
+	  timer_(strand),
 	  retry_count_(0)
 #ifndef _WIN32
 	  ,
-	  signal_(service, SIGCHLD)
+	  signal_(strand, SIGCHLD)
 #endif
 {
 	SetCommand(settings->QEMUCmd);
+	guac_client_.SetTiledUpdates(settings->TiledUpdates);
+	guac_client_.SetImageEncoding(static_cast<guac_image_encoding>(settings->ImageEncoding));
+	guac_client_.SetVideoMode(settings->VideoMode);
 
 	std::lock_guard<std::mutex> lock(qmp_thread_mutex_);
 	if(!qmp_count_++) {
@@ -163,6 +166,9 @@ void QEMUController::ChangeSettings(const std::shared_ptr<VMSettings>& settings)
 			InitAgent(*settings, *qmp_service_);
 		}
 	}
+	guac_client_.SetTiledUpdates(settings->TiledUpdates);
+	guac_client_.SetImageEncoding(static_cast<guac_image_encoding>(settings->ImageEncoding));
+	guac_client_.SetVideoMode(settings->VideoMode);
 	VMController::ChangeSettings(settings);
 	settings_ = settings;
 	if(restart)
@@ -24,7 +24,7 @@ class QEMUController : public VMController, public QMPCallback {
 	/**
 	 * Creates a new VM controller for QEMU.
 	 */
-	QEMUController(CollabVMServer& server, boost::asio::io_service& service, const std::shared_ptr<VMSettings>& settings);
+	QEMUController(CollabVMServer& server, const Strand& strand, const std::shared_ptr<VMSettings>& settings);
 
 	void ChangeSettings(const std::shared_ptr<VMSettings>& settings) override;
 
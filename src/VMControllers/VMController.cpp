@@ -3,21 +3,21 @@
 #include "Database/VMSettings.h"
 #include <boost/asio.hpp>
 
-VMController::VMController(CollabVMServer& server, boost::asio::io_service& service, const std::shared_ptr<VMSettings>& settings)
+VMController::VMController(CollabVMServer& server, const Strand& strand, const std::shared_ptr<VMSettings>& settings)
 	: server_(server),
-	  io_service_(service),
+	  strand_(strand),
 	  settings_(settings),
-	  turn_timer_(service),
+	  turn_timer_(strand),
 	  vote_state_(VoteState::kIdle),
 	  vote_count_yes_(0),
 	  vote_count_no_(0),
-	  vote_timer_(service),
+	  vote_timer_(strand),
 	  current_turn_(nullptr),
 	  connected_users_(0),
 	  stop_reason_(StopReason::kNormal),
-	  thumbnail_str_(nullptr),
-	  agent_timer_(service),
-	  agent_connected_(false) {
+	  agent_timer_(strand),
+	  agent_connected_(false),
+	  shard_(0) {
 }
 
 void VMController::InitAgent(const VMSettings& settings, boost::asio::io_service& service) {
@@ -73,10 +73,7 @@ void VMController::Stop(StopReason reason) {
 	vote_timer_.cancel(ec);
 	agent_timer_.cancel(ec);
 
-	if(thumbnail_str_) {
-		delete thumbnail_str_;
-		thumbnail_str_ = nullptr;
-	}
+	thumbnail_str_.reset();
 
 	server_.OnVMControllerStateChange(shared_from_this(), VMController::ControllerState::kStopping);
 }
@@ -193,6 +190,22 @@ void VMController::EndVoteCommonLogic(bool vote_passed) {
 		RestoreVMSnapshot();
 }
 
+void VMController::SetCurrentTurn(const std::shared_ptr<CollabVMUser>& user) {
+	if(current_turn_ == user)
+		return;
+
+	// Only the user holding the turn can queue input from the websocket thread
+	if(current_turn_) {
+		std::lock_guard<std::mutex> lock(current_turn_->turn_input_lock);
+		current_turn_->turn_client = nullptr;
+	}
+	current_turn_ = user;
+	if(current_turn_ && current_turn_->guac_user) {
+		std::lock_guard<std::mutex> lock(current_turn_->turn_input_lock);
+		current_turn_->turn_client = current_turn_->guac_user->client_;
+	}
+}
+
 void VMController::TurnRequest(const std::shared_ptr<CollabVMUser>& user, bool turnJack, bool isStaff) {
 	// If the user is already in the queue or they are already
 	// in control don't allow them to make another turn request
@@ -212,7 +225,7 @@ void VMController::TurnRequest(const std::shared_ptr<CollabVMUser>& user, bool t
 
 	if(!current_turn_) {
 		// If no one currently has a turn then give the requesting user control
-		current_turn_ = user;
+		SetCurrentTurn(user);
 		// Start the turn timer
 		boost::system::error_code ec;
 		turn_timer_.expires_from_now(std::chrono::seconds(settings_->TurnTime), ec);
@@ -226,7 +239,7 @@ void VMController::TurnRequest(const std::shared_ptr<CollabVMUser>& user, bool t
 			// Turn-jack
 			turn_queue_.push_front(current_turn_);
 			current_turn_->waiting_turn = true;
-			current_turn_ = user;
+			SetCurrentTurn(user);
 
 			boost::system::error_code ec;
 			turn_timer_.cancel(ec);
@@ -242,7 +255,7 @@ void VMController::TurnRequest(const std::shared_ptr<CollabVMUser>& user, bool t
 void VMController::NextTurn() {
 	int32_t time_remaining;
 	if(!turn_queue_.empty()) {
-		current_turn_ = turn_queue_.front();
+		SetCurrentTurn(turn_queue_.front());
 		current_turn_->waiting_turn = false;
 		turn_queue_.pop_front();
 
@@ -252,7 +265,7 @@ void VMController::NextTurn() {
 		turn_timer_.async_wait(std::bind(&VMController::TurnTimerCallback, shared_from_this(), std::placeholders::_1));
 		time_remaining = std::chrono::duration_cast<millisecs_t>(turn_timer_.expires_from_now()).count();
 	} else {
-		current_turn_ = nullptr;
+		SetCurrentTurn(nullptr);
 		time_remaining = 0;
 	}
 
@@ -265,7 +278,7 @@ void VMController::ClearTurnQueue() {
 		(*it)->waiting_turn = false;
 		it = turn_queue_.erase(it);
 	}
-	current_turn_ = nullptr;
+	SetCurrentTurn(nullptr);
 	server_.BroadcastTurnInfo(*this, users_, turn_queue_, current_turn_.get(), 0);
 }
 
@@ -331,7 +344,7 @@ void VMController::EndTurn(const std::shared_ptr<CollabVMUser>& user) {
 		turn_timer_.cancel(ec);
 
 		if(!turn_queue_.empty()) {
-			current_turn_ = turn_queue_.front();
+			SetCurrentTurn(turn_queue_.front());
 			current_turn_->waiting_turn = false;
 			turn_queue_.pop_front();
 
@@ -339,7 +352,7 @@ void VMController::EndTurn(const std::shared_ptr<CollabVMUser>& user) {
 			turn_timer_.expires_from_now(std::chrono::seconds(settings_->TurnTime), ec);
 			turn_timer_.async_wait(std::bind(&VMController::TurnTimerCallback, shared_from_this(), std::placeholders::_1));
 		} else
-			current_turn_ = nullptr;
+			SetCurrentTurn(nullptr);
 
 		turn_change = true;
 	}
@@ -351,12 +364,13 @@ void VMController::EndTurn(const std::shared_ptr<CollabVMUser>& user) {
 
 void VMController::AddUser(const std::shared_ptr<CollabVMUser>& user) {
 	users_.AddUser(*user, [this](CollabVMUser& user) { OnAddUser(user); });
+	user->shard.store(shard_, std::memory_order_relaxed);
 
 	int32_t time_remaining;
 	if(current_turn_) {
 		time_remaining = std::chrono::duration_cast<millisecs_t>(turn_timer_.expires_from_now()).count();
 		if(time_remaining > 0)
-			server_.SendTurnInfo(*user, time_remaining, *current_turn_->username, turn_queue_);
+			server_.SendTurnInfo(*this, *user, time_remaining);
 	}
 
 	if(vote_state_ == VoteState::kVoting) {
@@ -383,10 +397,11 @@ void VMController::RemoveUser(const std::shared_ptr<CollabVMUser>& user) {
 	EndTurn(user);
 
 	users_.RemoveUser(*user, [this](CollabVMUser& user) { OnRemoveUser(user); });
+	user->shard.store(CollabVMUser::kNoShard, std::memory_order_relaxed);
 }
 
-void VMController::NewThumbnail(std::string* str) {
-	server_.OnVMControllerThumbnailUpdate(shared_from_this(), str);
+void VMController::NewThumbnail(std::shared_ptr<const std::string> str) {
+	server_.OnVMControllerThumbnailUpdate(shared_from_this(), std::move(str));
 }
 
 bool VMController::IsFileUploadValid(const std::shared_ptr<CollabVMUser>& user, const std::string& filename, size_t file_size, bool run_file) {
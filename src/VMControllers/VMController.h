@@ -26,6 +26,12 @@ class VMController : public std::enable_shared_from_this<VMController>, public A
 	friend GuacBroadcastSocket;
 
    public:
+	/**
+	 * The executor that timers and hypervisor signals are run on. Their
+	 * handlers never run concurrently, even when the io_service is run by
+	 * several threads.
+	 */
+	typedef boost::asio::strand<boost::asio::io_context::executor_type> Strand;
 
 	virtual ~VMController() = default;
 
@@ -144,27 +150,27 @@ class VMController : public std::enable_shared_from_this<VMController>, public A
 	 * Called by the Guacamole client after a new thumbnail has
 	 * been created.
 	 */
-	void NewThumbnail(std::string* str);
+	void NewThumbnail(std::shared_ptr<const std::string> str);
 
-	inline std::string* GetThumbnail() const {
+	inline const std::shared_ptr<const std::string>& GetThumbnail() const {
 		return thumbnail_str_;
 	}
 
-	inline void SetThumbnail(std::string* str) {
-		if(thumbnail_str_)
-			delete thumbnail_str_;
-		thumbnail_str_ = str;
+	inline void SetThumbnail(std::shared_ptr<const std::string> str) {
+		thumbnail_str_ = std::move(str);
 	}
 
-	//inline std::string& GetTurnListCache()
-	//{
-	//	return turn_list_cache_;
-	//}
+	/**
+	 * The encoded list of users from the last turn broadcast, reused
+	 * for users joining the VM. Empty if it needs to be rebuilt.
+	 */
+	inline std::string& GetTurnListCache() {
+		return turn_list_cache_;
+	}
 
-	//inline void SetTurnListCache(const std::string& str)
-	//{
-	//	turn_list_cache_ = str;
-	//}
+	inline void SetTurnListCache(std::string&& str) {
+		turn_list_cache_ = std::move(str);
+	}
 
 	inline UserList& GetUsersList() {
 		return users_;
@@ -187,8 +193,14 @@ class VMController : public std::enable_shared_from_this<VMController>, public A
 	bool agent_upload_in_progress_;
 	std::deque<std::shared_ptr<UploadInfo>> agent_upload_queue_;
 
+	/**
+	 * The processing shard that runs the actions for this controller.
+	 * Assigned by CollabVMServer when the controller is created.
+	 */
+	uint32_t shard_;
+
    protected:
-	VMController(CollabVMServer& server, boost::asio::io_service& service, const std::shared_ptr<VMSettings>& settings);
+	VMController(CollabVMServer& server, const Strand& strand, const std::shared_ptr<VMSettings>& settings);
 
 	virtual void OnAddUser(CollabVMUser& user) = 0;
 
@@ -208,10 +220,9 @@ class VMController : public std::enable_shared_from_this<VMController>, public A
 	CollabVMServer& server_;
 
 	/**
-	 * The io_service to use for guest service sockets and
-	 * hypervisor controller sockets.
+	 * The strand to use for timers and hypervisor signals.
 	 */
-	boost::asio::io_service& io_service_;
+	Strand strand_;
 
 	std::shared_ptr<VMSettings> settings_;
 
@@ -241,6 +252,11 @@ class VMController : public std::enable_shared_from_this<VMController>, public A
 
 	void EndVoteCommonLogic(bool vote_passed);
 
+	/**
+	 * Gives the turn to a user, or nobody if it's null.
+	 */
+	void SetCurrentTurn(const std::shared_ptr<CollabVMUser>& user);
+
 	void VoteEndedCallback(const boost::system::error_code& ec);
 
 	void TurnTimerCallback(const boost::system::error_code& ec);
@@ -262,9 +278,13 @@ class VMController : public std::enable_shared_from_this<VMController>, public A
 	 */
 	boost::asio::steady_timer vote_timer_;
 
-	std::string* thumbnail_str_;
+	/**
+	 * The base64 encoded PNG thumbnail of the VM. It's never modified,
+	 * only replaced, so it can be shared with the list response.
+	 */
+	std::shared_ptr<const std::string> thumbnail_str_;
 
-	//std::string turn_list_cache_;
+	std::string turn_list_cache_;
 
 	const uint32_t kMaxFilenameLen = 100;
 };
@@ -28,6 +28,7 @@
 #include <cairo/cairo.h>
 #include <guacamole/protocol.h>
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -40,17 +41,20 @@ guac_common_cursor* guac_common_cursor_alloc(GuacClient& client) {
     /* Associate cursor with client and allocate cursor layer */
 	cursor->layer = client.AllocLayer();
 
-    /* Allocate initial image buffer */
-    cursor->image_buffer_size = GUAC_COMMON_CURSOR_DEFAULT_SIZE;
-    cursor->image_buffer = (unsigned char*)malloc(cursor->image_buffer_size);
-
     /* No cursor image yet */
     cursor->width = 0;
     cursor->height = 0;
-    cursor->surface = NULL;
     cursor->hotspot_x = 0;
     cursor->hotspot_y = 0;
 
+    /* No cached images yet */
+    for (int i = 0; i < GUAC_COMMON_CURSOR_CACHE_SIZE; i++) {
+        cursor->images[i].buffer = NULL;
+        cursor->images[i].surface = NULL;
+    }
+    cursor->image_clock = 0;
+    cursor->image = NULL;
+
     /* No user has moved the mouse yet */
     cursor->user = NULL;
 
@@ -64,15 +68,19 @@ guac_common_cursor* guac_common_cursor_alloc(GuacClient& client) {
 
 void guac_common_cursor_free(guac_common_cursor* cursor) {
 
-    /* Free image buffer and surface */
-    free(cursor->image_buffer);
-    if (cursor->surface != NULL)
-        cairo_surface_destroy(cursor->surface);
+    /* Free cached images and return their buffers to the pool */
+    for (int i = 0; i < GUAC_COMMON_CURSOR_CACHE_SIZE; i++) {
+        guac_common_cursor_image* image = &cursor->images[i];
+        if (image->buffer != NULL) {
+            cairo_surface_destroy(image->surface);
+            cursor->client.FreeBuffer(image->buffer);
+        }
+    }
 
     /* Return layer to pool */
 	cursor->client.FreeLayer(cursor->layer);
 
-    free(cursor);
+    delete cursor;
 
 }
 
@@ -84,13 +92,27 @@ void guac_common_cursor_dup(guac_common_cursor* cursor, GuacSocket& socket) {
             cursor->y - cursor->hotspot_y,
             0);
 
+    /* Synchronize cached images, so later shape changes can refer to them */
+    for (int i = 0; i < GUAC_COMMON_CURSOR_CACHE_SIZE; i++) {
+        guac_common_cursor_image* image = &cursor->images[i];
+        if (image->buffer != NULL) {
+            guac_protocol_send_size(socket, image->buffer,
+                    cairo_image_surface_get_width(image->surface),
+                    cairo_image_surface_get_height(image->surface));
+
+            guac_protocol_send_png(socket, GUAC_COMP_SRC,
+                    image->buffer, 0, 0, image->surface);
+        }
+    }
+
     /* Synchronize cursor image */
-    if (cursor->surface != NULL) {
+    if (cursor->image != NULL) {
         guac_protocol_send_size(socket, cursor->layer,
                 cursor->width, cursor->height);
 
-        guac_protocol_send_png(socket, GUAC_COMP_SRC,
-                cursor->layer, 0, 0, cursor->surface);
+        guac_protocol_send_copy(socket, cursor->image->buffer,
+                0, 0, cursor->width, cursor->height,
+                GUAC_COMP_SRC, cursor->layer, 0, 0);
     }
 
     socket.Flush();
@@ -138,40 +160,112 @@ void guac_common_cursor_move(guac_common_cursor* cursor, GuacUser& user,
 }
 
 /**
- * Ensures the cursor image buffer has enough room to fit an image with the 
- * given characteristics. Existing image buffer data may be destroyed.
+ * Hashes raw 32-bit image data, to quickly find cached images that may
+ * match it.
  */
-static void guac_common_cursor_resize(guac_common_cursor* cursor,
+static unsigned int guac_common_cursor_hash(unsigned const char* data,
         int width, int height, int stride) {
 
-    int minimum_size = height * stride;
+    unsigned int hash = 0x1B872E69;
 
-    /* Grow image buffer if necessary */
-    if (cursor->image_buffer_size < minimum_size) {
+    for (int y = 0; y < height; y++) {
+        const uint32_t* row = (const uint32_t*) (data + y * stride);
+        for (int x = 0; x < width; x++)
+            hash = ((hash << 1) | (hash >> 31)) ^ row[x] ^ 0x1B872E69;
+    }
 
-        /* Calculate new size */
-        cursor->image_buffer_size = minimum_size*2;
+    return hash;
 
-        /* Destructively reallocate image buffer */
-        free(cursor->image_buffer);
-        cursor->image_buffer = (unsigned char*)malloc(cursor->image_buffer_size);
+}
 
+/**
+ * Whether raw 32-bit image data is identical to a cached image.
+ */
+static bool guac_common_cursor_image_equals(guac_common_cursor_image* image,
+        unsigned const char* data, int width, int height, int stride) {
+
+    if (cairo_image_surface_get_width(image->surface) != width
+            || cairo_image_surface_get_height(image->surface) != height)
+        return false;
+
+    unsigned const char* cached = cairo_image_surface_get_data(image->surface);
+    int cached_stride = cairo_image_surface_get_stride(image->surface);
+
+    for (int y = 0; y < height; y++) {
+        if (memcmp(cached + y * cached_stride, data + y * stride, width * 4))
+            return false;
     }
 
+    return true;
+
 }
 
-void guac_common_cursor_set_argb(guac_common_cursor* cursor, int hx, int hy,
-    unsigned const char* data, int width, int height, int stride) {
+/**
+ * Finds the cached image matching the given raw image data. If it isn't
+ * cached, the least recently used image is replaced with it, and it is sent
+ * to all users.
+ */
+static guac_common_cursor_image* guac_common_cursor_cache(
+        guac_common_cursor* cursor, unsigned const char* data,
+        int width, int height, int stride) {
+
+    unsigned int hash = guac_common_cursor_hash(data, width, height, stride);
+    guac_common_cursor_image* lru = &cursor->images[0];
+
+    for (int i = 0; i < GUAC_COMMON_CURSOR_CACHE_SIZE; i++) {
+        guac_common_cursor_image* image = &cursor->images[i];
 
-    /* Copy image data */
-    guac_common_cursor_resize(cursor, width, height, stride);
-    memcpy(cursor->image_buffer, data, height * stride);
+        /* Prefer an unused entry to replacing one */
+        if (image->buffer == NULL) {
+            if (lru->buffer != NULL)
+                lru = image;
+            continue;
+        }
+
+        if (image->hash == hash && guac_common_cursor_image_equals(image,
+                    data, width, height, stride))
+            return image;
 
-    if (cursor->surface != NULL)
-        cairo_surface_destroy(cursor->surface);
+        if (lru->buffer != NULL && image->last_used < lru->last_used)
+            lru = image;
+    }
 
-    cursor->surface = cairo_image_surface_create_for_data(cursor->image_buffer,
-            CAIRO_FORMAT_ARGB32, width, height, stride);
+    /* The buffer of a replaced image is reused for the new one */
+    if (lru->buffer == NULL)
+        lru->buffer = cursor->client.AllocBuffer();
+    else
+        cairo_surface_destroy(lru->surface);
+
+    /* Copy image data, as the given data belongs to the caller */
+    lru->surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+            width, height);
+    unsigned char* cached = cairo_image_surface_get_data(lru->surface);
+    int cached_stride = cairo_image_surface_get_stride(lru->surface);
+    for (int y = 0; y < height; y++)
+        memcpy(cached + y * cached_stride, data + y * stride, width * 4);
+    cairo_surface_mark_dirty(lru->surface);
+
+    lru->hash = hash;
+
+    /* Broadcast new image to all users */
+    guac_protocol_send_size(cursor->client.broadcast_socket_, lru->buffer,
+            width, height);
+
+    guac_protocol_send_png(cursor->client.broadcast_socket_, GUAC_COMP_SRC,
+            lru->buffer, 0, 0, lru->surface);
+
+    return lru;
+
+}
+
+void guac_common_cursor_set_argb(guac_common_cursor* cursor, int hx, int hy,
+    unsigned const char* data, int width, int height, int stride) {
+
+    /* Find or send the image */
+    guac_common_cursor_image* image = guac_common_cursor_cache(cursor, data,
+            width, height, stride);
+    image->last_used = ++cursor->image_clock;
+    cursor->image = image;
 
     /* Set new cursor parameters */
     cursor->width = width;
@@ -186,12 +280,12 @@ void guac_common_cursor_set_argb(guac_common_cursor* cursor, int hx, int hy,
             cursor->y - hy,
             0);
 
-    /* Broadcast new cursor image to all users */
+    /* Copy the image from its buffer into the cursor layer */
     guac_protocol_send_size(cursor->client.broadcast_socket_, cursor->layer,
             width, height);
 
-    guac_protocol_send_png(cursor->client.broadcast_socket_, GUAC_COMP_SRC,
-            cursor->layer, 0, 0, cursor->surface);
+    guac_protocol_send_copy(cursor->client.broadcast_socket_, image->buffer,
+            0, 0, width, height, GUAC_COMP_SRC, cursor->layer, 0, 0);
 
     cursor->client.broadcast_socket_.Flush();
 
@@ -35,9 +35,41 @@ class GuacClient;
 class GuacUser;
 
 /**
- * The default size of the cursor image buffer.
+ * The number of cursor images kept in off-screen buffers. Guests switch
+ * between a handful of shapes, so a shape that was seen recently can be
+ * copied from its buffer instead of being encoded and sent again.
  */
-#define GUAC_COMMON_CURSOR_DEFAULT_SIZE 64*64*4
+#define GUAC_COMMON_CURSOR_CACHE_SIZE 8
+
+/**
+ * A cursor image that has been sent to all users and is kept in an
+ * off-screen buffer.
+ */
+typedef struct guac_common_cursor_image {
+
+    /**
+     * The buffer holding the image, or NULL if this entry is unused.
+     */
+    guac_layer* buffer;
+
+    /**
+     * A copy of the image, used to compare new images against and to send
+     * the image to joining users.
+     */
+    cairo_surface_t* surface;
+
+    /**
+     * The hash of the image data.
+     */
+    unsigned int hash;
+
+    /**
+     * The value of the cursor's image clock when the image was last used,
+     * the entry with the lowest value is replaced when the cache is full.
+     */
+    unsigned int last_used;
+
+} guac_common_cursor_image;
 
 /**
  * Cursor object which maintains and synchronizes the current mouse cursor
@@ -72,21 +104,21 @@ typedef struct guac_common_cursor {
     int height;
 
     /**
-     * Arbitrary image data buffer, backing the Cairo surface used to store
-     * the cursor image.
+     * The recently used cursor images.
      */
-    unsigned char* image_buffer;
+    guac_common_cursor_image images[GUAC_COMMON_CURSOR_CACHE_SIZE];
 
     /**
-     * The size of the image data buffer, in bytes.
+     * Incremented every time the cursor image is set, to find the least
+     * recently used image.
      */
-    int image_buffer_size;
+    unsigned int image_clock;
 
     /**
      * The current cursor image, if any. If the mouse cursor has not yet been
      * set, this will be NULL.
      */
-    cairo_surface_t* surface;
+    guac_common_cursor_image* image;
 
     /**
      * The X coordinate of the hotspot of the mouse cursor.
@@ -134,8 +166,8 @@ void guac_common_cursor_free(guac_common_cursor* cursor);
 
 /**
  * Sends the current state of this cursor across the given socket, including
- * the current cursor image. The resulting cursor on the remote display will
- * be visible.
+ * the current cursor image and the other cached images. The resulting cursor
+ * on the remote display will be visible.
  *
  * @param cursor The cursor to send.
  * @param socket The socket along which the cursor should be sent.
@@ -159,7 +191,8 @@ void guac_common_cursor_move(guac_common_cursor* cursor, GuacUser& user,
  * Sets the cursor image to the given raw image data. This raw image data must
  * be in 32-bit ARGB format, having 8 bits per color component, where the
  * alpha component is stored in the high-order 8 bits, and blue is stored
- * in the low-order 8 bits.
+ * in the low-order 8 bits. If the image is one of the cached images, it is
+ * copied from its buffer rather than sent again.
  *
  * @param cursor The cursor to set the image of.
  * @param hx The X coordinate of the hotspot of the new cursor image.
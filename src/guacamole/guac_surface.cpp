@@ -23,15 +23,29 @@
 #include "config.h"
 #include "guac_rect.h"
 #include "guac_surface.h"
+#include "GuacBufferSocket.h"
+#include "GuacEncoderPool.h"
 
 #include <cairo/cairo.h>
 #include <guacamole/layer.h>
 #include <guacamole/protocol.h>
 #include <guacamole/socket.h>
+#include <guacamole/timestamp.h>
 
 #include <stdlib.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <future>
+#include <vector>
+
+#include <boost/asio/post.hpp>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define GUAC_SURFACE_USE_X86_SIMD
+#include <immintrin.h>
+#endif
+
 /**
  * The width of an update which should be considered negible and thus
  * trivial overhead compared ot the cost of two updates.
@@ -71,6 +85,59 @@
  */
 #define GUAC_SURFACE_FILL_PATTERN_FACTOR 3
 
+/**
+ * The width and height of each tile when tiled change tracking is enabled,
+ * in pixels.
+ */
+#define GUAC_SURFACE_TILE_SIZE 64
+
+/**
+ * The number of consecutive flushes a region must change in before it is
+ * treated as video.
+ */
+#define GUAC_SURFACE_VIDEO_FRAMES 5
+
+/**
+ * The smallest region, in pixels, which may be treated as video.
+ */
+#define GUAC_SURFACE_VIDEO_MIN_AREA (128*128)
+
+/**
+ * The time, in milliseconds, a video region must stay still before it is
+ * sent again losslessly.
+ */
+#define GUAC_SURFACE_VIDEO_STILL_TIME 500
+
+/**
+ * The fewest rows or columns of an update which must match the surface
+ * shifted, such as after scrolling, for them to be sent as a copy. Updates
+ * narrower than this in the other direction are not checked.
+ */
+#define GUAC_SURFACE_MOTION_MIN_LINES 32
+
+/**
+ * The smallest update, in pixels, which is checked for moved content.
+ */
+#define GUAC_SURFACE_MOTION_MIN_AREA (128*128)
+
+/**
+ * The number of rows or columns of an update which are looked up in the
+ * surface to find how far its content may have moved.
+ */
+#define GUAC_SURFACE_MOTION_SAMPLES 8
+
+/**
+ * The most positions of each sampled row or column in the surface which are
+ * tried, so that repetitive content can't make the search slow.
+ */
+#define GUAC_SURFACE_MOTION_MAX_CANDIDATES 4
+
+/**
+ * The most bands of solid color an update may be made of for it to be sent
+ * as filled rectangles instead of an image.
+ */
+#define GUAC_SURFACE_MAX_SOLID_RECTS 4
+
 /* Define cairo_format_stride_for_width() if missing */
 #ifndef HAVE_CAIRO_FORMAT_STRIDE_FOR_WIDTH
 #define cairo_format_stride_for_width(format, width) (width*4)
@@ -188,6 +255,79 @@ static int __guac_common_should_combine(guac_common_surface* surface, const guac
 
 }
 
+/**
+ * Marks each tile intersecting the given rectangle as either dirty or as
+ * having unknown contents on the client. The rectangle must be within the
+ * bounds of the surface.
+ *
+ * @param surface The surface whose tiles should be marked.
+ * @param rect The rectangle of the update.
+ * @param invalidate Non-zero if the update has already been sent to the
+ *                   client by other means, such that the tiles' hashes no
+ *                   longer describe the client's contents, zero if the tiles
+ *                   should be sent on the next flush.
+ */
+static void __guac_common_surface_mark_tiles(guac_common_surface* surface,
+        const guac_common_rect* rect, int invalidate) {
+
+    int tx, ty;
+
+    int min_tx = rect->x / GUAC_SURFACE_TILE_SIZE;
+    int min_ty = rect->y / GUAC_SURFACE_TILE_SIZE;
+    int max_tx = (rect->x + rect->width - 1) / GUAC_SURFACE_TILE_SIZE;
+    int max_ty = (rect->y + rect->height - 1) / GUAC_SURFACE_TILE_SIZE;
+
+    for (ty = min_ty; ty <= max_ty && ty < surface->tiles_y; ty++) {
+        for (tx = min_tx; tx <= max_tx && tx < surface->tiles_x; tx++) {
+
+            int index = ty * surface->tiles_x + tx;
+
+            if (invalidate)
+                surface->tile_hashes[index] = 0;
+            else
+                surface->tile_dirty[index] = 1;
+
+        }
+    }
+
+}
+
+/**
+ * Allocates the tile grid of the given surface to fit its current size. All
+ * tiles start out clean, with unknown contents on the client.
+ *
+ * @param surface The surface to allocate tiles for.
+ */
+static void __guac_common_surface_alloc_tiles(guac_common_surface* surface) {
+
+    free(surface->tile_hashes);
+    free(surface->tile_dirty);
+
+    surface->tiles_x = (surface->width  + GUAC_SURFACE_TILE_SIZE - 1) / GUAC_SURFACE_TILE_SIZE;
+    surface->tiles_y = (surface->height + GUAC_SURFACE_TILE_SIZE - 1) / GUAC_SURFACE_TILE_SIZE;
+
+    surface->tile_hashes = (uint64_t*) calloc(surface->tiles_x * surface->tiles_y, sizeof(uint64_t));
+    surface->tile_dirty = (unsigned char*) calloc(surface->tiles_x * surface->tiles_y, 1);
+
+}
+
+/**
+ * Frees the tile grid of the given surface, if any.
+ *
+ * @param surface The surface to free tiles of.
+ */
+static void __guac_common_surface_free_tiles(guac_common_surface* surface) {
+
+    free(surface->tile_hashes);
+    free(surface->tile_dirty);
+
+    surface->tile_hashes = NULL;
+    surface->tile_dirty = NULL;
+    surface->tiles_x = 0;
+    surface->tiles_y = 0;
+
+}
+
 /**
  * Expands the dirty rect of the given surface to contain the rect described by the given
  * coordinates.
@@ -201,6 +341,19 @@ static void __guac_common_mark_dirty(guac_common_surface* surface, const guac_co
     if (rect->width <= 0 || rect->height <= 0)
         return;
 
+    surface->version++;
+
+    if (surface->tiled)
+        __guac_common_surface_mark_tiles(surface, rect, 0);
+
+    /* Track everything drawn within this frame for video detection */
+    if (surface->frame_dirty)
+        guac_common_rect_extend(&surface->frame_rect, rect);
+    else {
+        surface->frame_rect = *rect;
+        surface->frame_dirty = 1;
+    }
+
     /* If already dirty, update existing rect */
     if (surface->dirty)
         guac_common_rect_extend(&surface->dirty_rect, rect);
@@ -244,6 +397,10 @@ void guac_common_surface_flush_deferred(guac_common_surface* surface) {
     if (!surface->dirty)
         return;
 
+    /* Tiles track their own changes, leave the surface dirty until flushed */
+    if (surface->tiled)
+        return;
+
     /* Flush if queue size has reached maximum (space is reserved for the final dirty rect,
      * as guac_common_surface_flush() MAY add an additional rect to the queue */
     if (surface->png_queue_length == GUAC_COMMON_SURFACE_QUEUE_SIZE-1)
@@ -406,6 +563,250 @@ static void __guac_common_surface_rect(guac_common_surface* dst, guac_common_rec
 
 }
 
+/**
+ * A function which copies one row of opaque pixels, writing only where the
+ * destination differs, and reports the first and last pixels which changed.
+ *
+ * @param src The source row.
+ * @param dst The destination row.
+ * @param width The number of pixels in the row.
+ * @param first Set to the index of the first changed pixel, if any.
+ * @param last Set to the index of the last changed pixel, if any.
+ * @return Non-zero if any pixel changed, zero otherwise.
+ */
+typedef int __guac_common_surface_put_row_fn(const uint32_t* src, uint32_t* dst,
+                                              int width, int* first, int* last);
+
+/**
+ * Portable version of __guac_common_surface_put_row_fn, one pixel at a time.
+ */
+static int __guac_common_surface_put_row(const uint32_t* src, uint32_t* dst,
+                                         int width, int* first, int* last) {
+
+    int x;
+    int changed = 0;
+
+    for (x=0; x < width; x++) {
+
+        uint32_t new_color = src[x] | 0xFF000000;
+
+        if (dst[x] != new_color) {
+            if (!changed) *first = x;
+            *last = x;
+            changed = 1;
+            dst[x] = new_color;
+        }
+
+    }
+
+    return changed;
+
+}
+
+#ifdef GUAC_SURFACE_USE_X86_SIMD
+
+/**
+ * SSE2 version of __guac_common_surface_put_row(), comparing four pixels
+ * at a time.
+ */
+__attribute__((target("sse2")))
+static int __guac_common_surface_put_row_sse2(const uint32_t* src, uint32_t* dst,
+                                              int width, int* first, int* last) {
+
+    const __m128i alpha = _mm_set1_epi32(0xFF000000);
+
+    int x = 0;
+    int changed = 0;
+
+    for (; x + 4 <= width; x += 4) {
+
+        __m128i new_color = _mm_or_si128(_mm_loadu_si128((const __m128i*) (src + x)), alpha);
+        __m128i old_color = _mm_loadu_si128((const __m128i*) (dst + x));
+
+        /* One bit per pixel which differs */
+        int diff = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(new_color, old_color))) & 0xF;
+        if (diff) {
+            if (!changed) *first = x + __builtin_ctz(diff);
+            *last = x + 31 - __builtin_clz(diff);
+            changed = 1;
+            _mm_storeu_si128((__m128i*) (dst + x), new_color);
+        }
+
+    }
+
+    /* Remaining pixels */
+    int tail_first, tail_last;
+    if (__guac_common_surface_put_row(src + x, dst + x, width - x, &tail_first, &tail_last)) {
+        if (!changed) *first = x + tail_first;
+        *last = x + tail_last;
+        changed = 1;
+    }
+
+    return changed;
+
+}
+
+/**
+ * AVX2 version of __guac_common_surface_put_row(), comparing eight pixels
+ * at a time.
+ */
+__attribute__((target("avx2")))
+static int __guac_common_surface_put_row_avx2(const uint32_t* src, uint32_t* dst,
+                                              int width, int* first, int* last) {
+
+    const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+
+    int x = 0;
+    int changed = 0;
+
+    for (; x + 8 <= width; x += 8) {
+
+        __m256i new_color = _mm256_or_si256(_mm256_loadu_si256((const __m256i*) (src + x)), alpha);
+        __m256i old_color = _mm256_loadu_si256((const __m256i*) (dst + x));
+
+        /* One bit per pixel which differs */
+        int diff = ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(new_color, old_color))) & 0xFF;
+        if (diff) {
+            if (!changed) *first = x + __builtin_ctz(diff);
+            *last = x + 31 - __builtin_clz(diff);
+            changed = 1;
+            _mm256_storeu_si256((__m256i*) (dst + x), new_color);
+        }
+
+    }
+
+    /* Remaining pixels */
+    int tail_first, tail_last;
+    if (__guac_common_surface_put_row_sse2(src + x, dst + x, width - x, &tail_first, &tail_last)) {
+        if (!changed) *first = x + tail_first;
+        *last = x + tail_last;
+        changed = 1;
+    }
+
+    return changed;
+
+}
+
+#endif
+
+/**
+ * Returns the fastest row kernel supported by the current CPU.
+ */
+static __guac_common_surface_put_row_fn* __guac_common_surface_select_put_row() {
+
+#ifdef GUAC_SURFACE_USE_X86_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return __guac_common_surface_put_row_avx2;
+
+    if (__builtin_cpu_supports("sse2"))
+        return __guac_common_surface_put_row_sse2;
+#endif
+
+    return __guac_common_surface_put_row;
+
+}
+
+static __guac_common_surface_put_row_fn* const __guac_common_surface_put_row_best =
+        __guac_common_surface_select_put_row();
+
+/**
+ * Checks whether every pixel of a row is the given color.
+ *
+ * @param row The row.
+ * @param width The number of pixels in the row.
+ * @param color The color to compare against.
+ * @return Non-zero if the row is solid, zero otherwise.
+ */
+typedef int __guac_common_surface_solid_row_fn(const uint32_t* row, int width, uint32_t color);
+
+/**
+ * Portable version of __guac_common_surface_solid_row_fn, one pixel at a time.
+ */
+static int __guac_common_surface_solid_row(const uint32_t* row, int width, uint32_t color) {
+
+    int x;
+
+    for (x=0; x < width; x++) {
+        if (row[x] != color)
+            return 0;
+    }
+
+    return 1;
+
+}
+
+#ifdef GUAC_SURFACE_USE_X86_SIMD
+
+/**
+ * SSE2 version of __guac_common_surface_solid_row(), comparing four pixels
+ * at a time.
+ */
+__attribute__((target("sse2")))
+static int __guac_common_surface_solid_row_sse2(const uint32_t* row, int width, uint32_t color) {
+
+    const __m128i expected = _mm_set1_epi32(color);
+
+    int x = 0;
+
+    for (; x + 4 <= width; x += 4) {
+        __m128i current = _mm_loadu_si128((const __m128i*) (row + x));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(current, expected)) != 0xFFFF)
+            return 0;
+    }
+
+    /* Remaining pixels */
+    return __guac_common_surface_solid_row(row + x, width - x, color);
+
+}
+
+/**
+ * AVX2 version of __guac_common_surface_solid_row(), comparing eight pixels
+ * at a time.
+ */
+__attribute__((target("avx2")))
+static int __guac_common_surface_solid_row_avx2(const uint32_t* row, int width, uint32_t color) {
+
+    const __m256i expected = _mm256_set1_epi32(color);
+
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8) {
+        __m256i current = _mm256_loadu_si256((const __m256i*) (row + x));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(current, expected)) != -1)
+            return 0;
+    }
+
+    /* Remaining pixels */
+    return __guac_common_surface_solid_row_sse2(row + x, width - x, color);
+
+}
+
+#endif
+
+/**
+ * Returns the fastest solid row check supported by the current CPU.
+ */
+static __guac_common_surface_solid_row_fn* __guac_common_surface_select_solid_row() {
+
+#ifdef GUAC_SURFACE_USE_X86_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        return __guac_common_surface_solid_row_avx2;
+
+    if (__builtin_cpu_supports("sse2"))
+        return __guac_common_surface_solid_row_sse2;
+#endif
+
+    return __guac_common_surface_solid_row;
+
+}
+
+static __guac_common_surface_solid_row_fn* const __guac_common_surface_solid_row_best =
+        __guac_common_surface_select_solid_row();
+
 /**
  * Copies data from the given buffer to the surface at the given coordinates.
  * The dimensions and location of the destination rectangle will be altered
@@ -441,36 +842,62 @@ static void __guac_common_surface_put(unsigned char* src_buffer, int src_stride,
     src_buffer += src_stride * (*sy) + 4 * (*sx);
     dst_buffer += (dst_stride * rect->y) + (4 * rect->x);
 
-    /* For each row */
-    for (y=0; y < rect->height; y++) {
+    /* Opaque rows are compared and copied several pixels at a time */
+    if (opaque) {
 
-        uint32_t* src_current = (uint32_t*) src_buffer;
-        uint32_t* dst_current = (uint32_t*) dst_buffer;
+        for (y=0; y < rect->height; y++) {
 
-        /* Copy row */
-        for (x=0; x < rect->width; x++) {
+            int first, last;
+            if (__guac_common_surface_put_row_best((uint32_t*) src_buffer, (uint32_t*) dst_buffer,
+                        rect->width, &first, &last)) {
+                if (first < min_x) min_x = first;
+                if (y < min_y) min_y = y;
+                if (last > max_x) max_x = last;
+                if (y > max_y) max_y = y;
+            }
+
+            /* Next row */
+            src_buffer += src_stride;
+            dst_buffer += dst_stride;
+
+        }
+
+    }
+
+    /* Otherwise check the alpha of each pixel */
+    else {
+
+        for (y=0; y < rect->height; y++) {
+
+            uint32_t* src_current = (uint32_t*) src_buffer;
+            uint32_t* dst_current = (uint32_t*) dst_buffer;
+
+            /* Copy row */
+            for (x=0; x < rect->width; x++) {
 
-            if (opaque || (*src_current & 0xFF000000)) {
+                if (*src_current & 0xFF000000) {
 
-                uint32_t new_color = *src_current | 0xFF000000;
-                uint32_t old_color = *dst_current;
+                    uint32_t new_color = *src_current | 0xFF000000;
+                    uint32_t old_color = *dst_current;
 
-                if (old_color != new_color) {
-                    if (x < min_x) min_x = x;
-                    if (y < min_y) min_y = y;
-                    if (x > max_x) max_x = x;
-                    if (y > max_y) max_y = y;
-                    *dst_current = new_color;
+                    if (old_color != new_color) {
+                        if (x < min_x) min_x = x;
+                        if (y < min_y) min_y = y;
+                        if (x > max_x) max_x = x;
+                        if (y > max_y) max_y = y;
+                        *dst_current = new_color;
+                    }
                 }
+
+                src_current++;
+                dst_current++;
             }
 
-            src_current++;
-            dst_current++;
-        }
+            /* Next row */
+            src_buffer += src_stride;
+            dst_buffer += dst_stride;
 
-        /* Next row */
-        src_buffer += src_stride;
-        dst_buffer += dst_stride;
+        }
 
     }
 
@@ -653,6 +1080,256 @@ static void __guac_common_surface_transfer(guac_common_surface* src, int* sx, in
 
 }
 
+/**
+ * Hashes each row or each column of the given rectangle of image data.
+ *
+ * @param buffer The image data.
+ * @param stride The number of bytes in each row of the image data.
+ * @param x The X coordinate of the rectangle.
+ * @param y The Y coordinate of the rectangle.
+ * @param width The width of the rectangle.
+ * @param height The height of the rectangle.
+ * @param rows Non-zero to hash each row, zero to hash each column.
+ * @param hashes Receives one hash per row or column.
+ */
+static void __guac_common_surface_hash_lines(const unsigned char* buffer, int stride,
+        int x, int y, int width, int height, int rows, uint64_t* hashes) {
+
+    int lx, ly;
+    int count = rows ? height : width;
+
+    for (lx = 0; lx < count; lx++)
+        hashes[lx] = 0xcbf29ce484222325ULL;
+
+    /* 64-bit FNV-1a, with columns hashed a row at a time to read in order.
+     * Pixels are hashed as opaque, as they are stored in the surface. */
+    buffer += y * stride + x * 4;
+    for (ly = 0; ly < height; ly++) {
+
+        const uint32_t* current = (const uint32_t*) buffer;
+
+        if (rows) {
+            uint64_t hash = hashes[ly];
+            for (lx = 0; lx < width; lx++)
+                hash = (hash ^ (current[lx] | 0xFF000000)) * 0x100000001b3ULL;
+            hashes[ly] = hash;
+        }
+        else {
+            for (lx = 0; lx < width; lx++)
+                hashes[lx] = (hashes[lx] ^ (current[lx] | 0xFF000000)) * 0x100000001b3ULL;
+        }
+
+        buffer += stride;
+
+    }
+
+}
+
+/**
+ * Finds the longest run of lines of an update which appear in the surface
+ * shifted by the same distance. Lines which are the same at their own
+ * position are unchanged anyway, so a run only counts if enough of its
+ * lines differ there.
+ *
+ * @param src The hashes of the lines of the update.
+ * @param length The number of lines in the update.
+ * @param dst The hashes of the lines of the surface around the update.
+ * @param dst_length The number of lines hashed in the surface.
+ * @param base The index in dst of the first line of the update.
+ * @param start Receives the index of the first line of the run.
+ * @param count Receives the number of lines in the run.
+ * @return The distance the run moved, from its position in the surface to
+ *         its position in the update, or zero if no run was found.
+ */
+static int __guac_common_surface_find_shift(const uint64_t* src, int length,
+        const uint64_t* dst, int dst_length, int base, int* start, int* count) {
+
+    int best_shift = 0;
+    int best_changed = 0;
+
+    for (int sample = 0; sample < GUAC_SURFACE_MOTION_SAMPLES; sample++) {
+
+        int i = length * (2 * sample + 1) / (2 * GUAC_SURFACE_MOTION_SAMPLES);
+        uint64_t hash = src[i];
+
+        /* Lines like their neighbours, such as a plain background, would
+         * match anywhere, and unchanged lines did not move */
+        if ((i > 0 && src[i - 1] == hash) || (i + 1 < length && src[i + 1] == hash)
+                || dst[base + i] == hash)
+            continue;
+
+        int candidates = 0;
+        for (int k = 0; k < dst_length && candidates < GUAC_SURFACE_MOTION_MAX_CANDIDATES; k++) {
+
+            if (dst[k] != hash)
+                continue;
+
+            candidates++;
+            int shift = k - base - i;
+
+            /* Extend the run in both directions */
+            int first = i;
+            while (first > 0 && base + first - 1 + shift >= 0
+                    && src[first - 1] == dst[base + first - 1 + shift])
+                first--;
+
+            int last = i;
+            while (last + 1 < length && base + last + 1 + shift < dst_length
+                    && src[last + 1] == dst[base + last + 1 + shift])
+                last++;
+
+            /* Only lines that changed in place benefit from the copy */
+            int changed = 0;
+            for (int j = first; j <= last; j++) {
+                if (src[j] != dst[base + j])
+                    changed++;
+            }
+
+            if (changed > best_changed) {
+                best_changed = changed;
+                best_shift = shift;
+                *start = first;
+                *count = last - first + 1;
+            }
+
+        }
+
+    }
+
+    if (best_changed < GUAC_SURFACE_MOTION_MIN_LINES)
+        return 0;
+
+    return best_shift;
+
+}
+
+/**
+ * Compares opaque image data to a rectangle of the given surface.
+ *
+ * @param src_buffer The image data, starting at the first pixel to compare.
+ * @param src_stride The number of bytes in each row of the image data.
+ * @param surface The surface to compare against.
+ * @param rect The rectangle of the surface to compare against.
+ * @return Non-zero if the image data is identical, zero otherwise.
+ */
+static int __guac_common_surface_equals(const unsigned char* src_buffer, int src_stride,
+        guac_common_surface* surface, const guac_common_rect* rect) {
+
+    const unsigned char* dst_buffer = surface->buffer
+        + rect->y * surface->stride + rect->x * 4;
+
+    for (int y = 0; y < rect->height; y++) {
+
+        const uint32_t* src_current = (const uint32_t*) src_buffer;
+        const uint32_t* dst_current = (const uint32_t*) dst_buffer;
+
+        for (int x = 0; x < rect->width; x++) {
+            if ((src_current[x] | 0xFF000000) != (dst_current[x] | 0xFF000000))
+                return 0;
+        }
+
+        src_buffer += src_stride;
+        dst_buffer += surface->stride;
+
+    }
+
+    return 1;
+
+}
+
+/**
+ * Looks for content of an opaque update which is already in the surface at
+ * another position, as happens when scrolling. If a large enough part of
+ * the update moved vertically or horizontally, it is copied within the
+ * surface so that only the rest of the update needs to be sent as an image.
+ *
+ * @param surface The surface being drawn to.
+ * @param src_buffer The image data of the update.
+ * @param src_stride The number of bytes in each row of the image data.
+ * @param sx The X coordinate of the update within the image data.
+ * @param sy The Y coordinate of the update within the image data.
+ * @param rect The destination rectangle of the update, clipped to the
+ *             surface.
+ */
+static void __guac_common_surface_copy_motion(guac_common_surface* surface,
+        const unsigned char* src_buffer, int src_stride, int sx, int sy,
+        const guac_common_rect* rect) {
+
+    if (rect->width * rect->height < GUAC_SURFACE_MOTION_MIN_AREA)
+        return;
+
+    /* Video changes in every frame, there's nothing to find */
+    if (surface->video) {
+        guac_common_rect overlap = *rect;
+        guac_common_rect_constrain(&overlap, &surface->video_rect);
+        if (overlap.width > 0 && overlap.height > 0)
+            return;
+    }
+
+    src_buffer += src_stride * sy + 4 * sx;
+
+    std::vector<uint64_t> src_hashes;
+    std::vector<uint64_t> dst_hashes;
+    int start, count, shift;
+
+    /* Vertical motion, comparing rows to those up to a height away */
+    if (rect->width >= GUAC_SURFACE_MOTION_MIN_LINES
+            && rect->height >= GUAC_SURFACE_MOTION_MIN_LINES) {
+
+        int window_y = std::max(rect->y - rect->height, 0);
+        int window_height = std::min(rect->y + 2 * rect->height, surface->height) - window_y;
+
+        src_hashes.resize(rect->height);
+        dst_hashes.resize(window_height);
+        __guac_common_surface_hash_lines(src_buffer, src_stride, 0, 0,
+                rect->width, rect->height, 1, src_hashes.data());
+        __guac_common_surface_hash_lines(surface->buffer, surface->stride, rect->x, window_y,
+                rect->width, window_height, 1, dst_hashes.data());
+
+        shift = __guac_common_surface_find_shift(src_hashes.data(), rect->height,
+                dst_hashes.data(), window_height, rect->y - window_y, &start, &count);
+
+        if (shift) {
+            guac_common_rect moved;
+            guac_common_rect_init(&moved, rect->x, rect->y + start + shift, rect->width, count);
+            if (__guac_common_surface_equals(src_buffer + start * src_stride, src_stride, surface, &moved)) {
+                guac_common_surface_copy(surface, moved.x, moved.y, moved.width, moved.height,
+                        surface, rect->x, rect->y + start);
+                return;
+            }
+        }
+
+    }
+
+    /* Horizontal motion, comparing columns to those up to a width away */
+    if (rect->width >= GUAC_SURFACE_MOTION_MIN_LINES
+            && rect->height >= GUAC_SURFACE_MOTION_MIN_LINES) {
+
+        int window_x = std::max(rect->x - rect->width, 0);
+        int window_width = std::min(rect->x + 2 * rect->width, surface->width) - window_x;
+
+        src_hashes.resize(rect->width);
+        dst_hashes.resize(window_width);
+        __guac_common_surface_hash_lines(src_buffer, src_stride, 0, 0,
+                rect->width, rect->height, 0, src_hashes.data());
+        __guac_common_surface_hash_lines(surface->buffer, surface->stride, window_x, rect->y,
+                window_width, rect->height, 0, dst_hashes.data());
+
+        shift = __guac_common_surface_find_shift(src_hashes.data(), rect->width,
+                dst_hashes.data(), window_width, rect->x - window_x, &start, &count);
+
+        if (shift) {
+            guac_common_rect moved;
+            guac_common_rect_init(&moved, rect->x + start + shift, rect->y, count, rect->height);
+            if (__guac_common_surface_equals(src_buffer + start * 4, src_stride, surface, &moved))
+                guac_common_surface_copy(surface, moved.x, moved.y, moved.width, moved.height,
+                        surface, rect->x + start, rect->y);
+        }
+
+    }
+
+}
+
 guac_common_surface* guac_common_surface_alloc(GuacSocket& socket, const guac_layer* layer, int w, int h) {
 
     /* Init surface */
@@ -684,6 +1361,7 @@ void guac_common_surface_free(guac_common_surface* surface) {
     if (surface->realized)
         guac_protocol_send_dispose(surface->socket, surface->layer);
 
+    __guac_common_surface_free_tiles(surface);
     free(surface->buffer);
     free(surface);
 
@@ -727,6 +1405,16 @@ void guac_common_surface_resize(guac_common_surface* surface, int w, int h) {
             surface->dirty = 0;
     }
 
+    surface->version++;
+
+    /* Forget any video, its region may no longer exist */
+    surface->video = 0;
+    surface->video_frames = 0;
+
+    /* Rebuild tile grid for new dimensions */
+    if (surface->tiled)
+        __guac_common_surface_alloc_tiles(surface);
+
     /* Update Guacamole layer */
     if (surface->realized)
         guac_protocol_send_size(socket, layer, w, h);
@@ -752,6 +1440,10 @@ void guac_common_surface_draw(guac_common_surface* surface, int x, int y, cairo_
     if (rect.width <= 0 || rect.height <= 0)
         return;
 
+    /* Copy content which moved within the surface, so it isn't drawn again */
+    if (format != CAIRO_FORMAT_ARGB32)
+        __guac_common_surface_copy_motion(surface, buffer, stride, sx, sy, &rect);
+
     /* Update backing surface */
     __guac_common_surface_put(buffer, stride, &sx, &sy, surface, &rect, format != CAIRO_FORMAT_ARGB32);
     if (rect.width <= 0 || rect.height <= 0)
@@ -830,6 +1522,10 @@ void guac_common_surface_copy(guac_common_surface* src, int sx, int sy, int w, i
         guac_protocol_send_copy(socket, src_layer, sx, sy, rect.width, rect.height,
                                 GUAC_COMP_OVER, dst_layer, rect.x, rect.y);
         dst->realized = 1;
+        dst->version++;
+
+        if (dst->tiled)
+            __guac_common_surface_mark_tiles(dst, &rect, 1);
     }
 
     /* Update backing surface last if destination rect can intersect source rect */
@@ -870,6 +1566,10 @@ void guac_common_surface_transfer(guac_common_surface* src, int sx, int sy, int
         guac_common_surface_flush(src);
         guac_protocol_send_transfer(socket, src_layer, sx, sy, rect.width, rect.height, op, dst_layer, rect.x, rect.y);
         dst->realized = 1;
+        dst->version++;
+
+        if (dst->tiled)
+            __guac_common_surface_mark_tiles(dst, &rect, 1);
     }
 
     /* Update backing surface last if destination rect can intersect source rect */
@@ -908,6 +1608,10 @@ void guac_common_surface_rect(guac_common_surface* surface,
         guac_protocol_send_rect(socket, layer, rect.x, rect.y, rect.width, rect.height);
         guac_protocol_send_cfill(socket, GUAC_COMP_OVER, layer, red, green, blue, 0xFF);
         surface->realized = 1;
+        surface->version++;
+
+        if (surface->tiled)
+            __guac_common_surface_mark_tiles(surface, &rect, 1);
     }
 
 }
@@ -931,6 +1635,163 @@ void guac_common_surface_reset_clip(guac_common_surface* surface) {
     surface->clipped = 0;
 }
 
+/**
+ * Returns the area of the intersection of the given rectangles.
+ *
+ * @param a The first rectangle.
+ * @param b The second rectangle.
+ * @return The area shared by both rectangles, in pixels.
+ */
+static int __guac_common_rect_overlap(const guac_common_rect* a, const guac_common_rect* b) {
+
+    guac_common_rect overlap = *a;
+    guac_common_rect_constrain(&overlap, b);
+
+    if (overlap.width <= 0 || overlap.height <= 0)
+        return 0;
+
+    return overlap.width * overlap.height;
+
+}
+
+/**
+ * Updates the video state of the given surface from what was drawn since the
+ * last flush. A region which changes on GUAC_SURFACE_VIDEO_FRAMES consecutive
+ * flushes becomes video. Once it has not changed for
+ * GUAC_SURFACE_VIDEO_STILL_TIME, it is marked dirty so that it will be sent
+ * again with the surface's usual encoding.
+ *
+ * @param surface The surface to update.
+ */
+static void __guac_common_surface_update_video(guac_common_surface* surface) {
+
+    guac_timestamp now = guac_timestamp_current();
+    const guac_common_rect* frame = &surface->frame_rect;
+
+    if (surface->frame_dirty && surface->video_enabled) {
+
+        int area = frame->width * frame->height;
+        int overlap = surface->video_frames ? __guac_common_rect_overlap(frame, &surface->video_rect) : 0;
+
+        if (overlap)
+            surface->video_last_change = now;
+
+        /* Same region if they overlap by at least half of both */
+        if (area >= GUAC_SURFACE_VIDEO_MIN_AREA && overlap * 2 >= area
+                && overlap * 2 >= surface->video_rect.width * surface->video_rect.height) {
+            guac_common_rect_extend(&surface->video_rect, frame);
+            surface->video_frames++;
+        }
+
+        /* Anything else may be the start of new video, unless there is
+         * video already */
+        else if (!surface->video) {
+            surface->video_rect = *frame;
+            surface->video_frames = area >= GUAC_SURFACE_VIDEO_MIN_AREA ? 1 : 0;
+        }
+
+        if (surface->video_frames >= GUAC_SURFACE_VIDEO_FRAMES)
+            surface->video = 1;
+
+    }
+
+    /* Send the last frame of video again once it has gone still */
+    if (surface->video && (!surface->video_enabled
+            || now - surface->video_last_change >= GUAC_SURFACE_VIDEO_STILL_TIME)) {
+
+        surface->video = 0;
+        surface->video_frames = 0;
+
+        guac_common_rect rect = surface->video_rect;
+        __guac_common_bound_rect(surface, &rect, NULL, NULL);
+
+        if (rect.width > 0 && rect.height > 0) {
+            if (surface->tiled)
+                __guac_common_surface_mark_tiles(surface, &rect, 1);
+            __guac_common_mark_dirty(surface, &rect);
+        }
+
+    }
+
+}
+
+/**
+ * Returns how an image of the given rectangle of the given surface should be
+ * encoded. Images which are mostly video are sent lossily at the video
+ * quality.
+ *
+ * @param surface The surface the image is from.
+ * @param rect The rectangle of the surface within the image.
+ * @param quality Set to the quality to encode the image at.
+ * @return The encoding to use for the image.
+ */
+static guac_image_encoding __guac_common_surface_image_encoding(guac_common_surface* surface,
+        const guac_common_rect* rect, int* quality) {
+
+    if (surface->video && __guac_common_rect_overlap(rect, &surface->video_rect) * 2 >= rect->width * rect->height) {
+        *quality = surface->video_quality;
+        return GUAC_IMAGE_WEBP;
+    }
+
+    *quality = -1;
+    return surface->encoding;
+
+}
+
+/**
+ * Sends the given rectangle of the surface as filled rectangles if it is
+ * made of at most GUAC_SURFACE_MAX_SOLID_RECTS bands of rows which are each
+ * a single color, such as a cleared window or a plain background. Each row
+ * is scanned only until its first differing pixel, so rectangles that are
+ * not solid are rejected quickly.
+ *
+ * @param surface The surface to flush.
+ * @param rect The rectangle to send.
+ * @return Non-zero if the rectangle was sent, zero if it must be sent as an
+ *         image.
+ */
+static int __guac_common_surface_flush_solid(guac_common_surface* surface,
+        const guac_common_rect* rect) {
+
+    guac_common_rect bands[GUAC_SURFACE_MAX_SOLID_RECTS];
+    uint32_t colors[GUAC_SURFACE_MAX_SOLID_RECTS];
+    int band_count = 0;
+
+    int y;
+
+    unsigned char* row = surface->buffer + rect->y * surface->stride + rect->x * 4;
+    for (y = 0; y < rect->height; y++) {
+
+        uint32_t color = *((uint32_t*) row);
+        if (!__guac_common_surface_solid_row_best((uint32_t*) row, rect->width, color))
+            return 0;
+
+        /* Extend the current band, or start another */
+        if (band_count > 0 && colors[band_count - 1] == color)
+            bands[band_count - 1].height++;
+        else {
+            if (band_count == GUAC_SURFACE_MAX_SOLID_RECTS)
+                return 0;
+            guac_common_rect_init(&bands[band_count], rect->x, rect->y + y, rect->width, 1);
+            colors[band_count++] = color;
+        }
+
+        row += surface->stride;
+
+    }
+
+    for (int i = 0; i < band_count; i++) {
+        guac_protocol_send_rect(surface->socket, surface->layer,
+                bands[i].x, bands[i].y, bands[i].width, bands[i].height);
+        guac_protocol_send_cfill(surface->socket, GUAC_COMP_OVER, surface->layer,
+                (colors[i] >> 16) & 0xFF, (colors[i] >> 8) & 0xFF, colors[i] & 0xFF, 0xFF);
+    }
+
+    surface->realized = 1;
+    return 1;
+
+}
+
 /**
  * Flushes the PNG update currently described by the dirty rectangle within the
  * given surface directly to a "png" instruction, which is sent on the socket
@@ -945,6 +1806,12 @@ static void __guac_common_surface_flush_to_png(guac_common_surface* surface) {
         GuacSocket& socket = surface->socket;
         const guac_layer* layer = surface->layer;
 
+        /* Fill solid color rather than encoding it */
+        if (__guac_common_surface_flush_solid(surface, &surface->dirty_rect)) {
+            surface->dirty = 0;
+            return;
+        }
+
         /* Get Cairo surface for specified rect */
         unsigned char* buffer = surface->buffer + surface->dirty_rect.y * surface->stride + surface->dirty_rect.x * 4;
         cairo_surface_t* rect = cairo_image_surface_create_for_data(buffer, CAIRO_FORMAT_RGB24,
@@ -952,8 +1819,11 @@ static void __guac_common_surface_flush_to_png(guac_common_surface* surface) {
                                                                     surface->dirty_rect.height,
                                                                     surface->stride);
 
-        /* Send PNG for rect */
-        guac_protocol_send_png(socket, GUAC_COMP_OVER, layer, surface->dirty_rect.x, surface->dirty_rect.y, rect);
+        /* Send image for rect */
+        int quality;
+        guac_image_encoding encoding = __guac_common_surface_image_encoding(surface, &surface->dirty_rect, &quality);
+        guac_protocol_send_image(socket, GUAC_COMP_OVER, layer, surface->dirty_rect.x, surface->dirty_rect.y, rect,
+                                 encoding, quality);
         cairo_surface_destroy(rect);
         surface->realized = 1;
 
@@ -987,6 +1857,212 @@ static int __guac_common_surface_png_rect_compare(const void* a, const void* b)
 
 }
 
+/**
+ * Hashes the current contents of the given rectangle of the given surface.
+ * The result is never zero, as zero denotes unknown contents.
+ *
+ * @param surface The surface to read from.
+ * @param rect The rectangle to hash.
+ * @return A non-zero hash of the contents of the rectangle.
+ */
+static uint64_t __guac_common_surface_hash_rect(guac_common_surface* surface,
+        const guac_common_rect* rect) {
+
+    int x, y;
+
+    /* 64-bit FNV-1a, consuming one pixel at a time */
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    unsigned char* row = surface->buffer + rect->y * surface->stride + rect->x * 4;
+    for (y = 0; y < rect->height; y++) {
+
+        uint32_t* current = (uint32_t*) row;
+        for (x = 0; x < rect->width; x++)
+            hash = (hash ^ current[x]) * 0x100000001b3ULL;
+
+        row += surface->stride;
+
+    }
+
+    return hash != 0 ? hash : 1;
+
+}
+
+/**
+ * Flushes a surface which uses tiled change tracking. Each dirty tile is
+ * hashed, and runs of horizontally adjacent tiles whose contents changed are
+ * encoded as PNG in parallel, then sent in order. Runs of solid color are
+ * filled instead.
+ *
+ * @param surface The surface to flush.
+ */
+static void __guac_common_surface_flush_tiles(guac_common_surface* surface) {
+
+    GuacSocket& socket = surface->socket;
+    std::vector<guac_common_rect> updates;
+
+    int tx, ty;
+
+    for (ty = 0; ty < surface->tiles_y; ty++) {
+
+        int run_start = -1;
+
+        /* One column past the end so the final run is always closed */
+        for (tx = 0; tx <= surface->tiles_x; tx++) {
+
+            int changed = 0;
+
+            if (tx < surface->tiles_x) {
+
+                int index = ty * surface->tiles_x + tx;
+                if (surface->tile_dirty[index]) {
+
+                    guac_common_rect tile;
+                    guac_common_rect_init(&tile, tx * GUAC_SURFACE_TILE_SIZE, ty * GUAC_SURFACE_TILE_SIZE,
+                                          GUAC_SURFACE_TILE_SIZE, GUAC_SURFACE_TILE_SIZE);
+                    __guac_common_bound_rect(surface, &tile, NULL, NULL);
+
+                    /* Skip tiles which were redrawn with identical contents */
+                    uint64_t hash = __guac_common_surface_hash_rect(surface, &tile);
+                    if (hash != surface->tile_hashes[index]) {
+                        surface->tile_hashes[index] = hash;
+                        changed = 1;
+                    }
+
+                    surface->tile_dirty[index] = 0;
+
+                }
+
+            }
+
+            if (changed && run_start < 0)
+                run_start = tx;
+
+            else if (!changed && run_start >= 0) {
+
+                guac_common_rect run;
+                guac_common_rect_init(&run, run_start * GUAC_SURFACE_TILE_SIZE, ty * GUAC_SURFACE_TILE_SIZE,
+                                      (tx - run_start) * GUAC_SURFACE_TILE_SIZE, GUAC_SURFACE_TILE_SIZE);
+                __guac_common_bound_rect(surface, &run, NULL, NULL);
+                updates.push_back(run);
+
+                run_start = -1;
+
+            }
+
+        }
+
+    }
+
+    /* Tiles replace the dirty rect and PNG queue entirely */
+    surface->dirty = 0;
+    surface->png_queue_length = 0;
+
+    /* Runs of solid color are filled rather than encoded */
+    size_t images = 0;
+    for (size_t i = 0; i < updates.size(); i++) {
+        if (!__guac_common_surface_flush_solid(surface, &updates[i]))
+            updates[images++] = updates[i];
+    }
+    updates.resize(images);
+
+    if (updates.empty())
+        return;
+
+    auto create_image = [surface, &updates](size_t i) {
+
+        const guac_common_rect& rect = updates[i];
+
+        unsigned char* buffer = surface->buffer + rect.y * surface->stride + rect.x * 4;
+        return cairo_image_surface_create_for_data(buffer, CAIRO_FORMAT_RGB24,
+                                                   rect.width, rect.height,
+                                                   surface->stride);
+
+    };
+
+    /* Choose the encoding of each run up front, as video may overlap some */
+    std::vector<guac_image_encoding> encodings(updates.size());
+    std::vector<int> qualities(updates.size());
+    for (size_t i = 0; i < updates.size(); i++)
+        encodings[i] = __guac_common_surface_image_encoding(surface, &updates[i], &qualities[i]);
+
+    /* Sockets which encode images themselves get every run as is */
+    cairo_surface_t* first = create_image(0);
+    int deferred = socket.DeferImage(GUAC_COMP_OVER, surface->layer, updates[0].x, updates[0].y, first,
+                                     encodings[0], qualities[0]);
+    cairo_surface_destroy(first);
+
+    if (deferred) {
+        for (size_t i = 1; i < updates.size(); i++) {
+            cairo_surface_t* image = create_image(i);
+            guac_protocol_send_image(socket, GUAC_COMP_OVER, surface->layer, updates[i].x, updates[i].y, image,
+                                     encodings[i], qualities[i]);
+            cairo_surface_destroy(image);
+        }
+        surface->realized = 1;
+        return;
+    }
+
+    /* Otherwise encode each run into its own buffer */
+    std::vector<GuacBufferSocket> encoded(updates.size());
+    auto encode = [surface, &updates, &encoded, &encodings, &qualities, &create_image](size_t i) {
+
+        const guac_common_rect& rect = updates[i];
+        cairo_surface_t* image = create_image(i);
+
+        guac_protocol_send_image(encoded[i], GUAC_COMP_OVER, surface->layer, rect.x, rect.y, image,
+                                 encodings[i], qualities[i]);
+        cairo_surface_destroy(image);
+
+    };
+
+    /* The first run is encoded on this thread while the pool handles the rest */
+    std::vector<std::future<void>> pending;
+    for (size_t i = 1; i < updates.size(); i++) {
+        std::packaged_task<void()> task(std::bind(encode, i));
+        pending.push_back(task.get_future());
+        boost::asio::post(GetEncoderPool(), std::move(task));
+    }
+
+    encode(0);
+    for (std::future<void>& result : pending)
+        result.get();
+
+    /* Send in order, each buffer holding exactly one instruction */
+    for (GuacBufferSocket& update : encoded) {
+        socket.InstructionBegin();
+        socket.Write(update.buffer_.Data(), update.buffer_.Size());
+        socket.InstructionEnd();
+    }
+
+    surface->realized = 1;
+
+}
+
+void guac_common_surface_set_tiled(guac_common_surface* surface, int tiled) {
+
+    /* Nothing to do if mode is unchanged */
+    if (surface->tiled == tiled)
+        return;
+
+    /* Send pending updates using the current mode */
+    guac_common_surface_flush(surface);
+
+    surface->tiled = tiled;
+    if (tiled)
+        __guac_common_surface_alloc_tiles(surface);
+    else
+        __guac_common_surface_free_tiles(surface);
+
+}
+
+void guac_common_surface_set_video(guac_common_surface* surface, int enabled, int quality) {
+
+    surface->video_enabled = enabled;
+    surface->video_quality = quality;
+
+}
+
 void guac_common_surface_flush(guac_common_surface* surface) {
 
     guac_common_surface_png_rect* current = surface->png_queue;
@@ -995,6 +2071,14 @@ void guac_common_surface_flush(guac_common_surface* surface) {
     int original_queue_length;
     int flushed = 0;
 
+    __guac_common_surface_update_video(surface);
+    surface->frame_dirty = 0;
+
+    if (surface->tiled) {
+        __guac_common_surface_flush_tiles(surface);
+        return;
+    }
+
     /* Flush final dirty rect to queue */
     __guac_common_surface_flush_to_queue(surface);
     original_queue_length = surface->png_queue_length;
@@ -1052,8 +2136,9 @@ void guac_common_surface_flush(guac_common_surface* surface) {
 
     }
 
-    /* Flush complete */
+    /* Flush complete, rects combined above were not new drawing */
     surface->png_queue_length = 0;
+    surface->frame_dirty = 0;
 
 }
 
@@ -1071,8 +2156,8 @@ void guac_common_surface_dup(guac_common_surface* surface, GuacSocket& socket) {
             surface->buffer, CAIRO_FORMAT_RGB24,
             surface->width, surface->height, surface->stride);
 
-    /* Send PNG for rect */
-    guac_protocol_send_png(socket, GUAC_COMP_OVER, surface->layer, 0, 0, rect);
+    /* Send image for rect */
+    guac_protocol_send_image(socket, GUAC_COMP_OVER, surface->layer, 0, 0, rect, surface->encoding, -1);
     cairo_surface_destroy(rect);
 
 }
@@ -30,6 +30,7 @@
 #include <guacamole/layer.h>
 #include <guacamole/protocol.h>
 #include <guacamole/socket.h>
+#include <guacamole/timestamp.h>
 
 /**
  * The maximum number of updates to allow within the PNG queue.
@@ -66,6 +67,19 @@ typedef struct guac_common_surface {
 		width(width),
 		height(height),
 		dirty(dirty),
+		version(0),
+		encoding(GUAC_IMAGE_PNG),
+		frame_dirty(0),
+		video_enabled(0),
+		video(0),
+		video_frames(0),
+		video_last_change(0),
+		video_quality(-1),
+		tiled(0),
+		tiles_x(0),
+		tiles_y(0),
+		tile_hashes(NULL),
+		tile_dirty(NULL),
 		png_queue_length(png_queue_length)
 	{
 	}
@@ -110,6 +124,60 @@ typedef struct guac_common_surface {
      */
     guac_common_rect dirty_rect;
 
+    /**
+     * Incremented whenever the contents or size of this surface change, so
+     * that anything derived from the whole surface can tell when it is stale.
+     */
+    unsigned int version;
+
+    /**
+     * The format images of this surface are encoded as when flushed.
+     */
+    guac_image_encoding encoding;
+
+    /**
+     * Non-zero if the surface has been drawn to since the last flush.
+     */
+    int frame_dirty;
+
+    /**
+     * The bounds of everything drawn to the surface since the last flush.
+     */
+    guac_common_rect frame_rect;
+
+    /**
+     * Non-zero if regions which keep changing, such as video, may be sent
+     * lossily.
+     */
+    int video_enabled;
+
+    /**
+     * Non-zero if images within video_rect are currently being sent
+     * lossily.
+     */
+    int video;
+
+    /**
+     * The region which has been changing on consecutive flushes.
+     */
+    guac_common_rect video_rect;
+
+    /**
+     * The number of consecutive flushes in which video_rect has changed.
+     */
+    int video_frames;
+
+    /**
+     * The time video_rect last changed.
+     */
+    guac_timestamp video_last_change;
+
+    /**
+     * The quality images within video_rect are sent at (0-100), or -1 for
+     * the default quality.
+     */
+    int video_quality;
+
     /**
      * Whether the surface actually exists on the client.
      */
@@ -126,6 +194,34 @@ typedef struct guac_common_surface {
      */
     guac_common_rect clip_rect;
 
+    /**
+     * Non-zero if changes are tracked as a grid of fixed-size tiles, with
+     * only tiles whose contents actually changed being sent when flushed,
+     * zero if the dirty rectangle and PNG queue are used instead.
+     */
+    int tiled;
+
+    /**
+     * The number of columns of tiles covering this surface.
+     */
+    int tiles_x;
+
+    /**
+     * The number of rows of tiles covering this surface.
+     */
+    int tiles_y;
+
+    /**
+     * The hash of the contents of each tile as last sent to the client, in
+     * row-major order. Zero if the contents on the client are unknown.
+     */
+    uint64_t* tile_hashes;
+
+    /**
+     * Non-zero for each tile which has been drawn to since the last flush.
+     */
+    unsigned char* tile_dirty;
+
     /**
      * The number of updates in the PNG queue.
      */
@@ -167,7 +263,34 @@ void guac_common_surface_free(guac_common_surface* surface);
 void guac_common_surface_resize(guac_common_surface* surface, int w, int h);
 
 /**
- * Draws the given data to the given guac_common_surface.
+ * Enables or disables tiled change tracking for the given surface. While
+ * enabled, a flush hashes each tile that was drawn to and sends only the
+ * tiles whose contents differ from what was last sent, encoding them in
+ * parallel. Any pending updates are flushed before the mode changes.
+ *
+ * @param surface The surface to modify.
+ * @param tiled Non-zero to enable tiled change tracking, zero to disable it.
+ */
+void guac_common_surface_set_tiled(guac_common_surface* surface, int tiled);
+
+/**
+ * Enables or disables video detection for the given surface. While enabled,
+ * a region which changes on several consecutive flushes is sent lossily at
+ * the given quality, whatever the surface's encoding. Once the region has
+ * been still for a while it is sent again using the surface's encoding.
+ *
+ * @param surface The surface to modify.
+ * @param enabled Non-zero to enable video detection, zero to disable it.
+ * @param quality The quality to send video at (0-100), or -1 for the default
+ *                quality.
+ */
+void guac_common_surface_set_video(guac_common_surface* surface, int enabled, int quality);
+
+/**
+ * Draws the given data to the given guac_common_surface. If part of opaque
+ * data is already in the surface shifted vertically or horizontally, as
+ * after scrolling, that part is copied within the surface instead of being
+ * sent again as an image.
  *
  * @param surface The surface to draw to.
  * @param x The X coordinate of the draw location.
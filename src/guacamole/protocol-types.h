@@ -244,5 +244,16 @@ typedef enum guac_line_join_style {
     GUAC_LINE_JOIN_ROUND = 0x2
 } guac_line_join_style;
 
+/**
+ * The formats screen images may be encoded as. Only the screen layer is
+ * ever encoded lossily, all other layers are always sent as PNG.
+ */
+typedef enum guac_image_encoding {
+    GUAC_IMAGE_PNG      = 0x0,
+    GUAC_IMAGE_JPEG     = 0x1,
+    GUAC_IMAGE_WEBP     = 0x2,
+    GUAC_IMAGE_ADAPTIVE = 0x3 /* Chosen per image from its contents */
+} guac_image_encoding;
+
 #endif
 
@@ -31,11 +31,9 @@
 #include "unicode.h"
 
 
-#ifdef USE_JPEG
 extern "C" {
 	#include <cairo_jpg.h>
 }
-#else
 
 #ifdef __cplusplus
 extern "C" {
@@ -50,8 +48,11 @@ extern "C" {
 	#include <pngstruct.h>
 #endif
 
+#ifdef USE_WEBP
+	#include <webp/encode.h>
 #endif
 
+#include <charconv>
 #include <inttypes.h>
 #include <setjmp.h>
 #include <stdarg.h>
@@ -61,9 +62,8 @@ extern "C" {
 #include <string.h>
 #include <sys/types.h>
 
-#ifdef USE_JPEG
 /**
- * JPEG compression quality
+ * JPEG and lossy WebP compression quality
  *
  * Lower values will produce images quicker,
  * but the image quality will be reduced significantly.
@@ -80,7 +80,6 @@ void SetJPEGQuality(uint8_t quality)
 		JPEG_COMPRESSION_QUALITY = quality;
 	return;
 }
-#endif
 
 /* Output formatting functions */
 // TODO: Move into GuacSocket
@@ -94,9 +93,13 @@ size_t __guac_socket_write_length_string(GuacSocket& socket, const char* str)
 
 size_t __guac_socket_write_length_int(GuacSocket& socket, int64_t i)
 {
-    char buffer[128];
-    snprintf(buffer, sizeof(buffer), "%" PRIi64, i);
-    return __guac_socket_write_length_string(socket, buffer);
+    /* Digits are always ASCII, so the element length is the byte length */
+    char buffer[24];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), i);
+    return
+           socket.WriteInt(result.ptr - buffer)
+        || socket.WriteString(".")
+        || socket.Write(buffer, result.ptr - buffer);
 }
 
 size_t __guac_socket_write_length_double(GuacSocket& socket, double d)
@@ -190,15 +193,14 @@ int __guac_socket_write_length_png_cairo(GuacSocket& socket, cairo_surface_t* su
     return 0;
 }
 
-#ifdef USE_JPEG
-int __guac_socket_write_length_jpeg(GuacSocket& socket, cairo_surface_t* surface)
+int __guac_socket_write_length_jpeg(GuacSocket& socket, cairo_surface_t* surface, int quality)
 {
     __guac_socket_write_png_data png_data(socket, 8192, 0);
     int base64_length;
 
 	// Write JPEG surface
 	cairo_status_t status;
-    if ((status = cairo_image_surface_write_to_jpeg_stream(surface, __guac_socket_write_png_cairo, &png_data, JPEG_COMPRESSION_QUALITY)) != CAIRO_STATUS_SUCCESS)
+    if ((status = cairo_image_surface_write_to_jpeg_stream(surface, __guac_socket_write_png_cairo, &png_data, quality)) != CAIRO_STATUS_SUCCESS)
 	{
 		const char* status_str = cairo_status_to_string(status);
 	        guac_error = GUAC_STATUS_INTERNAL_ERROR;
@@ -220,9 +222,141 @@ int __guac_socket_write_length_jpeg(GuacSocket& socket, cairo_surface_t* surface
     free(png_data.buffer);
     return 0;
 }
+
+#ifdef USE_WEBP
+int __guac_socket_write_length_webp(GuacSocket& socket, cairo_surface_t* surface, int lossless, int quality)
+{
+    WebPConfig config;
+    WebPPicture picture;
+    WebPMemoryWriter writer;
+
+    int width = cairo_image_surface_get_width(surface);
+    int height = cairo_image_surface_get_height(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    unsigned char* data = cairo_image_surface_get_data(surface);
+
+    /* Favour speed, screen contents rarely stay around for long */
+    if (lossless) {
+        if (!WebPConfigLosslessPreset(&config, 0))
+            return -1;
+    }
+    else {
+        if (!WebPConfigInit(&config))
+            return -1;
+        config.quality = quality;
+        config.method = 2;
+    }
+
+    if (!WebPPictureInit(&picture))
+        return -1;
+
+    picture.use_argb = lossless;
+    picture.width = width;
+    picture.height = height;
+
+    /* Cairo RGB24 is BGRX in memory on little-endian machines */
+    cairo_surface_flush(surface);
+    if (!WebPPictureImportBGRX(&picture, data, stride)) {
+        /* The import may have allocated before it failed */
+        WebPPictureFree(&picture);
+        guac_error = GUAC_STATUS_NO_MEMORY;
+        guac_error_message = "libwebp failed to import image";
+        return -1;
+    }
+
+    WebPMemoryWriterInit(&writer);
+    picture.writer = WebPMemoryWrite;
+    picture.custom_ptr = &writer;
+
+    int encoded = WebPEncode(&config, &picture);
+    WebPPictureFree(&picture);
+
+    if (!encoded) {
+        WebPMemoryWriterClear(&writer);
+        guac_error = GUAC_STATUS_INTERNAL_ERROR;
+        guac_error_message = "libwebp encoding failed";
+        return -1;
+    }
+
+    int base64_length = (writer.size + 2) / 3 * 4;
+
+    /* Write length and data */
+    int ret_val =
+           socket.WriteInt(base64_length)
+        || socket.WriteString(".")
+        || socket.WriteBase64(writer.mem, writer.size)
+        || socket.FlushBase64();
+
+    WebPMemoryWriterClear(&writer);
+    return ret_val ? -1 : 0;
+}
 #endif
 
-#ifndef USE_JPEG
+/**
+ * The smallest image, in pixels, which may be encoded lossily when the
+ * encoding is chosen per image. Smaller images are mostly text and UI
+ * elements, where lossy artifacts are most visible and savings are small.
+ */
+#define GUAC_IMAGE_ADAPTIVE_MIN_LOSSY_AREA 4096
+
+/**
+ * The number of distinct colors among the sampled pixels of an image above
+ * which it is considered photographic and encoded lossily.
+ */
+#define GUAC_IMAGE_ADAPTIVE_MAX_COLORS 64
+
+/**
+ * Guesses whether the given RGB24 image is photographic from a sample of its
+ * pixels. Images with few colors compress well losslessly, while images with
+ * many colors are likely photos or video and are better encoded lossily.
+ *
+ * @param surface The image to inspect.
+ * @return Non-zero if the image should be encoded lossily, zero otherwise.
+ */
+static int __guac_protocol_is_photographic(cairo_surface_t* surface)
+{
+    int width = cairo_image_surface_get_width(surface);
+    int height = cairo_image_surface_get_height(surface);
+    int stride = cairo_image_surface_get_stride(surface);
+    const unsigned char* data = cairo_image_surface_get_data(surface);
+
+    if (width * height < GUAC_IMAGE_ADAPTIVE_MIN_LOSSY_AREA)
+        return 0;
+
+    /* Sample a grid of at most 32x32 pixels */
+    int step_x = width > 32 ? width / 32 : 1;
+    int step_y = height > 32 ? height / 32 : 1;
+
+    /* Open-addressed set of the colors seen so far. Colors are stored with
+     * their top byte set so that zero marks a free slot. */
+    uint32_t colors[GUAC_IMAGE_ADAPTIVE_MAX_COLORS * 2] = {};
+    int count = 0;
+
+    for (int y = 0; y < height; y += step_y) {
+
+        const uint32_t* row = (const uint32_t*) (data + y * stride);
+
+        for (int x = 0; x < width; x += step_x) {
+
+            uint32_t color = row[x] | 0xFF000000;
+            unsigned int slot = (color * 2654435761u) >> 25;
+
+            while (colors[slot] && colors[slot] != color)
+                slot = (slot + 1) % (GUAC_IMAGE_ADAPTIVE_MAX_COLORS * 2);
+
+            if (!colors[slot]) {
+                if (++count > GUAC_IMAGE_ADAPTIVE_MAX_COLORS)
+                    return 1;
+                colors[slot] = color;
+            }
+
+        }
+
+    }
+
+    return 0;
+}
+
 void __guac_socket_write_png(png_structp png,
         png_bytep data, png_size_t length)
 {
@@ -398,7 +532,6 @@ int __guac_socket_write_length_png(GuacSocket& socket, cairo_surface_t* surface)
 	free(png_data.buffer);
 	return 0;
 }
-#endif
 
 /* Protocol functions */
 
@@ -1038,56 +1171,74 @@ int guac_protocol_send_pipe(GuacSocket& socket, const guac_stream* stream,
 
 int guac_protocol_send_png(GuacSocket& socket, guac_composite_mode mode,
         const guac_layer* layer, int x, int y, cairo_surface_t* surface)
+{
+    return guac_protocol_send_image(socket, mode, layer, x, y, surface, GUAC_IMAGE_PNG, -1);
+}
+
+int guac_protocol_send_image(GuacSocket& socket, guac_composite_mode mode,
+        const guac_layer* layer, int x, int y, cairo_surface_t* surface,
+        guac_image_encoding encoding, int quality)
 {
     int ret_val;
-    socket.InstructionBegin();
-	
-#ifdef USE_JPEG
-	// Force PNG for any layer that is not the screen
-	if (layer->index != 0) {
-		ret_val =
-			socket.WriteString("3.png,")
-			|| __guac_socket_write_length_int(socket, mode)
-			|| socket.WriteString(",")
-			|| __guac_socket_write_length_int(socket, layer->index)
-			|| socket.WriteString(",")
-			|| __guac_socket_write_length_int(socket, x)
-			|| socket.WriteString(",")
-			|| __guac_socket_write_length_int(socket, y)
-			|| socket.WriteString(",")
-			// We use the Cairo fallback function for forcing png as the internal protocol function
-			// to use libpng natively will not be compiled into builds that use JPEG compression support.
-			|| __guac_socket_write_length_png_cairo(socket, surface)
-			|| socket.WriteString(";");
-	} else {
-		// Screen layer
-		ret_val =
-			socket.WriteString("3.png,")
-			|| __guac_socket_write_length_int(socket, mode)
-			|| socket.WriteString(",")
-			|| __guac_socket_write_length_int(socket, layer->index)
-			|| socket.WriteString(",")
-			|| __guac_socket_write_length_int(socket, x)
-			|| socket.WriteString(",")
-			|| __guac_socket_write_length_int(socket, y)
-			|| socket.WriteString(",")
-			|| __guac_socket_write_length_jpeg(socket, surface)
-			|| socket.WriteString(";");
-	}
+
+    /* Let sockets which encode images elsewhere take the image */
+    if (socket.DeferImage(mode, layer, x, y, surface, encoding, quality))
+        return 0;
+
+    if (quality < 0 || quality > 100)
+        quality = JPEG_COMPRESSION_QUALITY;
+
+    /* Only the opaque screen layer may be encoded lossily */
+    if (layer->index != 0 || cairo_image_surface_get_format(surface) != CAIRO_FORMAT_RGB24)
+        encoding = GUAC_IMAGE_PNG;
+
+    /* Whether WebP images are encoded losslessly */
+    int lossless = 0;
+    if (encoding == GUAC_IMAGE_ADAPTIVE) {
+        lossless = !__guac_protocol_is_photographic(surface);
+#ifdef USE_WEBP
+        encoding = GUAC_IMAGE_WEBP;
 #else
-	ret_val =
-			socket.WriteString("3.png,")
-			|| __guac_socket_write_length_int(socket, mode)
-			|| socket.WriteString(",")
-			|| __guac_socket_write_length_int(socket, layer->index)
-			|| socket.WriteString(",")
-			|| __guac_socket_write_length_int(socket, x)
-			|| socket.WriteString(",")
-			|| __guac_socket_write_length_int(socket, y)
-			|| socket.WriteString(",")
-			|| __guac_socket_write_length_png(socket, surface)
-			|| socket.WriteString(";");
+        encoding = lossless ? GUAC_IMAGE_PNG : GUAC_IMAGE_JPEG;
 #endif
+    }
+
+#ifndef USE_WEBP
+    if (encoding == GUAC_IMAGE_WEBP)
+        encoding = GUAC_IMAGE_JPEG;
+#endif
+
+    socket.InstructionBegin();
+
+    ret_val =
+           socket.WriteString("3.png,")
+        || __guac_socket_write_length_int(socket, mode)
+        || socket.WriteString(",")
+        || __guac_socket_write_length_int(socket, layer->index)
+        || socket.WriteString(",")
+        || __guac_socket_write_length_int(socket, x)
+        || socket.WriteString(",")
+        || __guac_socket_write_length_int(socket, y)
+        || socket.WriteString(",");
+
+    if (!ret_val) {
+        switch (encoding) {
+            case GUAC_IMAGE_JPEG:
+                ret_val = __guac_socket_write_length_jpeg(socket, surface, quality);
+                break;
+#ifdef USE_WEBP
+            case GUAC_IMAGE_WEBP:
+                ret_val = __guac_socket_write_length_webp(socket, surface, lossless, quality);
+                break;
+#endif
+            default:
+                ret_val = __guac_socket_write_length_png(socket, surface);
+                break;
+        }
+    }
+
+    ret_val = ret_val || socket.WriteString(";");
+
     socket.InstructionEnd();
     return ret_val;
 }
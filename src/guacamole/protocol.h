@@ -41,14 +41,12 @@
 #include <cairo/cairo.h>
 #include <stdarg.h>
 
-#ifdef USE_JPEG
 /**
- * Sets the JPEG quality used to the specified value.
+ * Sets the quality used for JPEG and lossy WebP images to the specified value.
  *
  * @param quality The JPEG quality to use (0-100).
  */
 void SetJPEGQuality(uint8_t quality);
-#endif
 
 /* CONTROL INSTRUCTIONS */
 
@@ -551,6 +549,31 @@ int guac_protocol_send_lstroke(GuacSocket& socket,
 int guac_protocol_send_png(GuacSocket& socket, guac_composite_mode mode,
         const guac_layer* layer, int x, int y, cairo_surface_t* surface);
 
+/**
+ * Sends a png instruction over the given guac_socket connection, with the
+ * image encoded in the given format. Browsers detect the format from the
+ * image data itself, so the instruction is the same whatever the format.
+ * Images which are not of the default layer, or which have an alpha
+ * channel, are always sent as PNG.
+ *
+ * If an error occurs sending the instruction, a non-zero value is
+ * returned, and guac_error is set appropriately.
+ *
+ * @param socket The guac_socket connection to use.
+ * @param mode The composite mode to use.
+ * @param layer The destination layer.
+ * @param x The destination X coordinate.
+ * @param y The destination Y coordinate.
+ * @param surface A cairo surface containing the image data to send.
+ * @param encoding The format to encode the image as.
+ * @param quality The quality of lossy images (0-100), or -1 to use the
+ *                quality set with SetJPEGQuality().
+ * @return Zero on success, non-zero on error.
+ */
+int guac_protocol_send_image(GuacSocket& socket, guac_composite_mode mode,
+        const guac_layer* layer, int x, int y, cairo_surface_t* surface,
+        guac_image_encoding encoding, int quality);
+
 /**
  * Sends a pop instruction over the given guac_socket connection.
  *
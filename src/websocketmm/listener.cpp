@@ -1,5 +1,6 @@
 #include <websocketmm/listener.h>
 #include <websocketmm/server.h>
+#include <websocketmm/static_files.h>
 #include <websocketmm/websocket_user.h>
 
 #include <utility>
@@ -7,7 +8,7 @@
 namespace websocketmm {
 
 	// TODO: Move this to a seperate file, and make it work with POSTs
-	// (so we can get the agent to work???) and serve files statically
+	// (so we can get the agent to work???)
 
 	struct session : public std::enable_shared_from_this<session> {
 		beast::tcp_stream stream_;
@@ -15,6 +16,10 @@ namespace websocketmm {
 		http::request<http::string_body> req_;
 		const std::shared_ptr<server>& server_;
 
+		// The response being written, and the cached file it refers to
+		static_files::response_type res_;
+		std::shared_ptr<const static_file> file_;
+
 		explicit session(tcp::socket&& socket, const std::shared_ptr<server>& server)
 			: stream_(std::move(socket)),
 			  server_(server) {
@@ -49,27 +54,34 @@ namespace websocketmm {
 			if(ec == http::error::end_of_stream)
 				return do_close();
 
+			if(ec)
+				return;
+
 			// Spawn a websocket connection,
-			// or close
+			// or serve a file from the document root
 			if(websocket::is_upgrade(req_)) {
 				std::make_shared<websocket_user>(server_, std::move(stream_.release_socket()))->run(req_);
+			} else if(server_->static_files_) {
+				res_ = server_->static_files_->handle_request(req_, file_);
+
+				// Give slow clients longer to download the file
+				stream_.expires_after(std::chrono::seconds(30));
+				http::async_write(stream_, res_,
+								  beast::bind_front_handler(
+								  &session::on_write,
+								  shared_from_this(),
+								  res_.need_eof()));
 			} else {
-				// TODO: process request in this case, for either static server or POST callback
+				// TODO: process request in this case, for POST callback
 				return do_close();
 			}
-
-			//if(ec)
-			//   return fail(ec, "read");
-
-			// Send the response
-			//handle_request(*doc_root_, std::move(req_), lambda_);
 		}
 
 		void on_write(bool close, beast::error_code ec, std::size_t bytes_transferred) {
 			boost::ignore_unused(bytes_transferred);
 
-			//if(ec)
-			//   return fail(ec, "write");
+			if(ec)
+				return;
 
 			if(close) {
 				// This means we should close the connection, usually because
@@ -77,8 +89,9 @@ namespace websocketmm {
 				return do_close();
 			}
 
-			// We're done with the response so delete it
-			//res_ = nullptr;
+			// We're done with the response so let go of the file
+			res_ = {};
+			file_.reset();
 
 			// Read another request
 			do_read();
@@ -96,7 +109,7 @@ namespace websocketmm {
 
 	listener::listener(net::io_context& ioc, tcp::endpoint ep, const std::shared_ptr<server>& server)
 		: ioc_(ioc),
-		  acceptor_(ioc),
+		  acceptor_(net::make_strand(ioc)),
 		  endpoint(std::move(ep)),
 		  server_(server) {
 	}
@@ -128,8 +141,11 @@ namespace websocketmm {
 	}
 
 	void listener::stop() {
-		boost::system::error_code ec;
-		acceptor_.cancel(ec);
+		// Accept handlers run on the acceptor's strand, so cancel it there
+		net::post(acceptor_.get_executor(), [self = shared_from_this()]() {
+			boost::system::error_code ec;
+			self->acceptor_.cancel(ec);
+		});
 	}
 
 	void listener::on_accept(beast::error_code ec, tcp::socket socket) {
@@ -1,5 +1,6 @@
 #include <websocketmm/server.h>
 #include <websocketmm/listener.h>
+#include <websocketmm/static_files.h>
 #include <websocketmm/websocket_user.h>
 
 #include <mutex>
@@ -59,6 +60,25 @@ namespace websocketmm {
 			close_handler(user);
 	}
 
+	void server::set_compression_options(const compression_options& options) {
+		std::lock_guard<std::mutex> lock(compression_lock_);
+		compression_ = options;
+	}
+
+	void server::set_doc_root(const std::string& doc_root) {
+		static_files_ = std::make_shared<static_files>(doc_root);
+	}
+
+	compression_options server::get_compression_options() {
+		std::lock_guard<std::mutex> lock(compression_lock_);
+		return compression_;
+	}
+
+	void server::resync(const std::weak_ptr<websocketmm::websocket_user>& user) {
+		if(resync_handler)
+			resync_handler(user);
+	}
+
 	bool server::send_message(std::weak_ptr<websocketmm::websocket_user>& user, const std::shared_ptr<const websocket_message>& message) {
 		try {
 			// If the user is expired,
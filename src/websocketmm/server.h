@@ -5,6 +5,7 @@
 #include <cstdint>
 #include <set>
 #include <memory>
+#include <mutex>
 #include <functional>
 
 #include <websocketmm/beast/net.h>
@@ -13,13 +14,60 @@ namespace websocketmm {
 
 	// forward declarations
 	struct listener;
+	struct session;
+	struct static_files;
 	struct websocket_user;
 
 	struct websocket_message;
 
+	/**
+	 * Per-connection send queue limits, in bytes.
+	 */
+	struct send_queue_limits {
+		/**
+		 * Once congested, a connection is caught up when its queue drains below this.
+		 */
+		std::size_t low_watermark = 256 * 1024;
+
+		/**
+		 * A connection whose queue grows past this is congested,
+		 * and droppable messages are dropped until it catches up.
+		 */
+		std::size_t high_watermark = 4 * 1024 * 1024;
+
+		/**
+		 * A connection whose queue would grow past this, even without
+		 * droppable messages, is closed.
+		 */
+		std::size_t max_bytes = 32 * 1024 * 1024;
+	};
+
+	/**
+	 * permessage-deflate settings. Changes only apply to connections made afterwards.
+	 */
+	struct compression_options {
+		bool enabled = false;
+
+		/**
+		 * The size of the window the server compresses with, from 9 to 15 bits.
+		 */
+		int window_bits = 15;
+
+		/**
+		 * How much memory zlib uses for each connection, from 1 to 9.
+		 */
+		int mem_level = 4;
+
+		/**
+		 * The zlib compression level, from 1 to 9.
+		 */
+		int level = 6;
+	};
+
 	struct server : public std::enable_shared_from_this<server> {
 		friend struct websocket_user;
 		friend struct listener;
+		friend struct session;
 
 		explicit server(net::io_context& context_);
 
@@ -31,9 +79,11 @@ namespace websocketmm {
 		//void broadcast_message(const std::shared_ptr<const websocket_message> message);
 
 		/**
-         * Broadcast a message to all connected Websocket users.
+         * Send a message to a Websocket user. Safe to call from any thread,
+         * the write is done on the user's strand.
          *
-         * \param[in] message Message to broadcast
+         * \param[in] user User to send the message to
+         * \param[in] message Message to send
          */
 		bool send_message(std::weak_ptr<websocketmm::websocket_user>& user, const std::shared_ptr<const websocket_message>& message);
 
@@ -53,6 +103,27 @@ namespace websocketmm {
 			close_handler = std::move(handler);
 		}
 
+		/**
+		 * Set the handler called when a user that had messages dropped has caught up.
+		 */
+		inline void set_resync_handler(std::function<void(std::weak_ptr<websocketmm::websocket_user>)> handler) {
+			resync_handler = std::move(handler);
+		}
+
+		inline void set_send_queue_limits(const send_queue_limits& limits) {
+			send_queue_limits_ = limits;
+		}
+
+		void set_compression_options(const compression_options& options);
+
+		/**
+		 * Serve the files in a directory to HTTP requests that aren't websocket
+		 * upgrades. Must be called before the server is started.
+		 */
+		void set_doc_root(const std::string& doc_root);
+
+		compression_options get_compression_options();
+
 	   protected:
 		//void join_to_server(websocket_user* user);
 		//void leave_server(websocket_user* user);
@@ -66,6 +137,8 @@ namespace websocketmm {
 
 		void close(const std::weak_ptr<websocketmm::websocket_user>& user);
 
+		void resync(const std::weak_ptr<websocketmm::websocket_user>& user);
+
 	   private:
 		/**
          * A reference to the io_context held here.
@@ -82,6 +155,14 @@ namespace websocketmm {
 		std::function<void(std::weak_ptr<websocket_user>)> open_handler;
 		std::function<void(std::weak_ptr<websocket_user>, std::shared_ptr<const websocket_message>)> message_handler;
 		std::function<void(std::weak_ptr<websocket_user>)> close_handler;
+		std::function<void(std::weak_ptr<websocket_user>)> resync_handler;
+
+		send_queue_limits send_queue_limits_;
+
+		std::shared_ptr<static_files> static_files_;
+
+		std::mutex compression_lock_;
+		compression_options compression_;
 	};
 
 } // namespace websocketmm
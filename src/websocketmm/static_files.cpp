@@ -0,0 +1,375 @@
+#include <websocketmm/static_files.h>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <utility>
+
+namespace websocketmm {
+
+	namespace {
+
+		beast::string_view content_type_for(beast::string_view path) {
+			const auto dot = path.rfind('.');
+			if(dot == beast::string_view::npos)
+				return "application/octet-stream";
+
+			const beast::string_view ext = path.substr(dot + 1);
+			if(beast::iequals(ext, "html") || beast::iequals(ext, "htm"))
+				return "text/html; charset=utf-8";
+			if(beast::iequals(ext, "css"))
+				return "text/css; charset=utf-8";
+			if(beast::iequals(ext, "js"))
+				return "application/javascript; charset=utf-8";
+			if(beast::iequals(ext, "json"))
+				return "application/json";
+			if(beast::iequals(ext, "txt"))
+				return "text/plain; charset=utf-8";
+			if(beast::iequals(ext, "png"))
+				return "image/png";
+			if(beast::iequals(ext, "jpg") || beast::iequals(ext, "jpeg"))
+				return "image/jpeg";
+			if(beast::iequals(ext, "gif"))
+				return "image/gif";
+			if(beast::iequals(ext, "webp"))
+				return "image/webp";
+			if(beast::iequals(ext, "svg"))
+				return "image/svg+xml";
+			if(beast::iequals(ext, "ico"))
+				return "image/x-icon";
+			if(beast::iequals(ext, "woff"))
+				return "font/woff";
+			if(beast::iequals(ext, "woff2"))
+				return "font/woff2";
+			if(beast::iequals(ext, "wasm"))
+				return "application/wasm";
+			return "application/octet-stream";
+		}
+
+		bool is_directory(const std::string& path) {
+			struct stat st;
+			return !stat(path.c_str(), &st) && S_ISDIR(st.st_mode);
+		}
+
+		bool read_file(const std::string& path, std::string& contents) {
+			struct stat st;
+			if(stat(path.c_str(), &st) || !S_ISREG(st.st_mode))
+				return false;
+
+			std::ifstream file(path, std::ios::in | std::ios::binary);
+			if(!file)
+				return false;
+
+			contents.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+			return !file.bad();
+		}
+
+		beast::string_view trim(beast::string_view str) {
+			while(!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+				str.remove_prefix(1);
+			while(!str.empty() && (str.back() == ' ' || str.back() == '\t'))
+				str.remove_suffix(1);
+			return str;
+		}
+
+		/**
+		 * Call a function with each element of a comma separated header,
+		 * until it returns true.
+		 */
+		template <class F>
+		bool any_element(beast::string_view header, F&& f) {
+			while(!header.empty()) {
+				auto comma = header.find(',');
+				if(f(trim(header.substr(0, comma))))
+					return true;
+				if(comma == beast::string_view::npos)
+					break;
+				header.remove_prefix(comma + 1);
+			}
+			return false;
+		}
+
+		/**
+		 * Whether an Accept-Encoding header allows a content coding.
+		 */
+		bool accepts_encoding(beast::string_view header, beast::string_view coding) {
+			return any_element(header, [coding](beast::string_view element) {
+				const auto semicolon = element.find(';');
+				if(!beast::iequals(trim(element.substr(0, semicolon)), coding))
+					return false;
+
+				// A quality of zero means the coding is not acceptable
+				if(semicolon != beast::string_view::npos) {
+					beast::string_view param = trim(element.substr(semicolon + 1));
+					if(param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+						return std::strtod(std::string(param.substr(2)).c_str(), nullptr) > 0;
+				}
+				return true;
+			});
+		}
+
+		bool etag_matches(beast::string_view header, beast::string_view etag) {
+			return any_element(header, [etag](beast::string_view element) {
+				// Weak comparison is used for If-None-Match
+				if(element.starts_with("W/"))
+					element.remove_prefix(2);
+				return element == "*" || element == etag;
+			});
+		}
+
+		bool parse_number(beast::string_view str, std::uint64_t& number) {
+			if(str.empty() || str.size() > 18)
+				return false;
+			number = 0;
+			for(char c : str) {
+				if(c < '0' || c > '9')
+					return false;
+				number = number * 10 + (c - '0');
+			}
+			return true;
+		}
+
+		enum class range_result {
+			none,		   // There's no usable range, so the whole file is sent
+			satisfiable,   // The range is inside the file
+			unsatisfiable  // The range is outside the file
+		};
+
+		/**
+		 * Parse a Range header with a single byte range.
+		 * Multiple ranges aren't supported, so they are ignored.
+		 */
+		range_result parse_range(beast::string_view header, std::uint64_t size, std::uint64_t& first, std::uint64_t& last) {
+			if(!header.starts_with("bytes="))
+				return range_result::none;
+			header.remove_prefix(6);
+			if(header.find(',') != beast::string_view::npos)
+				return range_result::none;
+
+			const auto dash = header.find('-');
+			if(dash == beast::string_view::npos)
+				return range_result::none;
+			const beast::string_view first_str = trim(header.substr(0, dash));
+			const beast::string_view last_str = trim(header.substr(dash + 1));
+
+			if(first_str.empty()) {
+				// A suffix range, which is the length of the end of the file
+				std::uint64_t length;
+				if(!parse_number(last_str, length))
+					return range_result::none;
+				if(!length || !size)
+					return range_result::unsatisfiable;
+				first = size - std::min(length, size);
+				last = size - 1;
+				return range_result::satisfiable;
+			}
+
+			if(!parse_number(first_str, first))
+				return range_result::none;
+			if(last_str.empty()) {
+				last = size - 1;
+			} else {
+				if(!parse_number(last_str, last) || last < first)
+					return range_result::none;
+				last = std::min(last, size - 1);
+			}
+			return first < size ? range_result::satisfiable : range_result::unsatisfiable;
+		}
+
+		/**
+		 * The value of a hex digit, or -1 if it isn't one.
+		 */
+		int hex_value(char c) {
+			if(c >= '0' && c <= '9')
+				return c - '0';
+			if(c >= 'a' && c <= 'f')
+				return c - 'a' + 10;
+			if(c >= 'A' && c <= 'F')
+				return c - 'A' + 10;
+			return -1;
+		}
+
+		/**
+		 * Percent-decode a request target, without its query string, into
+		 * a path. Returns false if the target is malformed or the decoded
+		 * path could leave the document root.
+		 */
+		bool decode_target(beast::string_view target, std::string& path) {
+			target = target.substr(0, target.find('?'));
+
+			path.clear();
+			path.reserve(target.size());
+			for(size_t i = 0; i < target.size(); i++) {
+				char c = target[i];
+				if(c == '%') {
+					int high, low;
+					if(i + 2 >= target.size() || (high = hex_value(target[i + 1])) < 0 || (low = hex_value(target[i + 2])) < 0)
+						return false;
+					c = static_cast<char>(high << 4 | low);
+					i += 2;
+				}
+				path += c;
+			}
+
+			// Checked after decoding so escapes can't hide them
+			return !path.empty() && path.front() == '/' &&
+				   path.find("..") == std::string::npos &&
+				   path.find('\\') == std::string::npos &&
+				   path.find('\0') == std::string::npos;
+		}
+
+		void set_error(static_files::response_type& res, http::status status, beast::string_view message) {
+			res.result(status);
+			res.set(http::field::content_type, "text/plain; charset=utf-8");
+			res.body() = { message.data(), message.size() };
+		}
+
+	} // namespace
+
+	static_files::static_files(std::string doc_root)
+		: doc_root_(std::move(doc_root)) {
+	}
+
+	std::shared_ptr<const static_file> static_files::get(beast::string_view target) {
+		// The query string doesn't change which file is served
+		std::string path;
+		if(!decode_target(target, path))
+			return nullptr;
+
+		if(path.back() == '/')
+			path += "index.html";
+
+		{
+			std::lock_guard<std::mutex> lock(lock_);
+			auto it = files_.find(path);
+			if(it != files_.end())
+				return it->second;
+		}
+
+		// Missing files aren't cached, so requests for random paths can't fill the cache
+		std::shared_ptr<const static_file> file = load(path);
+		if(!file)
+			return nullptr;
+
+		std::lock_guard<std::mutex> lock(lock_);
+		return files_.emplace(std::move(path), std::move(file)).first->second;
+	}
+
+	std::shared_ptr<const static_file> static_files::load(const std::string& path) {
+		auto file = std::make_shared<static_file>();
+		const std::string full_path = doc_root_ + path;
+		if(!read_file(full_path, file->body))
+			return nullptr;
+
+		read_file(full_path + ".gz", file->gzip_body);
+		read_file(full_path + ".br", file->brotli_body);
+
+		file->content_type = std::string(content_type_for(path));
+
+		char etag[40];
+		std::snprintf(etag, sizeof(etag), "%zx-%zx", std::hash<std::string>()(file->body), file->body.size());
+		file->etag = etag;
+		return file;
+	}
+
+	static_files::response_type static_files::handle_request(const http::request<http::string_body>& req, std::shared_ptr<const static_file>& file) {
+		response_type res;
+		res.version(req.version());
+		res.keep_alive(req.keep_alive());
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+
+		if(req.method() != http::verb::get && req.method() != http::verb::head) {
+			set_error(res, http::status::method_not_allowed, "Method not allowed");
+			res.set(http::field::allow, "GET, HEAD");
+			res.prepare_payload();
+			return res;
+		}
+
+		file = get(req.target());
+		if(!file) {
+			// Send directories to their index, so relative links in it work
+			const beast::string_view target = req.target().substr(0, req.target().find('?'));
+			std::string path;
+			if(decode_target(target, path) && path.back() != '/' && is_directory(doc_root_ + path)) {
+				res.result(http::status::moved_permanently);
+				res.set(http::field::location, std::string(target) + '/');
+				res.prepare_payload();
+				return res;
+			}
+
+			set_error(res, http::status::not_found, "Not found");
+			res.prepare_payload();
+			return res;
+		}
+
+		// Pick the precompressed copy if the client accepts it. Each
+		// copy has its own entity tag since it's a different representation.
+		const beast::string_view accept_encoding = req[http::field::accept_encoding];
+		beast::string_view body = file->body;
+		std::string etag = '"' + file->etag;
+		if(!file->brotli_body.empty() && accepts_encoding(accept_encoding, "br")) {
+			res.set(http::field::content_encoding, "br");
+			body = file->brotli_body;
+			etag += "-br";
+		} else if(!file->gzip_body.empty() && accepts_encoding(accept_encoding, "gzip")) {
+			res.set(http::field::content_encoding, "gzip");
+			body = file->gzip_body;
+			etag += "-gz";
+		}
+		etag += '"';
+
+		res.set(http::field::etag, etag);
+		res.set(http::field::cache_control, "no-cache");
+		res.set(http::field::vary, "Accept-Encoding");
+
+		const auto if_none_match = req.find(http::field::if_none_match);
+		if(if_none_match != req.end() && etag_matches(if_none_match->value(), etag)) {
+			res.result(http::status::not_modified);
+			return res;
+		}
+
+		res.set(http::field::content_type, file->content_type);
+
+		// Ranges are only served from the uncompressed file, and If-Range
+		// makes the whole file be sent if it has changed
+		if(body.data() == file->body.data()) {
+			res.set(http::field::accept_ranges, "bytes");
+
+			std::uint64_t first, last;
+			range_result range = range_result::none;
+			const auto range_header = req.find(http::field::range);
+			if(range_header != req.end()) {
+				const auto if_range = req.find(http::field::if_range);
+				if(if_range == req.end() || if_range->value() == etag)
+					range = parse_range(range_header->value(), body.size(), first, last);
+			}
+
+			if(range == range_result::unsatisfiable) {
+				set_error(res, http::status::range_not_satisfiable, "Range not satisfiable");
+				res.set(http::field::content_range, "bytes */" + std::to_string(body.size()));
+				res.prepare_payload();
+				return res;
+			}
+
+			if(range == range_result::satisfiable) {
+				res.result(http::status::partial_content);
+				res.set(http::field::content_range, "bytes " + std::to_string(first) + '-' + std::to_string(last) + '/' + std::to_string(body.size()));
+				body = body.substr(first, last - first + 1);
+			}
+		}
+
+		if(req.method() == http::verb::head) {
+			res.content_length(body.size());
+		} else {
+			res.body() = { body.data(), body.size() };
+			res.prepare_payload();
+		}
+		return res;
+	}
+
+} // namespace websocketmm
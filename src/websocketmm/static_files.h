@@ -0,0 +1,70 @@
+#ifndef WEBSOCKETMM_STATIC_FILES_H
+#define WEBSOCKETMM_STATIC_FILES_H
+
+#include <websocketmm/beast/beast.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace websocketmm {
+
+	/**
+	 * A file served over HTTP, held in memory.
+	 */
+	struct static_file {
+		std::string content_type;
+
+		/**
+		 * The entity tag of the file, without the quotes so the tags
+		 * of the precompressed copies can be made from it.
+		 */
+		std::string etag;
+
+		std::string body;
+
+		/**
+		 * Precompressed copies of the file, read from the .gz and .br files
+		 * next to it. Empty if there weren't any.
+		 */
+		std::string gzip_body;
+		std::string brotli_body;
+	};
+
+	/**
+	 * Serves the files under a document root. Each file is read the first
+	 * time it's requested and kept in memory for the life of the server,
+	 * so changes on disk need a restart to be picked up.
+	 */
+	struct static_files {
+		using response_type = http::response<http::span_body<const char>>;
+
+		explicit static_files(std::string doc_root);
+
+		/**
+		 * Build the response to a request. The response refers to memory
+		 * owned by the file, which is returned in file and must be kept
+		 * alive until the response is written. It may be null if the
+		 * response doesn't refer to a file.
+		 */
+		response_type handle_request(const http::request<http::string_body>& req, std::shared_ptr<const static_file>& file);
+
+	   private:
+		/**
+		 * Get a file by its request target, reading it if it isn't cached.
+		 * Returns null if the target is invalid or the file doesn't exist.
+		 */
+		std::shared_ptr<const static_file> get(beast::string_view target);
+
+		std::shared_ptr<const static_file> load(const std::string& path);
+
+		std::string doc_root_;
+
+		std::mutex lock_;
+		std::unordered_map<std::string, std::shared_ptr<const static_file>> files_;
+	};
+
+} // namespace websocketmm
+
+#endif //WEBSOCKETMM_STATIC_FILES_H
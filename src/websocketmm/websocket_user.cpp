@@ -1,6 +1,7 @@
 #include <websocketmm/websocket_user.h>
 #include <websocketmm/server.h>
 
+#include <algorithm>
 #include <utility>
 
 // Uncomment if you're going to use Websocket-- under a proxy.
@@ -30,6 +31,15 @@ namespace websocketmm {
 		return BuildWebsocketMessage(websocket_message::type::text, (std::uint8_t*)str.data(), str.length());
 	}
 
+	std::shared_ptr<const websocket_message> BuildWebsocketMessage(websocket_message::type t, std::vector<std::uint8_t>&& data, bool droppable) {
+		auto m = std::make_shared<websocket_message>();
+
+		m->message_type = t;
+		m->data = std::move(data);
+		m->droppable = droppable;
+		return m;
+	}
+
 	// TODO utf-16 overloads
 
 	websocket_user::websocket_user(std::shared_ptr<server> server, tcp::socket&& socket)
@@ -66,8 +76,24 @@ namespace websocketmm {
 		return proxy_address_.value();
 	}
 
+	send_queue_stats websocket_user::GetSendQueueStats() const {
+		return {
+			queued_messages_.load(std::memory_order_relaxed),
+			queued_bytes_.load(std::memory_order_relaxed),
+			peak_queued_bytes_.load(std::memory_order_relaxed),
+			dropped_messages_.load(std::memory_order_relaxed),
+			dropped_bytes_.load(std::memory_order_relaxed)
+		};
+	}
+
 	// private API fun
 
+	/**
+	 * The most text messages are allowed to add up to when they are concatenated
+	 * into one frame. A single message larger than this is still written alone.
+	 */
+	constexpr std::size_t max_write_batch_bytes = 256 * 1024;
+
 	void websocket_user::run(http::request<http::string_body> upgrade) {
 		upgrade_request_ = upgrade;
 
@@ -89,10 +115,20 @@ namespace websocketmm {
 				res.set(http::field::sec_websocket_protocol, selected_subprotocol_.value());
 		}));
 
+		// Write each message or batch of messages as a single frame.
+		// Otherwise Beast splits anything larger than its write buffer into 4 KiB frames.
+		ws_.auto_fragment(false);
+
 		// Enable permessage deflate
-		//		websocket::permessage_deflate deflate;
-		//		deflate.server_enable = true;
-		//		ws_.set_option(deflate);
+		const compression_options compression = server_->get_compression_options();
+		if(compression.enabled) {
+			websocket::permessage_deflate deflate;
+			deflate.server_enable = true;
+			deflate.server_max_window_bits = compression.window_bits;
+			deflate.memLevel = compression.mem_level;
+			deflate.compLevel = compression.level;
+			ws_.set_option(deflate);
+		}
 
 		// We wrap validation and accepting inside of the strand we were given by the
 		// listener object to avoid concurrency issues.
@@ -211,27 +247,95 @@ namespace websocketmm {
 		if(closing_)
 			return;
 
+		const auto& limits = server_->send_queue_limits_;
+		const std::size_t size = message->data.size();
+
+		// Don't queue anything that can be dropped until the user has caught up.
+		if(congested_ && message->droppable) {
+			drop_message(message);
+			return;
+		}
+
+		// The user isn't even keeping up with messages that can't be dropped,
+		// so give up on them rather than let the queue grow forever.
+		if(queued_bytes_ + size > limits.max_bytes) {
+			closing_ = true;
+			server_->close(weak_from_this());
+			close();
+			return;
+		}
+
 		message_queue_.push_back(message);
+		queued_messages_ = message_queue_.size();
+		queued_bytes_ += size;
+		if(queued_bytes_ > peak_queued_bytes_)
+			peak_queued_bytes_ = queued_bytes_.load();
+
+		if(!congested_ && queued_bytes_ > limits.high_watermark) {
+			congested_ = true;
+			drop_queued_messages();
+		}
 
 		// If we are already trying to write a message,
 		// return early so that whatever is writing can do it for us.
-		if(message_queue_.size() > 1)
+		if(writing_)
 			return;
 
 		// Otherwise, we should write the message immediately.
-		write_message(message_queue_.front());
+		write_messages();
+	}
+
+	void websocket_user::drop_message(const std::shared_ptr<const websocket_message>& message) {
+		dropped_messages_++;
+		dropped_bytes_ += message->data.size();
+		resync_pending_ = true;
+	}
+
+	void websocket_user::drop_queued_messages() {
+		// The messages being written have to stay
+		auto first = message_queue_.begin() + writing_;
+		auto end = std::remove_if(first, message_queue_.end(), [this](const std::shared_ptr<const websocket_message>& message) {
+			if(!message->droppable)
+				return false;
+
+			queued_bytes_ -= message->data.size();
+			drop_message(message);
+			return true;
+		});
+		message_queue_.erase(end, message_queue_.end());
+		queued_messages_ = message_queue_.size();
 	}
 
-	void websocket_user::write_message(const std::shared_ptr<const websocket_message>& message) {
+	void websocket_user::write_messages() {
 		// Return immediately if the socket is pending a close,
 		// so we can empty the message queue without scheduling writes
 		// (which is bad once the closing sequence has begin)
 		if(closing_)
 			return;
 
+		const auto& front = message_queue_.front();
+		write_buffers_.clear();
+		write_buffers_.push_back(net::buffer(front->data));
+		writing_ = 1;
+
+		// Guacamole instructions can be concatenated, so every text message
+		// waiting behind the first one is sent in the same frame.
+		std::size_t size = front->data.size();
+		if(front->message_type == websocket_message::type::text) {
+			for(; writing_ < message_queue_.size(); writing_++) {
+				const auto& message = message_queue_[writing_];
+				if(message->message_type != websocket_message::type::text ||
+				   size + message->data.size() > max_write_batch_bytes)
+					break;
+
+				size += message->data.size();
+				write_buffers_.push_back(net::buffer(message->data));
+			}
+		}
+
 		// Configure the message type and schedule a asynchronous write.
-		ws_.binary(message->message_type == websocket_message::type::binary);
-		ws_.async_write(net::buffer(message->data), beast::bind_front_handler(&websocket_user::on_write, shared_from_this()));
+		ws_.binary(front->message_type == websocket_message::type::binary);
+		ws_.async_write(write_buffers_, beast::bind_front_handler(&websocket_user::on_write, shared_from_this()));
 	}
 
 	void websocket_user::on_write(beast::error_code ec, std::size_t bytes_transferred) {
@@ -239,14 +343,31 @@ namespace websocketmm {
 
 		if(ec) {
 			message_queue_.clear();
+			writing_ = 0;
+			queued_messages_ = 0;
+			queued_bytes_ = 0;
 			return;
 		}
 
-		message_queue_.erase(message_queue_.begin());
+		for(; writing_; writing_--) {
+			queued_bytes_ -= message_queue_.front()->data.size();
+			message_queue_.pop_front();
+		}
+		queued_messages_ = message_queue_.size();
+
+		// Once the user has caught up, let the server replace what was dropped
+		if(congested_ && queued_bytes_ <= server_->send_queue_limits_.low_watermark) {
+			congested_ = false;
+
+			if(resync_pending_) {
+				resync_pending_ = false;
+				server_->resync(weak_from_this());
+			}
+		}
 
 		// Write more messages to empty the queue
 		if(!message_queue_.empty())
-			write_message(message_queue_.front());
+			write_messages();
 	}
 
 	void websocket_user::close() {
@@ -4,7 +4,9 @@
 #include <websocketmm/beast/net.h>
 #include <websocketmm/beast/beast.h>
 
+#include <atomic>
 #include <cstdint>
+#include <deque>
 #include <memory>
 #include <vector>
 #include <optional> // wow, we can use this now!
@@ -22,6 +24,24 @@ namespace websocketmm {
 
 		type message_type;
 		std::vector<std::uint8_t> data;
+
+		/**
+		 * Whether the message may be dropped when the receiving user can't keep up.
+		 * The server's resync handler is called once the user has caught up,
+		 * so whatever was dropped can be replaced.
+		 */
+		bool droppable { false };
+	};
+
+	/**
+	 * Send queue metrics for a single connection.
+	 */
+	struct send_queue_stats {
+		std::size_t messages;
+		std::size_t bytes;
+		std::size_t peak_bytes;
+		std::uint64_t dropped_messages;
+		std::uint64_t dropped_bytes;
 	};
 
 	/**
@@ -30,6 +50,11 @@ namespace websocketmm {
 	std::shared_ptr<const websocket_message> BuildWebsocketMessage(websocket_message::type t, std::uint8_t* data, std::size_t size);
 	std::shared_ptr<const websocket_message> BuildWebsocketMessage(const std::string& str);
 
+	/**
+	 * Build a websocket message which takes ownership of an existing buffer, without copying it.
+	 */
+	std::shared_ptr<const websocket_message> BuildWebsocketMessage(websocket_message::type t, std::vector<std::uint8_t>&& data, bool droppable = false);
+
 	struct server;
 
 	/**
@@ -83,6 +108,12 @@ namespace websocketmm {
 
 		net::ip::address GetAddress();
 
+		/**
+		 * Get the current state of this user's send queue.
+		 * Safe to call from any thread.
+		 */
+		send_queue_stats GetSendQueueStats() const;
+
 		/**
 		 * Close the WebSocket connection.
 		 * This function also clears the send queue for this connection entirely,
@@ -103,7 +134,18 @@ namespace websocketmm {
 
 		void on_close(beast::error_code ec);
 
-		void write_message(const std::shared_ptr<const websocket_message>& message);
+		/**
+		 * Write the messages at the front of the queue. Consecutive text messages
+		 * are concatenated into a single frame, up to a size limit.
+		 */
+		void write_messages();
+
+		/**
+		 * Drop every droppable message in the queue, except the ones being written.
+		 */
+		void drop_queued_messages();
+
+		void drop_message(const std::shared_ptr<const websocket_message>& message);
 
 		std::shared_ptr<server> server_;
 		per_user_data user_data_;
@@ -129,10 +171,38 @@ namespace websocketmm {
 		 */
 		bool closing_{false};
 
+		/**
+		 * True once the queue has grown past the high watermark, until it drains
+		 * below the low watermark. Droppable messages are dropped while set.
+		 */
+		bool congested_{false};
+
+		/**
+		 * True if messages have been dropped since the resync handler was last called.
+		 */
+		bool resync_pending_{false};
+
 		/**
 		 * internal queue of websocket messages
 		 */
-		std::vector<std::shared_ptr<const websocket_message>> message_queue_;
+		std::deque<std::shared_ptr<const websocket_message>> message_queue_;
+
+		/**
+		 * The number of messages at the front of the queue being written.
+		 */
+		std::size_t writing_{0};
+
+		/**
+		 * The buffers of the messages being written, reused between writes.
+		 */
+		std::vector<net::const_buffer> write_buffers_;
+
+		// Send queue metrics, written on the strand but readable from anywhere.
+		std::atomic<std::size_t> queued_bytes_{0};
+		std::atomic<std::size_t> queued_messages_{0};
+		std::atomic<std::size_t> peak_queued_bytes_{0};
+		std::atomic<std::uint64_t> dropped_messages_{0};
+		std::atomic<std::uint64_t> dropped_bytes_{0};
 	};
 } // namespace websocketmm
 
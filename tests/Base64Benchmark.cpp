@@ -0,0 +1,63 @@
+// Throughput benchmark for the base64 encoders, as used for PNG and JPEG
+// image data. Build with "make bench" and run bin/base64-benchmark [repeats].
+
+// The encoders are static, so they are benchmarked through the source file itself
+#include "Base64.cpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+/**
+ * Returns the best throughput of encoding the input, in MiB/s of input.
+ */
+static double Throughput(EncodeBlockFn encode, const std::vector<unsigned char>& input, std::vector<char>& output, int repeats) {
+	double best = 0;
+	for(int i = 0; i < repeats; i++) {
+		auto start = steady_clock::now();
+		encode(input.data(), input.size(), output.data());
+		double elapsed = duration<double>(steady_clock::now() - start).count();
+		double throughput = input.size() / elapsed / (1024 * 1024);
+		if(throughput > best)
+			best = throughput;
+	}
+	return best;
+}
+
+int main(int argc, char** argv) {
+	int repeats = argc > 1 ? std::atoi(argv[1]) : 50;
+
+	struct Encoder {
+		const char* name;
+		EncodeBlockFn fn;
+		bool supported;
+	};
+	std::vector<Encoder> encoders = { { "scalar", EncodeBlockScalar, true } };
+#ifdef BASE64_USE_X86_SIMD
+	__builtin_cpu_init();
+	encoders.push_back({ "SSSE3", EncodeBlockSSSE3, __builtin_cpu_supports("ssse3") != 0 });
+	encoders.push_back({ "AVX2", EncodeBlockAVX2, __builtin_cpu_supports("avx2") != 0 });
+#endif
+	encoders.push_back({ "EncodeBlock", Base64::EncodeBlock, true });
+
+	// A small image update and a large one
+	const size_t sizes[] = { 4 * 1024 / 3 * 3, 1024 * 1024 / 3 * 3 };
+	std::mt19937 rng(1);
+	for(size_t size : sizes) {
+		std::vector<unsigned char> input(size);
+		for(unsigned char& c : input)
+			c = rng();
+		std::vector<char> output(size / 3 * 4);
+
+		for(const Encoder& encoder : encoders) {
+			if(encoder.supported)
+				std::printf("%7zu bytes %-11s %.0f MiB/s\n", size, encoder.name, Throughput(encoder.fn, input, output, repeats));
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,116 @@
+// Checks that the SSSE3 and AVX2 base64 encoders give exactly the same
+// output as the portable one, and that Base64 matches a reference encoder.
+// Build and run with "make test".
+
+// The encoders are static, so they are tested through the source file itself
+#include "Base64.cpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * Straightforward encoder with padding, used as the reference.
+ */
+static std::string Reference(const unsigned char* in, size_t count) {
+	std::string out;
+	for(size_t i = 0; i < count; i += 3) {
+		unsigned int triplet = in[i] << 16;
+		if(i + 1 < count)
+			triplet |= in[i + 1] << 8;
+		if(i + 2 < count)
+			triplet |= in[i + 2];
+
+		out += __guac_socket_BASE64_CHARACTERS[(triplet >> 18) & 0x3F];
+		out += __guac_socket_BASE64_CHARACTERS[(triplet >> 12) & 0x3F];
+		out += i + 1 < count ? __guac_socket_BASE64_CHARACTERS[(triplet >> 6) & 0x3F] : '=';
+		out += i + 2 < count ? __guac_socket_BASE64_CHARACTERS[triplet & 0x3F] : '=';
+	}
+	return out;
+}
+
+int main() {
+	std::mt19937 rng(1);
+	int failures = 0;
+	int cases = 0;
+
+	std::vector<unsigned char> input(4096 + 64);
+	for(unsigned char& c : input)
+		c = rng();
+	// Make sure every 6-bit index, and so every output range, is covered
+	for(int i = 0; i < 48; i++)
+		input[i] = static_cast<unsigned char>(i * 0x55 + (i >> 2));
+
+#ifdef BASE64_USE_X86_SIMD
+	struct Encoder {
+		const char* name;
+		EncodeBlockFn fn;
+		bool supported;
+	};
+	__builtin_cpu_init();
+	const Encoder encoders[] = {
+		{ "SSSE3", EncodeBlockSSSE3, __builtin_cpu_supports("ssse3") != 0 },
+		{ "AVX2", EncodeBlockAVX2, __builtin_cpu_supports("avx2") != 0 }
+	};
+
+	for(const Encoder& encoder : encoders) {
+		if(!encoder.supported) {
+			std::printf("%s: not supported by this CPU, skipped\n", encoder.name);
+			continue;
+		}
+
+		// Every length up to several iterations of both vector loops, which
+		// covers each tail length and both sides of the 16 and 28 byte
+		// thresholds, from unaligned inputs and outputs
+		for(size_t count = 0; count <= 32 * 3; count += 3) {
+			for(size_t offset = 0; offset < 4; offset++) {
+				const unsigned char* in = input.data() + offset;
+				std::vector<char> expected(count / 3 * 4 + 8, '#');
+				std::vector<char> actual(expected.size() + offset, '#');
+				EncodeBlockScalar(in, count, expected.data());
+				encoder.fn(in, count, actual.data() + offset);
+				cases++;
+				// Nothing may be written past the end of the output either
+				if(!std::equal(expected.begin(), expected.end(), actual.begin() + offset)) {
+					std::printf("%s: mismatch at length %zu, offset %zu\n", encoder.name, count, offset);
+					failures++;
+				}
+			}
+		}
+
+		// A long block, like a whole PNG
+		std::vector<char> expected(4096 / 3 * 4);
+		std::vector<char> actual(expected.size());
+		EncodeBlockScalar(input.data(), 4096 / 3 * 3, expected.data());
+		encoder.fn(input.data(), 4096 / 3 * 3, actual.data());
+		cases++;
+		if(expected != actual) {
+			std::printf("%s: mismatch on a long block\n", encoder.name);
+			failures++;
+		}
+	}
+#endif
+
+	// Whole writes of every length, and the same data written in pieces so
+	// the partial triplets left between writes are covered
+	for(size_t count = 0; count < 200; count++) {
+		std::string expected = Reference(input.data(), count);
+		for(size_t piece = 1; piece <= 32; piece++) {
+			GuacBuffer buffer;
+			Base64 base64(buffer);
+			for(size_t i = 0; i < count; i += piece)
+				base64.WriteBase64(input.data() + i, std::min(piece, count - i));
+			base64.FlushBase64();
+			cases++;
+			if(std::string(reinterpret_cast<const char*>(buffer.Data()), buffer.Size()) != expected) {
+				std::printf("Base64: mismatch at length %zu written %zu bytes at a time\n", count, piece);
+				failures++;
+			}
+		}
+	}
+
+	std::printf("%d cases, %d failures\n", cases, failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,153 @@
+// Throughput benchmark for the Guacamole instruction decoder and stream,
+// and for building the instructions sent to clients.
+// Build with "make bench" and run bin/instruction-benchmark [iterations].
+#include "GuacInstructionParser.h"
+#include "GuacInstructionStream.h"
+#include "GuacSocket.h"
+#include "guacamole/layer.h"
+#include "guacamole/protocol.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <websocketmm/websocket_user.h>
+
+using namespace GuacInstructionParser;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+/**
+ * Builds a message like the ones a client sends while it has a turn:
+ * mostly mouse moves, with some keys and the occasional chat message.
+ */
+static std::vector<std::uint8_t> BuildMessage(size_t& instructions) {
+	std::string message;
+	instructions = 0;
+	for(int i = 0; i < 64; i++) {
+		std::string x = std::to_string(100 + i * 7);
+		std::string y = std::to_string(200 + i * 3);
+		message += "5.mouse," + std::to_string(x.length()) + '.' + x + ',' + std::to_string(y.length()) + '.' + y + ",1.0;";
+		instructions++;
+		if(i % 8 == 0) {
+			message += "3.key,5.65307,1.1;3.key,5.65307,1.0;";
+			instructions += 2;
+		}
+		if(i % 32 == 0) {
+			message += "4.chat,43.The quick brown fox jumps over the lazy dog;";
+			instructions++;
+		}
+	}
+	return std::vector<std::uint8_t>(message.begin(), message.end());
+}
+
+/**
+ * Takes each instruction out of the buffer once it is finished, like
+ * GuacWebSocket does before handing it to the websocket.
+ */
+class ReleasingSocket : public GuacSocket {
+   public:
+	void InstructionBegin() override {
+		mutex_.lock();
+	}
+
+	void InstructionEnd() override {
+		bytes += buffer_.Release().size();
+		mutex_.unlock();
+	}
+
+	size_t bytes = 0;
+};
+
+static void Report(const char* name, duration<double> elapsed, size_t instructions, size_t bytes) {
+	std::cout << name << ": " << elapsed.count() * 1e9 / instructions << " ns/instruction, "
+			  << bytes / elapsed.count() / (1024 * 1024) << " MiB/s" << std::endl;
+}
+
+int main(int argc, char** argv) {
+	size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+	size_t per_message;
+	std::vector<std::uint8_t> data = BuildMessage(per_message);
+	auto message = websocketmm::BuildWebsocketMessage(websocketmm::websocket_message::type::text, std::vector<std::uint8_t>(data));
+
+	// Split messages into instructions
+	size_t found = 0;
+	GuacInstructionStream stream;
+	std::shared_ptr<const websocketmm::websocket_message> instruction;
+	size_t offset;
+	size_t length;
+	auto start = steady_clock::now();
+	for(size_t i = 0; i < iterations; i++) {
+		stream.Feed(message);
+		while(stream.Next(instruction, offset, length) == GuacInstructionStream::Status::kComplete)
+			found++;
+	}
+	Report("GuacInstructionStream::Next", steady_clock::now() - start, found, data.size() * iterations);
+	if(found != per_message * iterations) {
+		std::cout << "Expected " << per_message * iterations << " instructions, found " << found << std::endl;
+		return 1;
+	}
+
+	// Decode each instruction from a copy, as ParseInstruction does
+	std::vector<std::pair<size_t, size_t>> bounds;
+	stream.Feed(message);
+	while(stream.Next(instruction, offset, length) == GuacInstructionStream::Status::kComplete)
+		bounds.emplace_back(offset, length);
+
+	char buffer[MAX_GUAC_FRAME_LENGTH];
+	std::string_view opcode;
+	GuacArguments args;
+	size_t decoded = 0;
+	start = steady_clock::now();
+	for(size_t i = 0; i < iterations; i++) {
+		for(const auto& [position, instruction_length] : bounds) {
+			std::memcpy(buffer, data.data() + position, instruction_length);
+			if(DecodeInstruction(buffer, instruction_length, opcode, args) != static_cast<int>(instruction_length)) {
+				std::cout << "Failed to decode an instruction" << std::endl;
+				return 1;
+			}
+			decoded++;
+		}
+	}
+	Report("DecodeInstruction", steady_clock::now() - start, decoded, data.size() * iterations);
+
+	// Build the instructions sent most often to clients
+	guac_layer layer = { 0 };
+	ReleasingSocket socket;
+	const size_t sent = iterations * 64;
+	start = steady_clock::now();
+	for(size_t i = 0; i < sent; i++)
+		guac_protocol_send_move(socket, &layer, &layer, i % 1024, i % 768, 0);
+	Report("guac_protocol_send_move", steady_clock::now() - start, sent, socket.bytes);
+
+	socket.bytes = 0;
+	start = steady_clock::now();
+	for(size_t i = 0; i < sent; i++)
+		guac_protocol_send_sync(socket, 1600000000000 + i);
+	Report("guac_protocol_send_sync", steady_clock::now() - start, sent, socket.bytes);
+
+	// A small screen update, like most of the ones a VM sends
+	cairo_surface_t* surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, 64, 64);
+	unsigned char* pixels = cairo_image_surface_get_data(surface);
+	const int stride = cairo_image_surface_get_stride(surface);
+	for(int y = 0; y < 64; y++) {
+		for(int x = 0; x < 64; x++)
+			reinterpret_cast<std::uint32_t*>(pixels + y * stride)[x] = (x * 4) << 16 | (y * 4) << 8 | ((x ^ y) & 0x10 ? 0xFF : 0);
+	}
+	cairo_surface_mark_dirty(surface);
+
+	const size_t images = std::max<size_t>(iterations / 4, 1);
+	socket.bytes = 0;
+	start = steady_clock::now();
+	for(size_t i = 0; i < images; i++)
+		guac_protocol_send_png(socket, GUAC_COMP_OVER, &layer, 0, 0, surface);
+	Report("guac_protocol_send_png (64x64)", steady_clock::now() - start, images, socket.bytes);
+	cairo_surface_destroy(surface);
+	return 0;
+}
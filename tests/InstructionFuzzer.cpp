@@ -0,0 +1,75 @@
+// libFuzzer target for the Guacamole instruction decoder and stream.
+// Build with "make fuzz" (requires clang) and run bin/instruction-fuzzer.
+#include "GuacInstructionParser.h"
+#include "GuacInstructionStream.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <string_view>
+#include <vector>
+
+#include <websocketmm/websocket_user.h>
+
+using namespace GuacInstructionParser;
+
+/**
+ * Decodes a copy of the buffer and checks that everything the decoder
+ * returned lies inside it.
+ */
+static int CheckDecode(const std::uint8_t* data, size_t size) {
+	std::vector<char> buffer(data, data + size);
+	std::string_view opcode;
+	GuacArguments args;
+	int decoded = DecodeInstruction(buffer.data(), buffer.size(), opcode, args);
+	if(decoded < -1 || decoded > static_cast<int>(size))
+		std::abort();
+
+	if(decoded > 0) {
+		const char* begin = buffer.data();
+		const char* end = begin + decoded;
+		if(opcode.data() < begin || opcode.data() + opcode.length() >= end || opcode.data()[opcode.length()] != '\0')
+			std::abort();
+		for(size_t i = 0; i < args.size(); i++) {
+			std::string_view arg = args.view(i);
+			if(arg.data() < begin || arg.data() + arg.length() >= end || arg.data()[arg.length()] != '\0')
+				std::abort();
+		}
+	}
+	return decoded;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, size_t size) {
+	CheckDecode(data, size);
+
+	if(!size)
+		return 0;
+
+	// The first byte chooses how the rest is split into messages, so
+	// instructions that span messages are covered too
+	size_t chunk_size = data[0] + 1;
+	data++;
+	size--;
+
+	GuacInstructionStream stream;
+	for(size_t position = 0; position < size; position += chunk_size) {
+		size_t length = std::min(chunk_size, size - position);
+		stream.Feed(websocketmm::BuildWebsocketMessage(websocketmm::websocket_message::type::text,
+													   std::vector<std::uint8_t>(data + position, data + position + length)));
+
+		std::shared_ptr<const websocketmm::websocket_message> instruction;
+		size_t offset;
+		size_t instruction_length;
+		while(stream.Next(instruction, offset, instruction_length) == GuacInstructionStream::Status::kComplete) {
+			if(!instruction_length || offset + instruction_length > instruction->data.size() ||
+			   instruction->data[offset + instruction_length - 1] != ';')
+				std::abort();
+
+			// The decoder must accept exactly what the stream split off,
+			// unless it has more arguments than the decoder allows
+			int decoded = CheckDecode(instruction->data.data() + offset, instruction_length);
+			if(decoded != static_cast<int>(instruction_length) && decoded != -1)
+				std::abort();
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,83 @@
+// Benchmark for the row kernels used by surface puts, putting a whole
+// frame at common screen sizes with the portable, SSE2 and AVX2 kernels.
+// Build with "make bench" and run bin/surface-put-benchmark [repeats].
+
+// The kernels are static, so they are benchmarked through the source file itself
+#include "guacamole/guac_surface.cpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
+
+/**
+ * Returns the best time of putting a frame, in milliseconds. Before each
+ * put the destination is reset so the same pixels change every time.
+ */
+static double TimePut(__guac_common_surface_put_row_fn* kernel, const std::vector<uint32_t>& frame,
+					  const std::vector<uint32_t>& previous, int width, int height, int repeats) {
+	std::vector<uint32_t> dst;
+	double best = 0;
+	for(int i = 0; i < repeats; i++) {
+		dst = previous;
+		auto start = steady_clock::now();
+		int first, last;
+		int changed_rows = 0;
+		for(int y = 0; y < height; y++)
+			changed_rows += kernel(&frame[y * width], &dst[y * width], width, &first, &last);
+		double elapsed = duration<double, std::milli>(steady_clock::now() - start).count();
+		if(!i || elapsed < best)
+			best = elapsed;
+		if(changed_rows < 0)
+			std::abort();
+	}
+	return best;
+}
+
+int main(int argc, char** argv) {
+	int repeats = argc > 1 ? std::atoi(argv[1]) : 20;
+
+	struct Kernel {
+		const char* name;
+		__guac_common_surface_put_row_fn* fn;
+		bool supported;
+	};
+	std::vector<Kernel> kernels = { { "scalar", __guac_common_surface_put_row, true } };
+#ifdef GUAC_SURFACE_USE_X86_SIMD
+	__builtin_cpu_init();
+	kernels.push_back({ "SSE2", __guac_common_surface_put_row_sse2, __builtin_cpu_supports("sse2") != 0 });
+	kernels.push_back({ "AVX2", __guac_common_surface_put_row_avx2, __builtin_cpu_supports("avx2") != 0 });
+#endif
+
+	const int sizes[][2] = { { 1024, 768 }, { 1920, 1080 } };
+	std::mt19937 rng(1);
+	for(const auto& size : sizes) {
+		const int width = size[0];
+		const int height = size[1];
+
+		std::vector<uint32_t> previous(width * height);
+		for(uint32_t& pixel : previous)
+			pixel = rng() | 0xFF000000;
+
+		// VNC updates mostly cover pixels that are already on the screen
+		std::vector<uint32_t> frame(previous);
+		for(uint32_t& pixel : frame) {
+			pixel &= 0x00FFFFFF;
+			if(rng() % 100 == 0)
+				pixel ^= 0x00808080;
+		}
+
+		for(const Kernel& kernel : kernels) {
+			if(!kernel.supported)
+				continue;
+			std::printf("%dx%d %-6s 1%% changed: %.3f ms, unchanged: %.3f ms\n", width, height, kernel.name,
+						TimePut(kernel.fn, frame, previous, width, height, repeats),
+						TimePut(kernel.fn, previous, previous, width, height, repeats));
+		}
+	}
+	return 0;
+}
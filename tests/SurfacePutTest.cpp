@@ -0,0 +1,122 @@
+// Checks that the SSE2 and AVX2 row kernels used by surface puts give
+// exactly the same result as the portable one.
+// Build and run with "make test".
+
+// The kernels are static, so they are tested through the source file itself
+#include "guacamole/guac_surface.cpp"
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+/**
+ * The result of putting a rectangle with one of the row kernels.
+ */
+struct PutResult {
+	std::vector<uint32_t> dst;
+	bool changed = false;
+	int min_x = 0;
+	int min_y = 0;
+	int max_x = 0;
+	int max_y = 0;
+};
+
+/**
+ * Puts a rectangle row by row like __guac_common_surface_put does for
+ * opaque sources, using the given kernel.
+ */
+static PutResult Put(__guac_common_surface_put_row_fn* kernel, const std::vector<uint32_t>& src, int src_stride, int sx,
+					 std::vector<uint32_t> dst, int dst_stride, int dx, int width, int height) {
+	PutResult result;
+	for(int y = 0; y < height; y++) {
+		int first, last;
+		if(kernel(&src[y * src_stride + sx], &dst[y * dst_stride + dx], width, &first, &last)) {
+			if(!result.changed) {
+				result.min_x = first;
+				result.min_y = y;
+				result.max_x = last;
+			}
+			result.min_x = std::min(result.min_x, first);
+			result.max_x = std::max(result.max_x, last);
+			result.max_y = y;
+			result.changed = true;
+		}
+	}
+	result.dst = std::move(dst);
+	return result;
+}
+
+static bool Same(const PutResult& a, const PutResult& b) {
+	if(a.dst != b.dst || a.changed != b.changed)
+		return false;
+	return !a.changed || (a.min_x == b.min_x && a.min_y == b.min_y && a.max_x == b.max_x && a.max_y == b.max_y);
+}
+
+int main() {
+	struct Kernel {
+		const char* name;
+		__guac_common_surface_put_row_fn* fn;
+		bool supported;
+	};
+	std::vector<Kernel> kernels;
+#ifdef GUAC_SURFACE_USE_X86_SIMD
+	__builtin_cpu_init();
+	kernels.push_back({ "SSE2", __guac_common_surface_put_row_sse2, __builtin_cpu_supports("sse2") != 0 });
+	kernels.push_back({ "AVX2", __guac_common_surface_put_row_avx2, __builtin_cpu_supports("avx2") != 0 });
+#endif
+
+	std::mt19937 rng(1);
+	int failures = 0;
+	int cases = 0;
+	for(const Kernel& kernel : kernels) {
+		if(!kernel.supported) {
+			std::printf("%s: not supported by this CPU, skipped\n", kernel.name);
+			continue;
+		}
+
+		// Every width up to a few vectors, with the rows starting at
+		// unaligned offsets and padded to different strides
+		for(int width = 1; width <= 67; width++) {
+			for(int padding = 0; padding <= 3; padding++) {
+				for(int change = 0; change < 4; change++) {
+					const int height = 5;
+					const int sx = padding;
+					const int dx = 3 - padding;
+					const int src_stride = width + sx + padding;
+					const int dst_stride = width + dx + 2 * padding + 1;
+
+					std::vector<uint32_t> src(src_stride * height);
+					std::vector<uint32_t> dst(dst_stride * height);
+					for(uint32_t& pixel : dst)
+						pixel = rng() | 0xFF000000;
+
+					// Sources carry an arbitrary X byte, so pixels can match
+					// the destination even when their top byte differs
+					for(int y = 0; y < height; y++) {
+						for(int x = 0; x < width; x++) {
+							uint32_t& pixel = src[y * src_stride + sx + x];
+							pixel = dst[y * dst_stride + dx + x] & 0x00FFFFFF;
+							if(rng() & 1)
+								pixel |= rng() & 0xFF000000;
+							// 0: nothing changes, 1: one pixel, 2: sparse, 3: everything
+							if((change == 1 && y == 2 && x == (width - 1) / 2) || (change == 2 && rng() % 7 == 0) ||
+							   change == 3)
+								pixel ^= 1 + rng() % 0xFFFFFF;
+						}
+					}
+
+					PutResult expected = Put(__guac_common_surface_put_row, src, src_stride, sx, dst, dst_stride, dx, width, height);
+					PutResult actual = Put(kernel.fn, src, src_stride, sx, dst, dst_stride, dx, width, height);
+					cases++;
+					if(!Same(expected, actual)) {
+						std::printf("%s: mismatch at width %d, padding %d, change %d\n", kernel.name, width, padding, change);
+						failures++;
+					}
+				}
+			}
+		}
+	}
+
+	std::printf("%d cases, %d failures\n", cases, failures);
+	return failures ? 1 : 0;
+}